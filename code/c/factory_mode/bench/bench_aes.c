@@ -0,0 +1,342 @@
+/*
+ *  bench_aes.c
+ *
+ *  Description: T-table and AES-NI baselines for swan_bench; see bench_aes.h. The
+ *  T-tables are computed on the first key setup instead of being spelled out.
+ */
+
+#include <string.h>
+#include "bench_aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define BENCH_AES_NI
+#endif
+
+static uint8_t sbox[256], inv_sbox[256];
+static uint32_t te[4][256], td[4][256];
+static int tables_ready;
+
+static uint8_t xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ (x & 0x80 ? 0x1b : 0));
+}
+
+static uint8_t gmul(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+
+    for (; b != 0; b >>= 1, a = xtime(a))
+        p ^= b & 1 ? a : 0;
+    return p;
+}
+
+static uint32_t ror8(uint32_t w)
+{
+    return w >> 8 | w << 24;
+}
+
+static void tables_init(void)
+{
+    uint8_t inv, s;
+    unsigned x, i;
+
+    for (x = 0; x < 256; x++)
+    {
+        //the inverse is x^254;
+        for (inv = 1, i = 0; i < 254; i++)
+            inv = gmul(inv, (uint8_t)x);
+        s = inv ^ (uint8_t)(inv << 1 | inv >> 7) ^ (uint8_t)(inv << 2 | inv >> 6) ^ (uint8_t)(inv << 3 | inv >> 5) ^
+            (uint8_t)(inv << 4 | inv >> 4) ^ 0x63;
+        sbox[x] = s;
+        inv_sbox[s] = (uint8_t)x;
+    }
+    for (x = 0; x < 256; x++)
+    {
+        s = sbox[x];
+        te[0][x] = (uint32_t)gmul(s, 2) << 24 | (uint32_t)s << 16 | (uint32_t)s << 8 | gmul(s, 3);
+        s = inv_sbox[x];
+        td[0][x] = (uint32_t)gmul(s, 14) << 24 | (uint32_t)gmul(s, 9) << 16 | (uint32_t)gmul(s, 13) << 8 | gmul(s, 11);
+        for (i = 1; i < 4; i++)
+        {
+            te[i][x] = ror8(te[i - 1][x]);
+            td[i][x] = ror8(td[i - 1][x]);
+        }
+    }
+    tables_ready = 1;
+}
+
+static uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void store32(uint8_t *p, uint32_t w)
+{
+    p[0] = (uint8_t)(w >> 24);
+    p[1] = (uint8_t)(w >> 16);
+    p[2] = (uint8_t)(w >> 8);
+    p[3] = (uint8_t)w;
+}
+
+static uint32_t sub_word(uint32_t w)
+{
+    return (uint32_t)sbox[w >> 24] << 24 | (uint32_t)sbox[(w >> 16) & 0xff] << 16 |
+           (uint32_t)sbox[(w >> 8) & 0xff] << 8 | sbox[w & 0xff];
+}
+
+int bench_aes_set_key(bench_aes *a, const uint8_t *key, unsigned bits)
+{
+    unsigned nk = bits / 32, n, i, r;
+    uint32_t t, rcon = 0x01;
+    uint32_t *dk;
+
+    if (bits != 128 && bits != 256)
+        return -1;
+    if (!tables_ready)
+        tables_init();
+    a->rounds = nk + 6;
+    n = 4 * (a->rounds + 1);
+    for (i = 0; i < nk; i++)
+        a->ek[i] = load32(key + 4 * i);
+    for (; i < n; i++)
+    {
+        t = a->ek[i - 1];
+        if (i % nk == 0)
+        {
+            t = sub_word(t << 8 | t >> 24) ^ rcon << 24;
+            rcon = xtime((uint8_t)rcon);
+        }
+        else if (nk == 8 && i % nk == 4)
+            t = sub_word(t);
+        a->ek[i] = a->ek[i - nk] ^ t;
+    }
+    //the equivalent inverse cipher: round keys reversed, InvMixColumns on the inner ones;
+    for (r = 0; r <= a->rounds; r++)
+    {
+        dk = a->dk + 4 * r;
+        memcpy(dk, a->ek + 4 * (a->rounds - r), 4 * sizeof(uint32_t));
+        if (r == 0 || r == a->rounds)
+            continue;
+        for (i = 0; i < 4; i++)
+        {
+            t = dk[i];
+            dk[i] = td[0][sbox[t >> 24]] ^ td[1][sbox[(t >> 16) & 0xff]] ^ td[2][sbox[(t >> 8) & 0xff]] ^
+                    td[3][sbox[t & 0xff]];
+        }
+    }
+    return 0;
+}
+
+void bench_aes_encrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    const uint32_t *rk;
+    unsigned r;
+
+    for (; nblocks > 0; nblocks--, in += BENCH_AES_BLOCK, out += BENCH_AES_BLOCK)
+    {
+        rk = a->ek;
+        s0 = load32(in) ^ rk[0];
+        s1 = load32(in + 4) ^ rk[1];
+        s2 = load32(in + 8) ^ rk[2];
+        s3 = load32(in + 12) ^ rk[3];
+        for (r = 1; r < a->rounds; r++)
+        {
+            rk += 4;
+            t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+            t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+            t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+            t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+            s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+        }
+        rk += 4;
+        store32(out, ((uint32_t)sbox[s0 >> 24] << 24 | (uint32_t)sbox[(s1 >> 16) & 0xff] << 16 |
+                      (uint32_t)sbox[(s2 >> 8) & 0xff] << 8 | sbox[s3 & 0xff]) ^ rk[0]);
+        store32(out + 4, ((uint32_t)sbox[s1 >> 24] << 24 | (uint32_t)sbox[(s2 >> 16) & 0xff] << 16 |
+                          (uint32_t)sbox[(s3 >> 8) & 0xff] << 8 | sbox[s0 & 0xff]) ^ rk[1]);
+        store32(out + 8, ((uint32_t)sbox[s2 >> 24] << 24 | (uint32_t)sbox[(s3 >> 16) & 0xff] << 16 |
+                          (uint32_t)sbox[(s0 >> 8) & 0xff] << 8 | sbox[s1 & 0xff]) ^ rk[2]);
+        store32(out + 12, ((uint32_t)sbox[s3 >> 24] << 24 | (uint32_t)sbox[(s0 >> 16) & 0xff] << 16 |
+                           (uint32_t)sbox[(s1 >> 8) & 0xff] << 8 | sbox[s2 & 0xff]) ^ rk[3]);
+    }
+}
+
+void bench_aes_decrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    const uint32_t *rk;
+    unsigned r;
+
+    for (; nblocks > 0; nblocks--, in += BENCH_AES_BLOCK, out += BENCH_AES_BLOCK)
+    {
+        rk = a->dk;
+        s0 = load32(in) ^ rk[0];
+        s1 = load32(in + 4) ^ rk[1];
+        s2 = load32(in + 8) ^ rk[2];
+        s3 = load32(in + 12) ^ rk[3];
+        for (r = 1; r < a->rounds; r++)
+        {
+            rk += 4;
+            t0 = td[0][s0 >> 24] ^ td[1][(s3 >> 16) & 0xff] ^ td[2][(s2 >> 8) & 0xff] ^ td[3][s1 & 0xff] ^ rk[0];
+            t1 = td[0][s1 >> 24] ^ td[1][(s0 >> 16) & 0xff] ^ td[2][(s3 >> 8) & 0xff] ^ td[3][s2 & 0xff] ^ rk[1];
+            t2 = td[0][s2 >> 24] ^ td[1][(s1 >> 16) & 0xff] ^ td[2][(s0 >> 8) & 0xff] ^ td[3][s3 & 0xff] ^ rk[2];
+            t3 = td[0][s3 >> 24] ^ td[1][(s2 >> 16) & 0xff] ^ td[2][(s1 >> 8) & 0xff] ^ td[3][s0 & 0xff] ^ rk[3];
+            s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+        }
+        rk += 4;
+        store32(out, ((uint32_t)inv_sbox[s0 >> 24] << 24 | (uint32_t)inv_sbox[(s3 >> 16) & 0xff] << 16 |
+                      (uint32_t)inv_sbox[(s2 >> 8) & 0xff] << 8 | inv_sbox[s1 & 0xff]) ^ rk[0]);
+        store32(out + 4, ((uint32_t)inv_sbox[s1 >> 24] << 24 | (uint32_t)inv_sbox[(s0 >> 16) & 0xff] << 16 |
+                          (uint32_t)inv_sbox[(s3 >> 8) & 0xff] << 8 | inv_sbox[s2 & 0xff]) ^ rk[1]);
+        store32(out + 8, ((uint32_t)inv_sbox[s2 >> 24] << 24 | (uint32_t)inv_sbox[(s1 >> 16) & 0xff] << 16 |
+                          (uint32_t)inv_sbox[(s0 >> 8) & 0xff] << 8 | inv_sbox[s3 & 0xff]) ^ rk[2]);
+        store32(out + 12, ((uint32_t)inv_sbox[s3 >> 24] << 24 | (uint32_t)inv_sbox[(s2 >> 16) & 0xff] << 16 |
+                           (uint32_t)inv_sbox[(s1 >> 8) & 0xff] << 8 | inv_sbox[s0 & 0xff]) ^ rk[3]);
+    }
+}
+
+#ifdef BENCH_AES_NI
+
+#define AES_NI __attribute__((target("aes,sse2")))
+
+int bench_aes_ni_available(void)
+{
+    return __builtin_cpu_supports("aes");
+}
+
+//One step of the key schedule: k ^ its 4-, 8- and 12-byte shifts ^ g, g already broadcast;
+static AES_NI __m128i expand(__m128i k, __m128i g)
+{
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    return _mm_xor_si128(k, g);
+}
+
+#define STEP128(i, rcon) \
+    k[i] = expand(k[i - 1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k[i - 1], rcon), 0xff))
+//AES-256 alternates a step with rcon and RotWord and one with SubWord alone;
+#define STEP256(i, rcon) \
+    k[i] = expand(k[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k[i - 1], rcon), 0xff))
+#define STEP256_SUB(i) \
+    k[i] = expand(k[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k[i - 1], 0), 0xaa))
+
+AES_NI int bench_aes_ni_set_key(bench_aes *a, const uint8_t *key, unsigned bits)
+{
+    __m128i k[BENCH_AES_MAX_ROUNDS + 1];
+    unsigned r;
+
+    if (bits == 128)
+    {
+        a->rounds = 10;
+        k[0] = _mm_loadu_si128((const __m128i *)key);
+        STEP128(1, 0x01);
+        STEP128(2, 0x02);
+        STEP128(3, 0x04);
+        STEP128(4, 0x08);
+        STEP128(5, 0x10);
+        STEP128(6, 0x20);
+        STEP128(7, 0x40);
+        STEP128(8, 0x80);
+        STEP128(9, 0x1b);
+        STEP128(10, 0x36);
+    }
+    else if (bits == 256)
+    {
+        a->rounds = 14;
+        k[0] = _mm_loadu_si128((const __m128i *)key);
+        k[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+        STEP256(2, 0x01);
+        STEP256_SUB(3);
+        STEP256(4, 0x02);
+        STEP256_SUB(5);
+        STEP256(6, 0x04);
+        STEP256_SUB(7);
+        STEP256(8, 0x08);
+        STEP256_SUB(9);
+        STEP256(10, 0x10);
+        STEP256_SUB(11);
+        STEP256(12, 0x20);
+        STEP256_SUB(13);
+        STEP256(14, 0x40);
+    }
+    else
+        return -1;
+    for (r = 0; r <= a->rounds; r++)
+    {
+        _mm_store_si128((__m128i *)a->ni_ek[r], k[r]);
+        _mm_store_si128((__m128i *)a->ni_dk[a->rounds - r],
+                        r == 0 || r == a->rounds ? k[r] : _mm_aesimc_si128(k[r]));
+    }
+    return 0;
+}
+
+//Eight independent blocks keep the AES unit's pipeline full, then the rest one by one;
+#define CRYPT_NI(name, rk, round, last)                                                               \
+    AES_NI void name(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks)          \
+    {                                                                                               \
+        const __m128i *src = (const __m128i *)in;                                                   \
+        __m128i *dst = (__m128i *)out;                                                              \
+        __m128i b[8], k;                                                                            \
+        unsigned r, j;                                                                              \
+                                                                                                    \
+        for (; nblocks >= 8; nblocks -= 8, src += 8, dst += 8)                                      \
+        {                                                                                           \
+            k = _mm_load_si128((const __m128i *)a->rk[0]);                                             \
+            for (j = 0; j < 8; j++)                                                                 \
+                b[j] = _mm_xor_si128(_mm_loadu_si128(src + j), k);                                  \
+            for (r = 1; r < a->rounds; r++)                                                         \
+            {                                                                                       \
+                k = _mm_load_si128((const __m128i *)a->rk[r]);                                         \
+                for (j = 0; j < 8; j++)                                                             \
+                    b[j] = round(b[j], k);                                                          \
+            }                                                                                       \
+            k = _mm_load_si128((const __m128i *)a->rk[r]);                                             \
+            for (j = 0; j < 8; j++)                                                                 \
+                _mm_storeu_si128(dst + j, last(b[j], k));                                           \
+        }                                                                                           \
+        for (; nblocks > 0; nblocks--, src++, dst++)                                                \
+        {                                                                                           \
+            b[0] = _mm_xor_si128(_mm_loadu_si128(src), _mm_load_si128((const __m128i *)a->rk[0]));     \
+            for (r = 1; r < a->rounds; r++)                                                         \
+                b[0] = round(b[0], _mm_load_si128((const __m128i *)a->rk[r]));                         \
+            _mm_storeu_si128(dst, last(b[0], _mm_load_si128((const __m128i *)a->rk[r])));              \
+        }                                                                                           \
+    }
+
+CRYPT_NI(bench_aes_ni_encrypt, ni_ek, _mm_aesenc_si128, _mm_aesenclast_si128)
+CRYPT_NI(bench_aes_ni_decrypt, ni_dk, _mm_aesdec_si128, _mm_aesdeclast_si128)
+
+#else
+
+int bench_aes_ni_available(void)
+{
+    return 0;
+}
+
+int bench_aes_ni_set_key(bench_aes *a, const uint8_t *key, unsigned bits)
+{
+    (void)a;
+    (void)key;
+    (void)bits;
+    return -1;
+}
+
+void bench_aes_ni_encrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    (void)a;
+    (void)in;
+    (void)out;
+    (void)nblocks;
+}
+
+void bench_aes_ni_decrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    (void)a;
+    (void)in;
+    (void)out;
+    (void)nblocks;
+}
+
+#endif
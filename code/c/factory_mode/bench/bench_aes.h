@@ -0,0 +1,39 @@
+/*
+ *  bench_aes.h
+ *
+ *  Description: AES baselines for swan_bench, so SWAN is compared with what would be
+ *  deployed instead rather than with the byte-wise reference in ../../performance:
+ *  a 32-bit T-table implementation in the style of rijndael-alg-fst.c, and AES-NI
+ *  with eight blocks in flight. Both expand the key once, outside the timed calls,
+ *  and run ECB over whole messages like swan_encrypt_blocks().
+ */
+
+#ifndef BENCH_AES_H_INCLUDED
+#define BENCH_AES_H_INCLUDED
+#include <stdint.h>
+#include <stddef.h>
+
+#define BENCH_AES_BLOCK 16
+#define BENCH_AES_MAX_ROUNDS 14
+
+typedef struct
+{
+    unsigned rounds;                                       //10 or 14
+    uint32_t ek[4 * (BENCH_AES_MAX_ROUNDS + 1)];            //T-table round keys
+    uint32_t dk[4 * (BENCH_AES_MAX_ROUNDS + 1)];            //equivalent inverse cipher
+    uint8_t ni_ek[BENCH_AES_MAX_ROUNDS + 1][16] __attribute__((aligned(16))); //AES-NI round keys
+    uint8_t ni_dk[BENCH_AES_MAX_ROUNDS + 1][16] __attribute__((aligned(16)));
+} bench_aes;
+
+//Expand a 128- or 256-bit key for the T-table code; -1 for other sizes;
+int bench_aes_set_key(bench_aes *a, const uint8_t *key, unsigned bits);
+void bench_aes_encrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks);
+void bench_aes_decrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+//1 if the CPU has AES-NI; the bench_aes_ni_* functions must not be called otherwise;
+int bench_aes_ni_available(void);
+int bench_aes_ni_set_key(bench_aes *a, const uint8_t *key, unsigned bits);
+void bench_aes_ni_encrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks);
+void bench_aes_ni_decrypt(const bench_aes *a, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+#endif
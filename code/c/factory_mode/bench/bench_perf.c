@@ -0,0 +1,131 @@
+/*
+ *  bench_perf.c
+ *
+ *  Description: perf_event_open counters for swan_bench; see bench_perf.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "bench_perf.h"
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} fixed[BENCH_PERF_FIXED] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"llc_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+int bench_perf_open(bench_perf *p, const char *raw)
+{
+    char *copy = raw != NULL ? strdup(raw) : NULL, *tok, *save = NULL, *eq, *end;
+    unsigned i;
+    int opened = 0;
+
+    memset(p, 0, sizeof(*p));
+    for (i = 0; i < BENCH_PERF_FIXED; i++)
+    {
+        snprintf(p->name[i], sizeof(p->name[i]), "%s", fixed[i].name);
+        p->type[i] = fixed[i].type;
+        p->config[i] = fixed[i].config;
+    }
+    p->n = BENCH_PERF_FIXED;
+    for (tok = copy != NULL ? strtok_r(copy, ",", &save) : NULL; tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        eq = strchr(tok, '=');
+        if (eq == NULL || eq == tok || eq[1] != 'r' || p->n == BENCH_PERF_MAX)
+            goto bad;
+        *eq = '\0';
+        p->config[p->n] = strtoull(eq + 2, &end, 16);
+        if (end == eq + 2 || *end != '\0')
+            goto bad;
+        snprintf(p->name[p->n], sizeof(p->name[p->n]), "%s", tok);
+        p->type[p->n] = PERF_TYPE_RAW;
+        p->n++;
+    }
+    for (i = 0; i < p->n; i++)
+    {
+        p->fd[i] = open_event(p->type[i], p->config[i]);
+        opened += p->fd[i] >= 0;
+    }
+    free(copy);
+    return opened;
+
+bad:
+    free(copy);
+    p->n = 0;
+    return -1;
+}
+
+void bench_perf_start(bench_perf *p)
+{
+    unsigned i;
+
+    for (i = 0; i < p->n; i++)
+    {
+        if (p->fd[i] >= 0)
+        {
+            ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void bench_perf_stop(bench_perf *p, double *sum)
+{
+    uint64_t v[3]; //count, time enabled, time running
+    unsigned i;
+
+    for (i = 0; i < p->n; i++)
+    {
+        if (p->fd[i] >= 0)
+            ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        //multiplexed events are scaled up to the time they were enabled;
+        if (p->fd[i] >= 0 && read(p->fd[i], v, sizeof(v)) == (ssize_t)sizeof(v) && v[2] > 0)
+            sum[i] += (double)v[0] * ((double)v[1] / (double)v[2]);
+        else
+            sum[i] = NAN;
+    }
+}
+
+void bench_perf_close(bench_perf *p)
+{
+    unsigned i;
+
+    for (i = 0; i < p->n; i++)
+    {
+        if (p->fd[i] >= 0)
+            close(p->fd[i]);
+    }
+    p->n = 0;
+}
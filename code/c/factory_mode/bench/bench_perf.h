@@ -0,0 +1,49 @@
+/*
+ *  bench_perf.h
+ *
+ *  Description: Hardware performance counters for swan_bench through perf_event_open.
+ *  Every event is opened on its own, user space only, so one the PMU or the kernel
+ *  refuses (no PMU in a VM, perf_event_paranoid, an unknown raw event) simply reads
+ *  as NaN, and events beyond the number of counters are multiplexed and scaled.
+ */
+
+#ifndef BENCH_PERF_H_INCLUDED
+#define BENCH_PERF_H_INCLUDED
+#include <stdint.h>
+
+#define BENCH_PERF_MAX 16
+
+//the fixed events come first, in this order;
+enum
+{
+    BENCH_PERF_CYCLES,
+    BENCH_PERF_INSTRUCTIONS,
+    BENCH_PERF_L1D_MISSES,
+    BENCH_PERF_LLC_MISSES,
+    BENCH_PERF_BRANCH_MISSES,
+    BENCH_PERF_FIXED
+};
+
+typedef struct
+{
+    unsigned n;                       //events, 0 when counting is off
+    char name[BENCH_PERF_MAX][24];
+    uint32_t type[BENCH_PERF_MAX];
+    uint64_t config[BENCH_PERF_MAX];
+    int fd[BENCH_PERF_MAX];           //-1 if the event could not be opened
+} bench_perf;
+
+/*
+ * Open the fixed events and the raw ones in raw, a list of NAME=rHEX such as
+ * "port0=r1a1,port1=r2a1" (event and umask as perf list prints them). Returns the
+ * number of events that could be opened, -1 if raw is malformed.
+ */
+int bench_perf_open(bench_perf *p, const char *raw);
+
+//Count from now on; bench_perf_stop() adds the counts since then to sum[], NaN where unavailable;
+void bench_perf_start(bench_perf *p);
+void bench_perf_stop(bench_perf *p, double *sum);
+
+void bench_perf_close(bench_perf *p);
+
+#endif
@@ -0,0 +1,1169 @@
+/*
+ *  swan_bench.c
+ *
+ *  Description: swan_bench, the benchmark of every SWAN variant and implementation over
+ *  message sizes from 8 B to 64 MiB:
+ *    otf         SWANxxx_encrypt_rounds(), key schedule on the fly, one block per call
+ *    precompute  precomputed key schedule, one block per call
+ *    batch       swan_encrypt_blocks() over the whole message
+ *    ecb cbc ctr xts  swan_crypt()
+ *    aes-tt      baseline: T-table AES-128/256 in ECB, with the 128-bit block variants
+ *    aes-ni      baseline: AES-NI in ECB, eight blocks in flight, where the CPU has it
+ *    key         key agility mode only: swan_set_key() alone
+ *    stream      scaling mode only: a STREAM-style copy, the memory bandwidth ceiling
+ *    wb          white-box SWAN128, swan_wb_encrypt()
+ *  Each case is warmed up, then timed as repeated samples of at least a millisecond;
+ *  the report gives the median and percentiles of the time per message, cycles per
+ *  byte and GB/s, as a table, JSON or CSV. With -p it also counts instructions, cache
+ *  and branch misses, and any raw events given with -P, over the timed samples.
+ *
+ *  With -L it measures latency instead: every call is timed on its own, key setup
+ *  included, into an HDR histogram (swan_hist), for the tail of small messages rather
+ *  than the throughput of many. -S also runs the library's own sampler and reports
+ *  what it saw of the same calls.
+ *
+ *  With -A it measures key agility: every message gets a fresh key, set up before it
+ *  is encrypted, and the sizes count blocks per key, 1 to 1024 by default. Next to the
+ *  key setup alone this shows from which message length a precomputed schedule beats
+ *  the on-the-fly rounds; with -d the on-the-fly path is the decryption one, which
+ *  first runs the schedule forward.
+ *
+ *  With -T it measures scaling: every case runs on each of the given numbers of
+ *  threads, pinned one to a CPU, with private input buffers or, with -B shared, one
+ *  input all threads read. The stream rows copy memory with the same threads and
+ *  sizes, the ceiling an encryption that only streams its message can reach.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SWAN_BENCH_TSC
+#endif
+#include <SWAN.h>
+#include <SWAN_wb.h>
+#include <SWAN_sampler.h>
+#include "bench_perf.h"
+#include "bench_aes.h"
+
+//default sizes, bytes;
+#define SWAN_BENCH_SIZES "8,16,64,256,1K,4K,16K,64K,256K,1M,4M,16M,64M"
+//shortest sample, ns; a sample repeats the message until it lasts this long;
+#define SWAN_BENCH_SAMPLE_NS 1e6
+//samples per case: at least, at most by default;
+#define SWAN_BENCH_MIN_REPS 5
+#define SWAN_BENCH_MAX_REPS 101
+//time per case, seconds, a tenth of it warm-up;
+#define SWAN_BENCH_BUDGET 0.2
+//latency mode: default sizes, timed calls per case and untimed ones before them;
+#define SWAN_BENCH_LATENCY_SIZES "16,32,64,128,256,512"
+#define SWAN_BENCH_CALLS 100000
+#define SWAN_BENCH_WARMUP_CALLS 1000
+//key agility mode: default blocks per key;
+#define SWAN_BENCH_AGILITY_BLOCKS "1,2,4,8,16,32,64,128,256,512,1024"
+//scaling mode: default sizes per thread, the last well beyond any last-level cache;
+#define SWAN_BENCH_SCALING_SIZES "64K,1M,32M"
+#define SWAN_BENCH_MAX_THREADS 256
+
+typedef struct
+{
+    const char *name;
+    uint16_t blocksize;
+    uint16_t keysize;
+} bench_variant;
+
+static const bench_variant variants[] = {
+    {"64-128", BLOCK64, KEY128},
+    {"64-256", BLOCK64, KEY256},
+    {"128-128", BLOCK128, KEY128},
+    {"128-256", BLOCK128, KEY256},
+    {"256-256", BLOCK256, KEY256},
+};
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+typedef struct
+{
+    const bench_variant *v;
+    int enc;
+    uint8_t key[KEY256 / 8];
+    uint8_t tweak[KEY256 / 8]; //XTS tweak key, independent of key
+    swan_ctx ctx;
+    swan_ctx xts;
+    swan_wb *wb;
+    bench_aes aes; //AES with the variant's key size, 128-bit block variants only
+    uint8_t iv[SWAN_MAX_BLOCK_BYTES];
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+    int setup; //latency and key agility modes: set the key before every call
+    int fresh; //key agility mode: a different key for every message
+} bench_case;
+
+//One message from c->in to c->out;
+typedef void (*bench_fn)(bench_case *c);
+
+static void run_otf(bench_case *c)
+{
+    size_t bs = c->v->blocksize / 8, i;
+    const uint8_t *in = c->in;
+    uint8_t *out = c->out;
+
+    for (i = 0; i + bs <= c->len; i += bs, in += bs, out += bs)
+    {
+        switch (c->v->blocksize + c->v->keysize)
+        {
+        case BLOCK64 + KEY128:
+            if (c->enc)
+                SWAN64_K128_encrypt_rounds(in, c->key, ROUNDS64_K128, out);
+            else
+                SWAN64_K128_decrypt_rounds(in, c->key, ROUNDS64_K128, out);
+            break;
+        case BLOCK64 + KEY256:
+            if (c->enc)
+                SWAN64_K256_encrypt_rounds(in, c->key, ROUNDS64_K256, out);
+            else
+                SWAN64_K256_decrypt_rounds(in, c->key, ROUNDS64_K256, out);
+            break;
+        case BLOCK128 + KEY128:
+            if (c->enc)
+                SWAN128_K128_encrypt_rounds((const uint16_t *)in, (const uint16_t *)c->key, ROUNDS128_128, (uint16_t *)out);
+            else
+                SWAN128_K128_decrypt_rounds((const uint16_t *)in, (const uint16_t *)c->key, ROUNDS128_128, (uint16_t *)out);
+            break;
+        case BLOCK128 + KEY256:
+            if (c->enc)
+                SWAN128_K256_encrypt_rounds((const uint16_t *)in, (const uint16_t *)c->key, ROUNDS128_256, (uint16_t *)out);
+            else
+                SWAN128_K256_decrypt_rounds((const uint16_t *)in, (const uint16_t *)c->key, ROUNDS128_256, (uint16_t *)out);
+            break;
+        default:
+            if (c->enc)
+                SWAN256_encrypt_rounds((const uint32_t *)in, (const uint32_t *)c->key, ROUNDS256_256, (uint32_t *)out);
+            else
+                SWAN256_decrypt_rounds((const uint32_t *)in, (const uint32_t *)c->key, ROUNDS256_256, (uint32_t *)out);
+            break;
+        }
+    }
+}
+
+static void run_precompute(bench_case *c)
+{
+    size_t bs = swan_block_bytes(&c->ctx), i;
+
+    for (i = 0; i + bs <= c->len; i += bs)
+    {
+        if (c->enc)
+            swan_encrypt_blocks(&c->ctx, c->in + i, c->out + i, 1);
+        else
+            swan_decrypt_blocks(&c->ctx, c->in + i, c->out + i, 1);
+    }
+}
+
+static void run_batch(bench_case *c)
+{
+    if (c->enc)
+        swan_encrypt_blocks(&c->ctx, c->in, c->out, c->len / swan_block_bytes(&c->ctx));
+    else
+        swan_decrypt_blocks(&c->ctx, c->in, c->out, c->len / swan_block_bytes(&c->ctx));
+}
+
+static void run_ecb(bench_case *c)
+{
+    swan_crypt(&c->ctx, SWAN_MODE_ECB, c->enc, c->iv, c->in, c->out, c->len);
+}
+
+static void run_cbc(bench_case *c)
+{
+    swan_crypt(&c->ctx, SWAN_MODE_CBC, c->enc, c->iv, c->in, c->out, c->len);
+}
+
+static void run_ctr(bench_case *c)
+{
+    swan_crypt(&c->ctx, SWAN_MODE_CTR, c->enc, c->iv, c->in, c->out, c->len);
+}
+
+static void run_xts(bench_case *c)
+{
+    swan_crypt(&c->xts, SWAN_MODE_XTS, c->enc, c->iv, c->in, c->out, c->len);
+}
+
+static void run_aes_tt(bench_case *c)
+{
+    if (c->enc)
+        bench_aes_encrypt(&c->aes, c->in, c->out, c->len / BENCH_AES_BLOCK);
+    else
+        bench_aes_decrypt(&c->aes, c->in, c->out, c->len / BENCH_AES_BLOCK);
+}
+
+static void run_aes_ni(bench_case *c)
+{
+    if (c->enc)
+        bench_aes_ni_encrypt(&c->aes, c->in, c->out, c->len / BENCH_AES_BLOCK);
+    else
+        bench_aes_ni_decrypt(&c->aes, c->in, c->out, c->len / BENCH_AES_BLOCK);
+}
+
+static void run_none(bench_case *c)
+{
+    (void)c;
+}
+
+//STREAM's copy kernel: one read and one write per byte, like a cipher streaming its message;
+static void run_stream(bench_case *c)
+{
+    const uint64_t *in = (const uint64_t *)c->in;
+    uint64_t *out = (uint64_t *)c->out;
+    size_t i;
+
+    for (i = 0; i < c->len / 8; i++)
+        out[i] = in[i];
+    memcpy(c->out + i * 8, c->in + i * 8, c->len % 8);
+}
+
+static void run_wb(bench_case *c)
+{
+    if (c->enc)
+        swan_wb_encrypt(c->wb, c->in, c->out, c->len / (BLOCK128 / 8));
+    else
+        swan_wb_decrypt(c->wb, c->in, c->out, c->len / (BLOCK128 / 8));
+}
+
+typedef enum
+{
+    SETUP_NONE, //no key schedule to set up, or the tables stand for it
+    SETUP_KEY,  //swan_set_key()
+    SETUP_XTS,  //swan_set_xts_key()
+    SETUP_AES,  //bench_aes_set_key()
+    SETUP_AES_NI //bench_aes_ni_set_key()
+} bench_setup;
+
+typedef struct
+{
+    const char *name;
+    bench_fn run;
+    int any_len; //messages need not be whole blocks
+    bench_setup setup;
+    int mode;    //swan_mode of swan_crypt(), -1 for the others
+} bench_impl;
+
+static const bench_impl impls[] = {
+    {"otf", run_otf, 0, SETUP_NONE, -1},
+    {"precompute", run_precompute, 0, SETUP_KEY, -1},
+    {"batch", run_batch, 0, SETUP_KEY, -1},
+    {"ecb", run_ecb, 0, SETUP_KEY, SWAN_MODE_ECB},
+    {"cbc", run_cbc, 0, SETUP_KEY, SWAN_MODE_CBC},
+    {"ctr", run_ctr, 1, SETUP_KEY, SWAN_MODE_CTR},
+    {"xts", run_xts, 0, SETUP_XTS, SWAN_MODE_XTS},
+    {"aes-tt", run_aes_tt, 0, SETUP_AES, -1},
+    {"aes-ni", run_aes_ni, 0, SETUP_AES_NI, -1},
+    {"key", run_none, 1, SETUP_KEY, -1},
+    {"stream", run_stream, 1, SETUP_NONE, -1},
+    {"wb", run_wb, 0, SETUP_NONE, -1},
+};
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+#define IMPL_WB (NIMPLS - 1)
+#define IMPL_STREAM (NIMPLS - 2)
+#define IMPL_KEY (NIMPLS - 3)
+#define IMPL_OTF 0
+#define IMPL_BATCH 2
+
+//quantiles reported, then the mean;
+enum
+{
+    Q_MIN,
+    Q_P50,
+    Q_P90,
+    Q_P99,
+    Q_P999,
+    Q_MAX,
+    Q_MEAN,
+    NQ
+};
+static const char *const q_name[NQ] = {"min", "p50", "p90", "p99", "p99.9", "max", "mean"};
+static const double q_pct[Q_MEAN] = {0, 50, 90, 99, 99.9, 100};
+
+typedef struct
+{
+    double q[NQ];
+} bench_dist;
+
+typedef struct
+{
+    const char *variant;
+    char impl[24];
+    int enc;
+    size_t bytes;
+    unsigned reps;
+    uint64_t iters; //messages per sample
+    bench_dist ns;  //per message
+    bench_dist cpb; //TSC cycles per byte, zero without a TSC
+    double gbps;    //at the median, all threads together
+    unsigned threads; //scaling mode, else 0
+    double eff;     //scaling mode: GB/s per thread against the smallest thread count
+    double counters[BENCH_PERF_MAX]; //per message, NaN where unavailable
+    double *sample[2]; //ns and cpb of every sample, sorted; NULL in latency mode
+} bench_result;
+
+typedef enum
+{
+    FMT_TEXT,
+    FMT_JSON,
+    FMT_CSV
+} bench_format;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: swan_bench [options]\n"
+            "  -v LIST  variants: 64-128,64-256,128-128,128-256,256-256; all by default\n"
+            "  -i LIST  implementations: otf,precompute,batch,ecb,cbc,ctr,xts,aes-tt,aes-ni,wb; all by default\n"
+            "  -s LIST  message sizes in bytes, K and M suffixes allowed; default %s\n"
+            "  -d       decryption instead of encryption\n"
+            "  -r N     at most N samples per case, default %d (at least %d)\n"
+            "  -t SEC   time per case, default %g s\n"
+            "  -w BITS  white-box block width, default 8\n"
+            "  -f FMT   text, json or csv; default text\n"
+            "  -o FILE  write the report to FILE instead of stdout\n"
+            "  -p       count cycles, instructions, L1D and LLC read misses and branch misses\n"
+            "  -P LIST  -p plus raw events NAME=rHEX, e.g. port0=r1a1,port1=r2a1 for port pressure on Intel\n"
+            "  -L       latency of single calls, key setup included, instead of throughput; sizes default to %s\n"
+            "  -n N     latency mode: timed calls per case, default %d\n"
+            "  -K       latency mode: set the key once, time the encryption alone\n"
+            "  -S N     latency mode: also report the library sampler's view, sampling one call in N\n"
+            "  -A       key agility: a fresh key before every message, sizes in blocks, default %s\n"
+            "  -T LIST  scaling: run every case on each number of pinned threads, sizes per thread default %s\n"
+            "  -B MODE  scaling mode buffers: private (default) or shared, one input all threads read\n"
+            "  -R       JSON: also every sample, for swan_compare\n"
+            "Sizes that are not whole blocks are only run in CTR mode. The AES baselines run with the\n"
+            "128-bit block variants, AES-128 with 128-128 and AES-256 with 128-256.\n",
+            SWAN_BENCH_SIZES, SWAN_BENCH_MAX_REPS, SWAN_BENCH_MIN_REPS, SWAN_BENCH_BUDGET, SWAN_BENCH_LATENCY_SIZES,
+            SWAN_BENCH_CALLS, SWAN_BENCH_AGILITY_BLOCKS, SWAN_BENCH_SCALING_SIZES);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t tsc(void)
+{
+#ifdef SWAN_BENCH_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+//TSC ticks per ns, measured over 50 ms; 0 without a TSC;
+static double tsc_ghz(void)
+{
+    struct timespec pause = {0, 50 * 1000 * 1000};
+    double t = now_ns();
+    uint64_t c = tsc();
+
+    nanosleep(&pause, NULL);
+    return (double)(tsc() - c) / (now_ns() - t);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+//Nearest-rank percentile of n sorted values;
+static double percentile(const double *v, unsigned n, double p)
+{
+    unsigned k = (unsigned)ceil(p / 100 * n);
+    return v[k > 0 ? k - 1 : 0];
+}
+
+static void distribution(double *v, unsigned n, bench_dist *d)
+{
+    unsigned k;
+
+    qsort(v, n, sizeof(double), cmp_double);
+    d->q[Q_MEAN] = 0;
+    for (k = 0; k < n; k++)
+        d->q[Q_MEAN] += v[k] / n;
+    for (k = 0; k < Q_MEAN; k++)
+        d->q[k] = percentile(v, n, q_pct[k]);
+}
+
+static void call(const bench_impl *im, bench_case *c)
+{
+    if (c->fresh)
+    {
+        c->key[0]++;
+        c->tweak[0]++;
+    }
+    if (c->setup && im->setup == SETUP_KEY)
+        swan_set_key(&c->ctx, c->v->blocksize, c->v->keysize, c->key);
+    else if (c->setup && im->setup == SETUP_XTS)
+        swan_set_xts_key(&c->xts, c->v->blocksize, c->v->keysize, c->key, c->tweak, 0);
+    else if (c->setup && im->setup == SETUP_AES)
+        bench_aes_set_key(&c->aes, c->key, c->v->keysize);
+    else if (c->setup && im->setup == SETUP_AES_NI)
+        bench_aes_ni_set_key(&c->aes, c->key, c->v->keysize);
+    im->run(c);
+}
+
+/*
+ * Time one case: warm up for a tenth of the budget, size the samples so each lasts
+ * SWAN_BENCH_SAMPLE_NS, then take as many as the budget allows within the limits.
+ */
+static int measure(const bench_impl *im, bench_case *c, double budget, unsigned max_reps, bench_perf *perf,
+                   bench_result *r)
+{
+    double *ns = (double *)malloc(max_reps * sizeof(double));
+    double *cyc = (double *)malloc(max_reps * sizeof(double));
+    double t, end, one;
+    uint64_t i, iters = 0;
+    uint64_t c0;
+    unsigned rep, reps;
+
+    if (ns == NULL || cyc == NULL)
+    {
+        free(ns);
+        free(cyc);
+        return -1;
+    }
+    t = now_ns();
+    end = t + budget * 1e8;
+    do
+    {
+        call(im, c);
+        iters++;
+    } while (now_ns() < end);
+    one = (now_ns() - t) / (double)iters;
+    iters = (uint64_t)ceil(SWAN_BENCH_SAMPLE_NS / one);
+    reps = (unsigned)(budget * 0.9e9 / (one * (double)iters));
+    reps = reps < SWAN_BENCH_MIN_REPS ? SWAN_BENCH_MIN_REPS : reps > max_reps ? max_reps : reps;
+    bench_perf_start(perf);
+    for (rep = 0; rep < reps; rep++)
+    {
+        t = now_ns();
+        c0 = tsc();
+        for (i = 0; i < iters; i++)
+            call(im, c);
+        //the key row has no message, its cycles are per call;
+        cyc[rep] = (double)(tsc() - c0) / (double)iters / (double)(c->len > 0 ? c->len : 1);
+        ns[rep] = (now_ns() - t) / (double)iters;
+    }
+    bench_perf_stop(perf, r->counters);
+    for (i = 0; i < perf->n; i++)
+        r->counters[i] /= (double)reps * (double)iters;
+    r->reps = reps;
+    r->iters = iters;
+    distribution(ns, reps, &r->ns);
+    distribution(cyc, reps, &r->cpb);
+    r->gbps = (double)c->len / r->ns.q[Q_P50];
+    r->sample[0] = ns;
+    r->sample[1] = cyc;
+    return 0;
+}
+
+//Quantiles of a histogram of ns per message, and the cycles per byte they stand for;
+static void from_hist(const swan_hist *h, double ghz, size_t bytes, bench_result *r)
+{
+    unsigned k;
+
+    for (k = 0; k < Q_MEAN; k++)
+        r->ns.q[k] = (double)swan_hist_percentile(h, q_pct[k]);
+    r->ns.q[Q_MIN] = (double)h->min;
+    r->ns.q[Q_MEAN] = (double)h->sum / (double)h->count;
+    for (k = 0; k < NQ; k++)
+        r->cpb.q[k] = r->ns.q[k] * ghz / (double)bytes;
+    r->reps = (unsigned)h->count;
+    r->iters = 1;
+    r->gbps = (double)bytes / r->ns.q[Q_P50];
+}
+
+/*
+ * Time calls one by one into a histogram: with the TSC when there is one (ghz > 0),
+ * which costs a few ns per reading, else with clock_gettime().
+ */
+static int measure_latency(const bench_impl *im, bench_case *c, uint64_t calls, double ghz, unsigned period,
+                           bench_perf *perf, bench_result *r)
+{
+    swan_hist *h = (swan_hist *)malloc(sizeof(swan_hist));
+    uint64_t i, t;
+    double d;
+
+    if (h == NULL)
+        return -1;
+    swan_hist_reset(h);
+    for (i = 0; i < SWAN_BENCH_WARMUP_CALLS; i++)
+        call(im, c);
+    //the library sampler, if asked for, sees the timed calls only;
+    if (period > 0)
+        swan_sampler_start(period);
+    bench_perf_start(perf);
+    for (i = 0; i < calls; i++)
+    {
+        t = ghz > 0 ? tsc() : (uint64_t)now_ns();
+        call(im, c);
+        d = ghz > 0 ? (double)(tsc() - t) / ghz : now_ns() - (double)t;
+        swan_hist_record(h, (uint64_t)(d + 0.5));
+    }
+    bench_perf_stop(perf, r->counters);
+    for (i = 0; i < perf->n; i++)
+        r->counters[i] /= (double)calls;
+    from_hist(h, ghz, c->len, r);
+    free(h);
+    return 0;
+}
+
+typedef struct
+{
+    bench_case c; //the thread's own key schedules, IV and output
+    const bench_impl *im;
+    uint64_t iters;
+    unsigned reps;
+    int cpu;      //-1: not pinned
+    int shared;   //read the common input instead of a private one
+    const int *go; //set once every thread is up, reps and the barriers are final then
+    pthread_barrier_t *start, *done;
+    uint8_t *buf;
+    int fail;
+} bench_worker;
+
+static void *worker(void *arg)
+{
+    bench_worker *w = (bench_worker *)arg;
+    size_t len = (w->c.len + 63) & ~(size_t)63;
+    cpu_set_t set;
+    unsigned rep;
+    uint64_t i;
+
+    if (w->cpu >= 0)
+    {
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    //allocated and first touched here, so the pages are local to the thread's node;
+    w->buf = (uint8_t *)aligned_alloc(64, 2 * (len > 0 ? len : 64));
+    w->fail = w->buf == NULL;
+    if (!w->fail)
+    {
+        memset(w->buf, 0, 2 * len);
+        if (!w->shared)
+        {
+            memcpy(w->buf, w->c.in, w->c.len);
+            w->c.in = w->buf;
+        }
+        w->c.out = w->buf + len;
+    }
+    while (!__atomic_load_n(w->go, __ATOMIC_ACQUIRE))
+        sched_yield();
+    for (rep = 0; rep < w->reps; rep++)
+    {
+        pthread_barrier_wait(w->start);
+        for (i = 0; !w->fail && i < w->iters; i++)
+            call(w->im, &w->c);
+        pthread_barrier_wait(w->done);
+    }
+    return NULL;
+}
+
+/*
+ * Time one case on n threads, thread k pinned to cpus[k % ncpus]: calibrate on this
+ * thread as measure() does, then every sample has all threads run the same number
+ * of messages between two barriers. ns is the wall time per message of one thread,
+ * gbps the throughput of all of them.
+ */
+static int measure_scaling(const bench_impl *im, bench_case *c, unsigned n, const int *cpus, unsigned ncpus,
+                           int shared, double budget, unsigned max_reps, bench_result *r)
+{
+    bench_worker *w = (bench_worker *)calloc(n, sizeof(bench_worker));
+    pthread_t *tid = (pthread_t *)calloc(n, sizeof(pthread_t));
+    double *ns = (double *)malloc(max_reps * sizeof(double));
+    double *cyc = (double *)malloc(max_reps * sizeof(double));
+    pthread_barrier_t start, done;
+    double t, end, one;
+    uint64_t iters = 0, c0;
+    unsigned k, rep, reps, started = 0;
+    int go = 0, fail = w == NULL || tid == NULL || ns == NULL || cyc == NULL;
+
+    if (!fail)
+    {
+        t = now_ns();
+        end = t + budget * 1e8;
+        do
+        {
+            call(im, c);
+            iters++;
+        } while (now_ns() < end);
+        one = (now_ns() - t) / (double)iters;
+        iters = (uint64_t)ceil(SWAN_BENCH_SAMPLE_NS / one);
+        reps = (unsigned)(budget * 0.9e9 / (one * (double)iters));
+        reps = reps < SWAN_BENCH_MIN_REPS ? SWAN_BENCH_MIN_REPS : reps > max_reps ? max_reps : reps;
+        for (k = 0; k < n; k++)
+        {
+            w[k].c = *c;
+            w[k].im = im;
+            w[k].iters = iters;
+            w[k].cpu = ncpus > 0 ? cpus[k % ncpus] : -1;
+            w[k].shared = shared;
+            w[k].go = &go;
+            w[k].start = &start;
+            w[k].done = &done;
+            if (pthread_create(&tid[k], NULL, worker, &w[k]) != 0)
+                break;
+        }
+        started = k;
+        //if a thread failed to start, the others leave without a sample;
+        fail = started < n;
+        for (k = 0; k < started; k++)
+            w[k].reps = fail ? 0 : reps;
+        pthread_barrier_init(&start, NULL, started + 1);
+        pthread_barrier_init(&done, NULL, started + 1);
+        __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+        for (rep = 0; !fail && rep < reps; rep++)
+        {
+            pthread_barrier_wait(&start);
+            t = now_ns();
+            c0 = tsc();
+            pthread_barrier_wait(&done);
+            cyc[rep] = (double)(tsc() - c0) / (double)iters / (double)(c->len > 0 ? c->len : 1);
+            ns[rep] = (now_ns() - t) / (double)iters;
+        }
+        for (k = 0; k < started; k++)
+        {
+            pthread_join(tid[k], NULL);
+            fail |= w[k].fail;
+            free(w[k].buf);
+        }
+        pthread_barrier_destroy(&start);
+        pthread_barrier_destroy(&done);
+    }
+    if (!fail)
+    {
+        r->reps = reps;
+        r->iters = iters;
+        r->threads = n;
+        distribution(ns, reps, &r->ns);
+        distribution(cyc, reps, &r->cpb);
+        r->gbps = (double)n * (double)c->len / r->ns.q[Q_P50];
+        r->sample[0] = ns;
+        r->sample[1] = cyc;
+    }
+    else
+    {
+        free(ns);
+        free(cyc);
+    }
+    free(w);
+    free(tid);
+    return fail ? -1 : 0;
+}
+
+//samples: also the ns and cpb of every sample, in JSON, for swan_compare;
+static void emit(FILE *fp, bench_format fmt, const bench_perf *perf, const bench_result *r, int first, int samples)
+{
+    const bench_dist *d[2] = {&r->ns, &r->cpb};
+    const char *name[2] = {"ns", "cpb"};
+    double ipc = r->counters[BENCH_PERF_INSTRUCTIONS] / r->counters[BENCH_PERF_CYCLES];
+    unsigned e;
+    int k, j;
+
+    switch (fmt)
+    {
+    case FMT_TEXT:
+        if (first)
+        {
+            fprintf(fp, "%-8s %-10s %-3s %9s %7s %9s %12s %12s %12s %12s %9s %9s", "variant", "impl", "op", "bytes", "reps",
+                    "iters", "ns p50", "ns p99", "ns p99.9", "ns max", "cpb p50", "GB/s");
+            if (r->threads > 0)
+                fprintf(fp, " %4s %9s %6s", "thr", "GB/s/thr", "eff");
+            if (perf->n > 0)
+                fprintf(fp, " %6s %8s", "IPC", "ins/B");
+            //the other counters per KiB of message;
+            for (e = BENCH_PERF_L1D_MISSES; e < perf->n; e++)
+                fprintf(fp, " %13.13s", perf->name[e]);
+            fprintf(fp, "\n");
+        }
+        fprintf(fp, "%-8s %-10s %-3s %9zu %7u %9llu %12.1f %12.1f %12.1f %12.1f %9.2f %9.3f", r->variant, r->impl,
+                r->enc ? "enc" : "dec", r->bytes, r->reps, (unsigned long long)r->iters, r->ns.q[Q_P50],
+                r->ns.q[Q_P99], r->ns.q[Q_P999], r->ns.q[Q_MAX], r->cpb.q[Q_P50], r->gbps);
+        if (r->threads > 0)
+            fprintf(fp, " %4u %9.3f %6.2f", r->threads, r->gbps / r->threads, r->eff);
+        if (perf->n > 0)
+            fprintf(fp, " %6.2f %8.1f", ipc, r->counters[BENCH_PERF_INSTRUCTIONS] / (double)r->bytes);
+        for (e = BENCH_PERF_L1D_MISSES; e < perf->n; e++)
+            fprintf(fp, " %13.2f", r->counters[e] * 1024 / (double)r->bytes);
+        fprintf(fp, "\n");
+        break;
+    case FMT_JSON:
+        fprintf(fp, "%s    {\"variant\": \"%s\", \"impl\": \"%s\", \"op\": \"%s\", \"bytes\": %zu, \"reps\": %u, \"iters\": %llu",
+                first ? "" : ",\n", r->variant, r->impl, r->enc ? "encrypt" : "decrypt", r->bytes, r->reps,
+                (unsigned long long)r->iters);
+        for (k = 0; k < 2; k++)
+        {
+            fprintf(fp, ", \"%s\": {", name[k]);
+            for (j = 0; j < NQ; j++)
+                fprintf(fp, "%s\"%s\": %.4g", j ? ", " : "", q_name[j], d[k]->q[j]);
+            fprintf(fp, "}");
+        }
+        fprintf(fp, ", \"gbps\": %.4g", r->gbps);
+        if (r->threads > 0)
+            fprintf(fp, ", \"threads\": %u, \"gbps_per_thread\": %.4g, \"efficiency\": %.4g", r->threads,
+                    r->gbps / r->threads, r->eff);
+        if (perf->n > 0)
+        {
+            fprintf(fp, ", \"counters\": {");
+            for (e = 0; e < perf->n; e++)
+            {
+                if (isnan(r->counters[e]))
+                    fprintf(fp, "%s\"%s\": null", e ? ", " : "", perf->name[e]);
+                else
+                    fprintf(fp, "%s\"%s\": %.6g", e ? ", " : "", perf->name[e], r->counters[e]);
+            }
+            fprintf(fp, isnan(ipc) ? "}, \"ipc\": null" : "}, \"ipc\": %.4g", ipc);
+        }
+        if (samples && r->sample[0] != NULL)
+        {
+            fprintf(fp, ", \"samples\": {");
+            for (k = 0; k < 2; k++)
+            {
+                fprintf(fp, "%s\"%s\": [", k ? ", " : "", name[k]);
+                for (e = 0; e < r->reps; e++)
+                    fprintf(fp, e ? ", %.6g" : "%.6g", r->sample[k][e]);
+                fprintf(fp, "]");
+            }
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "}");
+        break;
+    case FMT_CSV:
+        if (first)
+        {
+            fprintf(fp, "variant,impl,op,bytes,reps,iters");
+            for (k = 0; k < 2; k++)
+                for (j = 0; j < NQ; j++)
+                    fprintf(fp, ",%s_%s", name[k], q_name[j]);
+            fprintf(fp, ",gbps");
+            if (r->threads > 0)
+                fprintf(fp, ",threads,gbps_per_thread,efficiency");
+            for (e = 0; e < perf->n; e++)
+                fprintf(fp, ",%s", perf->name[e]);
+            fprintf(fp, perf->n > 0 ? ",ipc\n" : "\n");
+        }
+        fprintf(fp, "%s,%s,%s,%zu,%u,%llu", r->variant, r->impl, r->enc ? "encrypt" : "decrypt", r->bytes, r->reps,
+                (unsigned long long)r->iters);
+        for (k = 0; k < 2; k++)
+        {
+            for (j = 0; j < NQ; j++)
+                fprintf(fp, ",%.4g", d[k]->q[j]);
+        }
+        fprintf(fp, ",%.4g", r->gbps);
+        if (r->threads > 0)
+            fprintf(fp, ",%u,%.4g,%.4g", r->threads, r->gbps / r->threads, r->eff);
+        //per message, empty where unavailable;
+        for (e = 0; e < perf->n; e++)
+            fprintf(fp, isnan(r->counters[e]) ? "," : ",%.6g", r->counters[e]);
+        if (perf->n > 0)
+            fprintf(fp, isnan(ipc) ? ",\n" : ",%.4g\n", ipc);
+        else
+            fprintf(fp, "\n");
+        break;
+    }
+    fflush(fp);
+}
+
+//Key agility mode: the first size from which swan_set_key() and the batch kernel beat the on-the-fly rounds;
+static void break_even(FILE *fp, const char *variant, int enc, const size_t *blocks, int n, const double *otf_ns,
+                       const double *batch_ns)
+{
+    int s;
+
+    for (s = 0; s < n && batch_ns[s] >= otf_ns[s]; s++)
+        ;
+    if (s < n)
+        fprintf(fp, "%s %s: a precomputed schedule pays off from %zu block%s per key\n", variant, enc ? "enc" : "dec",
+                blocks[s], blocks[s] > 1 ? "s" : "");
+    else
+        fprintf(fp, "%s %s: the on-the-fly rounds win up to %zu blocks per key\n", variant, enc ? "enc" : "dec",
+                blocks[n - 1]);
+}
+
+//Mark the names of list found in names[] (stride bytes apart) in sel; -1 on an unknown name;
+static int select_names(const char *list, const void *names, size_t stride, size_t n, int *sel)
+{
+    char *copy = strdup(list), *tok, *save = NULL;
+    size_t i;
+    int ok = copy != NULL;
+
+    for (tok = ok ? strtok_r(copy, ",", &save) : NULL; tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        for (i = 0; i < n && strcmp(tok, *(const char *const *)((const char *)names + i * stride)) != 0; i++)
+            ;
+        if (i == n)
+        {
+            fprintf(stderr, "swan_bench: unknown name %s\n", tok);
+            ok = 0;
+            break;
+        }
+        sel[i] = 1;
+    }
+    free(copy);
+    return ok ? 0 : -1;
+}
+
+//Parse a size list into sizes[], at most max of them; returns the count, -1 on error;
+static int parse_sizes(const char *list, size_t *sizes, int max)
+{
+    const char *p = list;
+    char *end;
+    int n = 0;
+
+    while (*p != '\0' && n < max)
+    {
+        sizes[n] = (size_t)strtoull(p, &end, 10);
+        if (*end == 'K' || *end == 'k')
+            sizes[n] <<= 10, end++;
+        else if (*end == 'M' || *end == 'm')
+            sizes[n] <<= 20, end++;
+        if (end == p || sizes[n] == 0 || (*end != ',' && *end != '\0'))
+            return -1;
+        n++;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return *p == '\0' ? n : -1;
+}
+
+int main(int argc, char **argv)
+{
+    int vsel[NVARIANTS] = {0}, isel[NIMPLS] = {0};
+    const char *vlist = NULL, *ilist = NULL, *slist = SWAN_BENCH_SIZES, *path = NULL, *raw = NULL;
+    size_t sizes[64], max_size = 0;
+    int nsizes, first = 1, opt;
+    unsigned max_reps = SWAN_BENCH_MAX_REPS, width = 8, v, i;
+    double budget = SWAN_BENCH_BUDGET, ghz;
+    bench_format fmt = FMT_TEXT;
+    bench_result r;
+    bench_case c;
+    swan_wb_config wcfg;
+    uint8_t *in, *out;
+    FILE *fp = stdout;
+    bench_perf perf;
+    swan_hist *sampled = NULL;
+    uint64_t calls = SWAN_BENCH_CALLS;
+    int s, enc = SWAN_ENCRYPT, counters = 0, latency = 0, setup = 1, agility = 0;
+    double otf_ns[64], batch_ns[64]; //key agility mode: p50 per size
+    unsigned period = 0;
+    const char *tlist = NULL;
+    size_t threads[64] = {0};
+    int nthreads = 1, shared = 0, cpus[CPU_SETSIZE], t;
+    unsigned ncpus = 0;
+    cpu_set_t allowed;
+    int rc, streamed = 0, samples = 0, sizes_given = 0;
+    double base = 0; //scaling mode: GB/s per thread at the smallest thread count
+    int aes_ni = bench_aes_ni_available();
+
+    while ((opt = getopt(argc, argv, "v:i:s:dr:t:w:f:o:pP:Ln:KS:AT:B:Rh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            vlist = optarg;
+            break;
+        case 'i':
+            ilist = optarg;
+            break;
+        case 's':
+            slist = optarg;
+            sizes_given = 1;
+            break;
+        case 'd':
+            enc = SWAN_DECRYPT;
+            break;
+        case 'r':
+            max_reps = (unsigned)atoi(optarg);
+            break;
+        case 't':
+            budget = atof(optarg);
+            break;
+        case 'w':
+            width = (unsigned)atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") == 0)
+                fmt = FMT_JSON;
+            else if (strcmp(optarg, "csv") == 0)
+                fmt = FMT_CSV;
+            else if (strcmp(optarg, "text") != 0)
+            {
+                usage();
+                return 2;
+            }
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        case 'P':
+            raw = optarg;
+            /* fall through */
+        case 'p':
+            counters = 1;
+            break;
+        case 'L':
+            latency = 1;
+            break;
+        case 'n':
+            calls = strtoull(optarg, NULL, 10);
+            break;
+        case 'K':
+            setup = 0;
+            break;
+        case 'S':
+            period = (unsigned)atoi(optarg);
+            break;
+        case 'A':
+            agility = 1;
+            break;
+        case 'T':
+            tlist = optarg;
+            break;
+        case 'R':
+            samples = 1;
+            break;
+        case 'B':
+            if (strcmp(optarg, "shared") == 0)
+                shared = 1;
+            else if (strcmp(optarg, "private") != 0)
+            {
+                usage();
+                return 2;
+            }
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (latency && !sizes_given)
+        slist = SWAN_BENCH_LATENCY_SIZES;
+    else if (agility && !sizes_given)
+        slist = SWAN_BENCH_AGILITY_BLOCKS;
+    else if (tlist != NULL && !sizes_given)
+        slist = SWAN_BENCH_SCALING_SIZES;
+    if (tlist != NULL)
+        nthreads = parse_sizes(tlist, threads, (int)(sizeof(threads) / sizeof(threads[0])));
+    for (t = 0; t < nthreads; t++)
+    {
+        if (threads[t] > SWAN_BENCH_MAX_THREADS)
+            nthreads = -1;
+    }
+    nsizes = parse_sizes(slist, sizes, (int)(sizeof(sizes) / sizeof(sizes[0])));
+    if (optind != argc || nsizes <= 0 || max_reps < SWAN_BENCH_MIN_REPS || budget <= 0 || calls == 0 ||
+        (period > 0 && !latency) || (agility && latency) || nthreads <= 0 ||
+        (tlist != NULL && (latency || agility || counters)))
+    {
+        usage();
+        return 2;
+    }
+    if (period > 0)
+    {
+        sampled = (swan_hist *)malloc(sizeof(swan_hist));
+        if (sampled == NULL || swan_sampler_start(period) != 0)
+        {
+            fprintf(stderr, "swan_bench: the library was built without SWAN_SAMPLER\n");
+            return 1;
+        }
+    }
+    for (v = 0; v < NVARIANTS; v++)
+        vsel[v] = vlist == NULL;
+    for (i = 0; i < NIMPLS; i++)
+        isel[i] = ilist == NULL && (agility ? i != IMPL_WB : i != IMPL_KEY) && (tlist != NULL || i != IMPL_STREAM);
+    if ((vlist != NULL && select_names(vlist, variants, sizeof(variants[0]), NVARIANTS, vsel) != 0) ||
+        (ilist != NULL && select_names(ilist, impls, sizeof(impls[0]), NIMPLS, isel) != 0))
+        return 2;
+    for (i = 0; i < NIMPLS; i++)
+    {
+        if (isel[i] && ilist != NULL && impls[i].setup == SETUP_AES_NI && !aes_ni)
+            fprintf(stderr, "swan_bench: this CPU has no AES-NI, %s skipped\n", impls[i].name);
+    }
+    memset(&perf, 0, sizeof(perf));
+    if (counters)
+    {
+        s = bench_perf_open(&perf, raw);
+        if (s < 0)
+        {
+            fprintf(stderr, "swan_bench: raw events are NAME=rHEX\n");
+            return 2;
+        }
+        for (i = 0; i < perf.n; i++)
+        {
+            if (perf.fd[i] < 0)
+                fprintf(stderr, "swan_bench: counter %s unavailable here, reported as missing\n", perf.name[i]);
+        }
+    }
+    if (tlist != NULL && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (t = 0; t < CPU_SETSIZE; t++)
+        {
+            if (CPU_ISSET(t, &allowed))
+                cpus[ncpus++] = t;
+        }
+        for (t = 0; t < nthreads; t++)
+        {
+            if (threads[t] > ncpus)
+            {
+                fprintf(stderr, "swan_bench: %zu threads on %u CPUs, some share a CPU\n", threads[t], ncpus);
+                break;
+            }
+        }
+    }
+    if (path != NULL && (fp = fopen(path, "w")) == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    for (s = 0; s < nsizes; s++)
+        max_size = sizes[s] > max_size ? sizes[s] : max_size;
+    //blocks of the widest variant;
+    if (agility)
+        max_size *= SWAN_MAX_BLOCK_BYTES;
+    in = (uint8_t *)aligned_alloc(64, (max_size + 63) & ~(size_t)63);
+    out = (uint8_t *)aligned_alloc(64, (max_size + 63) & ~(size_t)63);
+    if (in == NULL || out == NULL)
+    {
+        fprintf(stderr, "swan_bench: out of memory\n");
+        return 1;
+    }
+    for (s = 0; (size_t)s < max_size; s++)
+        in[s] = (uint8_t)rand();
+    memset(out, 0, max_size);
+
+    ghz = tsc_ghz();
+    if (fmt == FMT_JSON)
+        fprintf(fp, "{\n  \"tool\": \"swan_bench\",\n  \"tsc_ghz\": %.4g,\n  \"results\": [\n", ghz);
+    else if (fmt == FMT_TEXT)
+        fprintf(fp, "TSC %.3f GHz; cpb counts TSC cycles per byte\n", ghz);
+
+    memset(&c, 0, sizeof(c));
+    for (s = 0; (size_t)s < sizeof(c.key); s++)
+        c.key[s] = (uint8_t)rand();
+    for (s = 0; (size_t)s < sizeof(c.tweak); s++)
+        c.tweak[s] = (uint8_t)rand();
+    c.enc = enc;
+    c.setup = (latency && setup) || agility;
+    c.fresh = agility;
+    c.in = in;
+    c.out = out;
+    for (v = 0; v < NVARIANTS; v++)
+    {
+        if (!vsel[v])
+            continue;
+        c.v = &variants[v];
+        swan_set_key(&c.ctx, c.v->blocksize, c.v->keysize, c.key);
+        swan_set_xts_key(&c.xts, c.v->blocksize, c.v->keysize, c.key, c.tweak, 0);
+        if (c.v->blocksize == BLOCK128)
+        {
+            bench_aes_set_key(&c.aes, c.key, c.v->keysize);
+            if (aes_ni)
+                bench_aes_ni_set_key(&c.aes, c.key, c.v->keysize);
+        }
+        if (isel[IMPL_WB] && c.v->blocksize == BLOCK128)
+        {
+            memset(&wcfg, 0, sizeof(wcfg));
+            wcfg.width = width;
+            wcfg.dirs = enc ? SWAN_WB_ENCRYPT : SWAN_WB_DECRYPT;
+            c.wb = swan_wb_generate(c.key, c.v->keysize, &wcfg);
+            if (c.wb == NULL)
+                fprintf(stderr, "swan_bench: cannot generate the %s white-box tables\n", c.v->name);
+        }
+        for (i = 0; i < NIMPLS; i++)
+        {
+            if (!isel[i] || (i == IMPL_WB && c.wb == NULL))
+                continue;
+            if (impls[i].setup >= SETUP_AES && c.v->blocksize != BLOCK128)
+                continue;
+            if (impls[i].setup == SETUP_AES_NI && !aes_ni)
+                continue;
+            //the tables stand for one fixed key;
+            if (agility && i == IMPL_WB)
+                continue;
+            //memory bandwidth does not depend on the variant;
+            if (i == IMPL_STREAM && streamed)
+                continue;
+            for (s = 0; s < (i == IMPL_KEY ? 1 : nsizes); s++)
+            {
+                if (!agility && !impls[i].any_len && sizes[s] % (c.v->blocksize / 8) != 0)
+                    continue;
+                c.len = agility ? (i == IMPL_KEY ? 0 : sizes[s] * (c.v->blocksize / 8)) : sizes[s];
+                //the thread counts of scaling mode, once otherwise;
+                for (t = 0; t < nthreads; t++)
+                {
+                    memset(c.iv, 0, sizeof(c.iv));
+                    memset(&r, 0, sizeof(r));
+                    r.variant = c.v->name;
+                    snprintf(r.impl, sizeof(r.impl), "%s", impls[i].name);
+                    r.enc = enc;
+                    r.bytes = c.len;
+                    if (tlist != NULL)
+                        rc = measure_scaling(&impls[i], &c, (unsigned)threads[t], cpus, ncpus, shared, budget,
+                                             max_reps, &r);
+                    else if (latency)
+                        rc = measure_latency(&impls[i], &c, calls, ghz, period, &perf, &r);
+                    else
+                        rc = measure(&impls[i], &c, budget, max_reps, &perf, &r);
+                    if (rc != 0)
+                    {
+                        fprintf(stderr, "swan_bench: out of memory\n");
+                        return 1;
+                    }
+                    if (t == 0)
+                        base = r.gbps / (r.threads > 0 ? r.threads : 1);
+                    r.eff = r.gbps / (r.threads > 0 ? r.threads : 1) / base;
+                    emit(fp, fmt, &perf, &r, first, samples);
+                    free(r.sample[0]);
+                    free(r.sample[1]);
+                    r.sample[0] = r.sample[1] = NULL;
+                    first = 0;
+                    if (i == IMPL_OTF)
+                        otf_ns[s] = r.ns.q[Q_P50];
+                    else if (i == IMPL_BATCH)
+                        batch_ns[s] = r.ns.q[Q_P50];
+                    //the sampler times swan_crypt() alone, from inside the library;
+                    if (period > 0 && impls[i].mode >= 0 &&
+                        swan_sampler_read(c.v->blocksize, c.v->keysize, impls[i].mode, enc, sampled) == 0 &&
+                        sampled->count > 0)
+                    {
+                        memset(r.counters, 0, sizeof(r.counters));
+                        snprintf(r.impl, sizeof(r.impl), "%s@lib", impls[i].name);
+                        from_hist(sampled, ghz, c.len, &r);
+                        emit(fp, fmt, &perf, &r, 0, 0);
+                    }
+                }
+            }
+        }
+        streamed = 1;
+        if (agility && fmt == FMT_TEXT && isel[IMPL_OTF] && isel[IMPL_BATCH])
+            break_even(fp, c.v->name, enc, sizes, nsizes, otf_ns, batch_ns);
+        swan_wb_free(c.wb);
+        c.wb = NULL;
+    }
+    if (fmt == FMT_JSON)
+        fprintf(fp, "\n  ]\n}\n");
+    if (fp != stdout)
+        fclose(fp);
+    bench_perf_close(&perf);
+    swan_sampler_stop();
+    free(sampled);
+    free(in);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ *  swan_compare.c
+ *
+ *  Description: swan_compare, the regression check between two reports of
+ *  swan_bench -f json -R, a baseline and a new run. For every case in both it compares
+ *  the median cycles per byte (ns per message without a TSC) and tests the samples
+ *  with a one-sided Mann-Whitney U test, exact for small samples without ties and
+ *  by the normal approximation otherwise. A case regresses if its median grew by
+ *  more than the threshold and the difference is significant; the exit status is 1
+ *  if any did, so scripts (bench/swan_regress.sh) can gate on it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+//default: a regression is a slower median by more than this many percent...
+#define SWAN_COMPARE_THRESHOLD 5.0
+//...with a p-value below this;
+#define SWAN_COMPARE_ALPHA 0.01
+//exact U distribution up to this many samples per side;
+#define SWAN_COMPARE_EXACT 20
+
+typedef struct
+{
+    char key[128]; //variant, impl, op, bytes and threads
+    char variant[16], impl[24], op[8];
+    unsigned long bytes, threads;
+    char thr[12]; //threads for the report, - outside scaling mode
+    const char *unit; //"cpb" or "ns"
+    double *x;
+    unsigned n;
+    double median;
+} cmp_case;
+
+typedef struct
+{
+    double tsc_ghz;
+    cmp_case *c;
+    unsigned n;
+} cmp_report;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: swan_compare [-t PCT] [-a ALPHA] BASELINE.json NEW.json\n"
+            "  -t PCT    a slower median by more than PCT percent is a regression, default %g\n"
+            "  -a ALPHA  if the Mann-Whitney U test's p-value is below ALPHA, default %g\n"
+            "Both reports come from swan_bench -f json -R. Exit status 1 on a regression.\n",
+            SWAN_COMPARE_THRESHOLD, SWAN_COMPARE_ALPHA);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+//The string value of "name" in a report line into out; -1 if absent;
+static int get_str(const char *line, const char *name, char *out, size_t size)
+{
+    char pat[32];
+    const char *p, *q;
+
+    snprintf(pat, sizeof(pat), "\"%s\": \"", name);
+    if ((p = strstr(line, pat)) == NULL || (q = strchr(p += strlen(pat), '"')) == NULL)
+        return -1;
+    snprintf(out, size, "%.*s", (int)(q - p), p);
+    return 0;
+}
+
+//The number after "name": in line, def if absent;
+static double get_num(const char *line, const char *name, double def)
+{
+    char pat[32];
+    const char *p;
+
+    snprintf(pat, sizeof(pat), "\"%s\": ", name);
+    p = strstr(line, pat);
+    return p != NULL ? strtod(p + strlen(pat), NULL) : def;
+}
+
+//The array "name": [...] inside p, into a new array; the count, -1 if absent or empty;
+static int get_array(const char *p, const char *name, double **out)
+{
+    char pat[32], *end;
+    double *x = NULL, *grown;
+    int n = 0, cap = 0;
+
+    snprintf(pat, sizeof(pat), "\"%s\": [", name);
+    if ((p = strstr(p, pat)) == NULL)
+        return -1;
+    for (p += strlen(pat); *p != ']' && *p != '\0'; p = *end == ',' ? end + 1 : end)
+    {
+        if (n == cap)
+        {
+            cap = cap ? 2 * cap : 64;
+            if ((grown = (double *)realloc(x, cap * sizeof(double))) == NULL)
+                break;
+            x = grown;
+        }
+        x[n] = strtod(p, &end);
+        if (end == p)
+            break;
+        n++;
+    }
+    if (*p != ']' || n == 0)
+    {
+        free(x);
+        return -1;
+    }
+    *out = x;
+    return n;
+}
+
+static int load(const char *path, cmp_report *rep)
+{
+    FILE *fp = fopen(path, "r");
+    char *line = NULL, *samples;
+    size_t cap = 0;
+    cmp_case c, *grown;
+    unsigned max = 0;
+    double *ns, *cpb;
+    int n, m;
+
+    memset(rep, 0, sizeof(*rep));
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (getline(&line, &cap, fp) != -1)
+    {
+        if (strstr(line, "\"tsc_ghz\": ") != NULL)
+            rep->tsc_ghz = get_num(line, "tsc_ghz", 0);
+        if (strstr(line, "{\"variant\": ") == NULL)
+            continue;
+        memset(&c, 0, sizeof(c));
+        if (get_str(line, "variant", c.variant, sizeof(c.variant)) != 0 ||
+            get_str(line, "impl", c.impl, sizeof(c.impl)) != 0 || get_str(line, "op", c.op, sizeof(c.op)) != 0)
+            continue;
+        c.bytes = (unsigned long)get_num(line, "bytes", 0);
+        c.threads = (unsigned long)get_num(line, "threads", 0);
+        snprintf(c.thr, sizeof(c.thr), c.threads ? "%lu" : "-", c.threads);
+        snprintf(c.key, sizeof(c.key), "%s %s %s %lu %lu", c.variant, c.impl, c.op, c.bytes, c.threads);
+        //latency rows and reports without -R have no samples;
+        if ((samples = strstr(line, "\"samples\": {")) == NULL || (n = get_array(samples, "ns", &ns)) < 0)
+            continue;
+        if ((m = get_array(samples, "cpb", &cpb)) == n && cpb[n - 1] > 0)
+        {
+            free(ns);
+            c.x = cpb, c.unit = "cpb";
+        }
+        else
+        {
+            free(m > 0 ? cpb : NULL);
+            c.x = ns, c.unit = "ns";
+        }
+        c.n = (unsigned)n;
+        qsort(c.x, c.n, sizeof(double), cmp_double);
+        c.median = c.n % 2 ? c.x[c.n / 2] : (c.x[c.n / 2 - 1] + c.x[c.n / 2]) / 2;
+        if (rep->n == max)
+        {
+            max = max ? 2 * max : 64;
+            if ((grown = (cmp_case *)realloc(rep->c, max * sizeof(cmp_case))) == NULL)
+            {
+                free(c.x);
+                break;
+            }
+            rep->c = grown;
+        }
+        rep->c[rep->n++] = c;
+    }
+    free(line);
+    fclose(fp);
+    if (rep->n == 0)
+    {
+        fprintf(stderr, "swan_compare: %s has no samples, run swan_bench with -f json -R\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * P(U >= u) and P(U <= u) for U, the pairs (a, b) with a from m samples above b from n,
+ * when both come from one distribution and there are no ties: the number of
+ * arrangements with U = u obeys c(m, n, u) = c(m - 1, n, u - n) + c(m, n - 1, u).
+ */
+static int exact_u(unsigned m, unsigned n, double u, double *upper, double *lower)
+{
+    unsigned umax = m * n, i, j, v;
+    double *c = (double *)calloc((size_t)(m + 1) * (n + 1) * (umax + 1), sizeof(double));
+    double total = 0, ge = 0, le = 0, w;
+
+#define C(i, j, v) c[((size_t)(i) * (n + 1) + (j)) * (umax + 1) + (v)]
+    if (c == NULL)
+        return -1;
+    for (i = 0; i <= m; i++)
+    {
+        for (j = 0; j <= n; j++)
+        {
+            if (i == 0 || j == 0)
+            {
+                C(i, j, 0) = 1;
+                continue;
+            }
+            for (v = 0; v <= i * j; v++)
+                C(i, j, v) = (v >= j ? C(i - 1, j, v - j) : 0) + C(i, j - 1, v);
+        }
+    }
+    for (v = 0; v <= umax; v++)
+    {
+        w = C(m, n, v);
+        total += w;
+        ge += v >= u ? w : 0;
+        le += v <= u ? w : 0;
+    }
+#undef C
+    free(c);
+    *upper = ge / total;
+    *lower = le / total;
+    return 0;
+}
+
+/*
+ * One-sided Mann-Whitney U test of new (m samples) against base (n samples), both
+ * sorted: *slower is the p-value for new being stochastically larger, *faster for
+ * it being smaller.
+ */
+static void mann_whitney(const double *new_x, unsigned m, const double *base, unsigned n, double *slower,
+                         double *faster)
+{
+    unsigned i = 0, j = 0, tied, N = m + n;
+    double rank = 1, rsum = 0, ties = 0, u, mean, sd, z;
+
+    //ranks of the pooled samples, ties sharing their average rank;
+    while (i < m || j < n)
+    {
+        double v = i < m && (j == n || new_x[i] <= base[j]) ? new_x[i] : base[j];
+        unsigned from_new = 0;
+
+        for (tied = 0; i < m && new_x[i] == v; i++, tied++)
+            from_new++;
+        for (; j < n && base[j] == v; j++)
+            tied++;
+        rsum += from_new * (rank + (tied - 1) / 2.0);
+        rank += tied;
+        ties += (double)tied * tied * tied - tied;
+    }
+    u = rsum - m * (m + 1) / 2.0;
+    if (ties == 0 && m <= SWAN_COMPARE_EXACT && n <= SWAN_COMPARE_EXACT && exact_u(m, n, u, slower, faster) == 0)
+        return;
+    mean = m * (double)n / 2;
+    sd = sqrt(m * (double)n / 12 * ((N + 1) - ties / ((double)N * (N - 1))));
+    if (sd == 0)
+    {
+        *slower = *faster = 1;
+        return;
+    }
+    //with a continuity correction;
+    z = (u - mean - 0.5) / sd;
+    *slower = 0.5 * erfc(z / sqrt(2));
+    z = (u - mean + 0.5) / sd;
+    *faster = 0.5 * erfc(-z / sqrt(2));
+}
+
+int main(int argc, char **argv)
+{
+    double threshold = SWAN_COMPARE_THRESHOLD, alpha = SWAN_COMPARE_ALPHA, change, slower, faster;
+    cmp_report base, cur;
+    const cmp_case *b, *c;
+    unsigned i, j, regressions = 0, faster_n = 0, compared = 0;
+    const char *verdict;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:a:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'a':
+            alpha = atof(optarg);
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (argc - optind != 2 || threshold < 0 || alpha <= 0 || alpha >= 1)
+    {
+        usage();
+        return 2;
+    }
+    if (load(argv[optind], &base) != 0 || load(argv[optind + 1], &cur) != 0)
+        return 2;
+    if (base.tsc_ghz > 0 && fabs(cur.tsc_ghz / base.tsc_ghz - 1) > 0.02)
+        fprintf(stderr, "swan_compare: TSC %.3f GHz against %.3f in the baseline, not the same machine?\n", cur.tsc_ghz,
+                base.tsc_ghz);
+    printf("%-8s %-10s %-7s %9s %4s %-3s %11s %11s %8s %9s\n", "variant", "impl", "op", "bytes", "thr", "", "baseline",
+           "new", "change", "p");
+    for (i = 0; i < cur.n; i++)
+    {
+        c = &cur.c[i];
+        for (j = 0; j < base.n && strcmp(base.c[j].key, c->key) != 0; j++)
+            ;
+        if (j == base.n)
+        {
+            printf("%-8s %-10s %-7s %9lu %4s %-3s %11s %11.4g %8s %9s  new case\n", c->variant, c->impl, c->op,
+                   c->bytes, c->thr, c->unit, "-", c->median, "-", "-");
+            continue;
+        }
+        b = &base.c[j];
+        if (strcmp(b->unit, c->unit) != 0)
+        {
+            printf("%-8s %-10s %-7s %9lu %4s %-3s %11s %11s %8s %9s  not comparable, %s against %s\n", c->variant,
+                   c->impl, c->op, c->bytes, c->thr, c->unit, "-", "-", "-", "-", c->unit, b->unit);
+            continue;
+        }
+        compared++;
+        change = (c->median / b->median - 1) * 100;
+        mann_whitney(c->x, c->n, b->x, b->n, &slower, &faster);
+        if (change > threshold && slower < alpha)
+            verdict = "REGRESSION", regressions++;
+        else if (change < -threshold && faster < alpha)
+            verdict = "faster", faster_n++;
+        else
+            verdict = "ok";
+        printf("%-8s %-10s %-7s %9lu %4s %-3s %11.4g %11.4g %+7.1f%% %9.2g  %s\n", c->variant, c->impl, c->op, c->bytes,
+               c->thr, c->unit, b->median, c->median, change, change >= 0 ? slower : faster, verdict);
+    }
+    printf("%u cases compared: %u regressions, %u faster (threshold %g%%, alpha %g)\n", compared, regressions, faster_n,
+           threshold, alpha);
+    for (i = 0; i < base.n; i++)
+        free(base.c[i].x);
+    for (i = 0; i < cur.n; i++)
+        free(cur.c[i].x);
+    free(base.c);
+    free(cur.c);
+    return regressions > 0;
+}
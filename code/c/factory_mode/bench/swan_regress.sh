@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+#  swan_regress.sh
+#
+#  Description: the performance regression gate. It keeps one swan_bench baseline per
+#  machine, named after a fingerprint of the CPU model, the number of CPUs and the
+#  architecture, and checks new runs against it with swan_compare:
+#
+#    swan_regress.sh [-b BUILD] [-d DIR] [-t PCT] [-a ALPHA] record|check [swan_bench options]
+#
+#  record  runs swan_bench and stores the report and its options in DIR
+#  check   runs swan_bench with the same options and exits 1 if a case regressed
+#
+#  BUILD is where swan_bench and swan_compare are, the current directory by default;
+#  DIR defaults to bench/baselines next to this script.
+#
+
+set -e
+
+build=.
+dir=$(dirname "$0")/baselines
+compare_opts=
+defaults="-i otf,batch,ecb,cbc,ctr,xts -s 16,256,4K,64K,1M"
+
+usage()
+{
+    echo "usage: swan_regress.sh [-b BUILD] [-d DIR] [-t PCT] [-a ALPHA] record|check [swan_bench options]" >&2
+    exit 2
+}
+
+while getopts b:d:t:a:h opt; do
+    case $opt in
+    b) build=$OPTARG ;;
+    d) dir=$OPTARG ;;
+    t) compare_opts="$compare_opts -t $OPTARG" ;;
+    a) compare_opts="$compare_opts -a $OPTARG" ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -ge 1 ] || usage
+action=$1
+shift
+
+model=$(sed -n 's/^model name[[:space:]]*: //p' /proc/cpuinfo 2>/dev/null | head -n 1)
+[ -n "$model" ] || model=$(uname -p)
+fingerprint="$(uname -m) | $model | $(getconf _NPROCESSORS_ONLN) CPUs"
+name=$(uname -m)-$(printf '%s\n' "$fingerprint" | cksum | cut -d ' ' -f 1)
+base=$dir/$name.json
+
+case $action in
+record)
+    opts=${*:-$defaults}
+    mkdir -p "$dir"
+    "$build/swan_bench" $opts -f json -R -o "$base.tmp"
+    mv "$base.tmp" "$base"
+    printf '%s\n%s\n' "$fingerprint" "$opts" > "$dir/$name.txt"
+    echo "baseline for $fingerprint stored in $base"
+    ;;
+check)
+    if [ ! -f "$base" ]; then
+        echo "swan_regress.sh: no baseline for $fingerprint in $dir, run record first" >&2
+        exit 2
+    fi
+    opts=${*:-$(sed -n 2p "$dir/$name.txt")}
+    new=$(mktemp "${TMPDIR:-/tmp}/swan_regress.XXXXXX")
+    trap 'rm -f "$new"' EXIT
+    "$build/swan_bench" $opts -f json -R -o "$new"
+    "$build/swan_compare" $compare_opts "$base" "$new"
+    ;;
+*)
+    usage
+    ;;
+esac
@@ -1,8 +1,14 @@
 // #include "SWAN64.h"
 // #include "SWAN128.h"
 // #include "SWAN256.h"
+#ifndef SWAN_H_INCLUDED
+#define SWAN_H_INCLUDED
 #include<stdint.h>
 #include<stdlib.h>
+#include<sys/uio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define ROUNDS64_K128 32
 #define ROUNDS64_K256 64
@@ -47,9 +53,11 @@
 #define ROL16(x, n) ((x >> n) | (x << (16 - n)))
 #define ROL32(x, n) ((x >> n) | (x << (32 - n)))
 
+void RotateKeyByte(uint8_t *key, uint16_t keylength, uint8_t Rlength);
 void InvRotateKeyByte(uint8_t *key, uint16_t keylength, uint8_t Rlength) ;
 void ShiftLanes(uint8_t a[4], uint16_t blocksize);
 void Beta(uint8_t _a[4], uint16_t blocksize) ;
+void SwitchLanes(uint8_t _a[4], uint16_t blocksize);
 void SWAN64_K128_encrypt_rounds(const uint8_t *plain, const uint8_t *masterkey, const uint8_t rounds, uint8_t *cipher);
 
 void SWAN64_K128_decrypt_rounds(const uint8_t *cipher, const uint8_t *masterkey, const uint8_t rounds, uint8_t *plain);
@@ -66,3 +74,100 @@ void SWAN128_K256_encrypt_rounds(const uint16_t *plain, const uint16_t *masterke
 
 void SWAN128_K256_decrypt_rounds(const uint16_t *cipher, const uint16_t *masterkey, const uint8_t rounds, uint16_t *plain);
 
+void SWAN256_encrypt_rounds(const uint32_t *plain, const uint32_t *masterkey, const uint8_t rounds, uint32_t *cipher);
+
+void SWAN256_decrypt_rounds(const uint32_t *cipher, const uint32_t *masterkey, const uint8_t rounds, uint32_t *plain);
+
+//Precomputed key schedule: 2*rounds half round subkeys of blocksize/16 bytes each;
+void SWAN64_key_schedule(const uint8_t *masterkey, const uint16_t keysize, const uint8_t rounds, uint8_t *subkeys);
+void SWAN128_key_schedule(const uint16_t *masterkey, const uint16_t keysize, const uint8_t rounds, uint16_t *subkeys);
+void SWAN256_key_schedule(const uint32_t *masterkey, const uint16_t keysize, const uint8_t rounds, uint32_t *subkeys);
+
+//Batch kernels over nblocks consecutive blocks with a precomputed key schedule;
+//they work on SWAN_KERNEL_WAYS blocks side by side so the lane arithmetic vectorises;
+#define SWAN_KERNEL_WAYS 16
+void SWAN64_encrypt_blocks(const uint8_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks);
+void SWAN64_decrypt_blocks(const uint8_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks);
+void SWAN128_encrypt_blocks(const uint16_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks);
+void SWAN128_decrypt_blocks(const uint16_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks);
+void SWAN256_encrypt_blocks(const uint32_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks);
+void SWAN256_decrypt_blocks(const uint32_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+/*
+ * Key context and modes of operation.
+ * A swan_ctx holds the expanded key schedule of one SWAN variant and is read-only
+ * after swan_set_key(), so it can be shared between threads.
+ */
+#define SWAN_MAX_ROUNDS 64
+#define SWAN_MAX_BLOCK_BYTES (BLOCK256 / 8)
+
+//blocks handled per batch kernel call inside the modes;
+#define SWAN_BATCH_BLOCKS 32
+
+#define SWAN_DECRYPT 0
+#define SWAN_ENCRYPT 1
+
+typedef enum
+{
+    SWAN_MODE_ECB,
+    SWAN_MODE_CBC,
+    SWAN_MODE_CTR,
+    SWAN_MODE_XTS
+} swan_mode;
+
+//default XTS data unit (sector) size in bytes;
+#define SWAN_XTS_UNIT 4096
+
+typedef struct swan_ctx
+{
+    uint16_t blocksize;
+    uint16_t keysize;
+    uint8_t rounds;
+    uint32_t subkeys[2 * SWAN_MAX_ROUNDS][SWAN_MAX_BLOCK_BYTES / 8];
+    //XTS only: data unit size and the tweak key schedule;
+    uint32_t xts_unit;
+    uint32_t tweak_subkeys[2 * SWAN_MAX_ROUNDS][SWAN_MAX_BLOCK_BYTES / 8];
+    //unique to every key setup, so copies of the schedule cached by address notice a re-key;
+    uint64_t generation;
+} swan_ctx;
+
+//Returns 0 on success, -1 if the blocksize/keysize pair is not a SWAN variant;
+int swan_set_key(swan_ctx *ctx, uint16_t blocksize, uint16_t keysize, const uint8_t *masterkey);
+
+//XTS needs a second, independent key for the tweaks; unit is the data unit size (0 for SWAN_XTS_UNIT);
+int swan_set_xts_key(swan_ctx *ctx, uint16_t blocksize, uint16_t keysize, const uint8_t *datakey,
+                     const uint8_t *tweakkey, uint32_t unit);
+
+#define swan_block_bytes(ctx) ((size_t)(ctx)->blocksize / 8)
+
+void swan_encrypt_blocks(const swan_ctx *ctx, const uint8_t *in, uint8_t *out, size_t nblocks);
+void swan_decrypt_blocks(const swan_ctx *ctx, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+/*
+ * Encrypt (enc = SWAN_ENCRYPT) or decrypt len bytes from in to out; in == out is allowed.
+ * iv is one block: the chaining value for CBC, the big-endian counter block for CTR,
+ * the little-endian number of the first data unit for XTS, unused for ECB. It is updated
+ * so that consecutive calls continue the same stream.
+ * ECB, CBC and XTS need len to be a multiple of the block size (XTS has no ciphertext
+ * stealing); CTR accepts any len but only the last call of a stream may end on a partial
+ * block, XTS only on a partial data unit.
+ * Returns 0 on success, -1 on invalid arguments.
+ */
+int swan_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+
+/*
+ * Scatter-gather variant of swan_crypt(): the message is the concatenation of the
+ * in segments, the result is written across the out segments. Whole-block runs inside
+ * a segment pair go straight to the batch kernels; only a block that straddles a segment
+ * boundary is gathered into a one-block bounce buffer.
+ * The out segments must hold at least as many bytes as the in segments; in-place
+ * operation needs in and out to describe the same segments. XTS is not supported here.
+ */
+int swan_crypt_iov(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                   const struct iovec *in, int in_cnt, const struct iovec *out, int out_cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ *  SWAN.hpp
+ *
+ *  Description: Header-only C++20 interface over the C kernels.
+ *
+ *  swan::Cipher<Block, Key> fixes the variant at compile time: the lane type, the
+ *  lane rotations A/B/C, the key rotation and the number of rounds are constexpr,
+ *  so the single-block round loop is fully unrolled and specialised for one lane
+ *  width, and batches go straight to the matching SWANxx_*_blocks kernel with no
+ *  blocksize switch and no casts at the call site. The object owns its expanded
+ *  key and wipes it on destruction.
+ *
+ *  swan::Context is the RAII form of swan_ctx for the runtime-selected variant and
+ *  the modes of operation.
+ */
+
+#ifndef SWAN_HPP_INCLUDED
+#define SWAN_HPP_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "SWAN.h"
+
+namespace swan
+{
+
+//Lane type and rotation amounts of one block size;
+template <unsigned Block>
+struct variant;
+
+template <>
+struct variant<BLOCK64>
+{
+    using lane = std::uint8_t;
+    static constexpr unsigned a = A_64;
+    static constexpr unsigned b = B_64;
+    static constexpr unsigned c = C_64;
+    static constexpr unsigned rotate = ROTATE_64;
+};
+
+template <>
+struct variant<BLOCK128>
+{
+    using lane = std::uint16_t;
+    static constexpr unsigned a = A_128;
+    static constexpr unsigned b = B_128;
+    static constexpr unsigned c = C_128;
+    static constexpr unsigned rotate = ROTATE_128;
+};
+
+template <>
+struct variant<BLOCK256>
+{
+    using lane = std::uint32_t;
+    static constexpr unsigned a = A_256;
+    static constexpr unsigned b = B_256;
+    static constexpr unsigned c = C_256;
+    static constexpr unsigned rotate = ROTATE_256;
+};
+
+//Rounds of each block/key pair, 0 for pairs that are not SWAN variants;
+template <unsigned Block, unsigned Key>
+inline constexpr unsigned rounds_v = 0;
+template <>
+inline constexpr unsigned rounds_v<BLOCK64, KEY128> = ROUNDS64_K128;
+template <>
+inline constexpr unsigned rounds_v<BLOCK64, KEY256> = ROUNDS64_K256;
+template <>
+inline constexpr unsigned rounds_v<BLOCK128, KEY128> = ROUNDS128_128;
+template <>
+inline constexpr unsigned rounds_v<BLOCK128, KEY256> = ROUNDS128_256;
+template <>
+inline constexpr unsigned rounds_v<BLOCK256, KEY256> = ROUNDS256_256;
+
+namespace detail
+{
+
+//Same rotation as the ROLn macros of SWAN.h;
+template <unsigned N, class T>
+constexpr T rol(T x) noexcept
+{
+    return static_cast<T>((x >> N) | (x << (sizeof(T) * 8 - N)));
+}
+
+//y ^= SwitchLanes(Beta(ShiftLanes(x) ^ k)), the bitsliced half round of the C kernels;
+template <class V, class T>
+inline void half_round(const T x[4], const T k[4], T y[4]) noexcept
+{
+    const T a0 = x[0] ^ k[0];
+    const T a1 = rol<V::a>(x[1]) ^ k[1];
+    const T a2 = rol<V::b>(x[2]) ^ k[2];
+    const T a3 = rol<V::c>(x[3]) ^ k[3];
+
+    const T b0 = static_cast<T>(~(a0 ^ a1 ^ a3 ^ (a2 & a3)));
+    const T b1 = a0 ^ (a0 & a1) ^ a2 ^ (a0 & a3) ^ (a1 & a3) ^ (a0 & a1 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3) ^ (a1 & a2 & a3);
+    const T b2 = a1 ^ a2 ^ (a0 & a2) ^ a3 ^ (a0 & a1 & a3) ^ (a1 & a2 & a3);
+    const T b3 = a1 ^ (a0 & a1) ^ (a0 & a2) ^ (a0 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3);
+
+    y[0] ^= b1 ^ b2 ^ b3;
+    y[1] ^= b0 ^ b2 ^ b3;
+    y[2] ^= b0 ^ b1 ^ b3;
+    y[3] ^= b0 ^ b1 ^ b2;
+}
+
+template <class V, class T, std::size_t... I>
+inline void encrypt_rounds(T l[4], T r[4], const T (*k)[4], std::index_sequence<I...>) noexcept
+{
+    ((half_round<V>(l, k[2 * I], r), half_round<V>(r, k[2 * I + 1], l)), ...);
+}
+
+template <class V, class T, std::size_t Rounds, std::size_t... I>
+inline void decrypt_rounds(T l[4], T r[4], const T (*k)[4], std::index_sequence<I...>) noexcept
+{
+    ((half_round<V>(r, k[2 * (Rounds - I) - 1], l), half_round<V>(l, k[2 * (Rounds - I) - 2], r)), ...);
+}
+
+} // namespace detail
+
+template <unsigned Block, unsigned Key>
+class Cipher
+{
+    static_assert(rounds_v<Block, Key> != 0, "not a SWAN variant, use 64/128, 64/256, 128/128, 128/256 or 256/256");
+
+public:
+    using lane_type = typename variant<Block>::lane;
+    static constexpr unsigned block_bits = Block;
+    static constexpr unsigned key_bits = Key;
+    static constexpr unsigned rounds = rounds_v<Block, Key>;
+    static constexpr std::size_t block_bytes = Block / 8;
+    static constexpr std::size_t key_bytes = Key / 8;
+    static constexpr unsigned rotate = variant<Block>::rotate;
+
+    explicit Cipher(std::span<const std::uint8_t, key_bytes> key) noexcept
+    {
+        //the C key schedules read the key in lanes, copy it to an aligned buffer first;
+        std::array<lane_type, key_bytes / sizeof(lane_type)> k;
+
+        std::memcpy(k.data(), key.data(), key_bytes);
+        if constexpr (Block == BLOCK64)
+            SWAN64_key_schedule(k.data(), Key, rounds, &subkeys_[0][0]);
+        else if constexpr (Block == BLOCK128)
+            SWAN128_key_schedule(k.data(), Key, rounds, &subkeys_[0][0]);
+        else
+            SWAN256_key_schedule(k.data(), Key, rounds, &subkeys_[0][0]);
+        wipe(k.data(), sizeof(k));
+    }
+
+    Cipher(const Cipher &) = delete;
+    Cipher &operator=(const Cipher &) = delete;
+
+    ~Cipher()
+    {
+        wipe(subkeys_, sizeof(subkeys_));
+    }
+
+    void encrypt_block(std::span<const std::uint8_t, block_bytes> in, std::span<std::uint8_t, block_bytes> out) const noexcept
+    {
+        lane_type w[8];
+
+        std::memcpy(w, in.data(), block_bytes);
+        detail::encrypt_rounds<variant<Block>>(w, w + 4, subkeys_, std::make_index_sequence<rounds>());
+        std::memcpy(out.data(), w, block_bytes);
+    }
+
+    void decrypt_block(std::span<const std::uint8_t, block_bytes> in, std::span<std::uint8_t, block_bytes> out) const noexcept
+    {
+        lane_type w[8];
+
+        std::memcpy(w, in.data(), block_bytes);
+        detail::decrypt_rounds<variant<Block>, lane_type, rounds>(w, w + 4, subkeys_, std::make_index_sequence<rounds>());
+        std::memcpy(out.data(), w, block_bytes);
+    }
+
+    //ECB over whole blocks; out may alias in. Throws std::invalid_argument on a length mismatch;
+    void encrypt(std::span<const std::uint8_t> in, std::span<std::uint8_t> out) const
+    {
+        crypt<true>(in, out);
+    }
+
+    void decrypt(std::span<const std::uint8_t> in, std::span<std::uint8_t> out) const
+    {
+        crypt<false>(in, out);
+    }
+
+private:
+    //below this many blocks the unrolled scalar loop beats a partly filled vector kernel call;
+    static constexpr std::size_t kernel_min_blocks = SWAN_KERNEL_WAYS / 4;
+
+    static void wipe(void *p, std::size_t n) noexcept
+    {
+        volatile std::uint8_t *v = static_cast<volatile std::uint8_t *>(p);
+        while (n-- > 0)
+            *v++ = 0;
+    }
+
+    template <bool Enc>
+    void crypt(std::span<const std::uint8_t> in, std::span<std::uint8_t> out) const
+    {
+        const std::size_t nblocks = in.size() / block_bytes;
+
+        if (in.size() % block_bytes != 0 || out.size() < in.size())
+            throw std::invalid_argument("swan::Cipher: input must be whole blocks and fit the output");
+        if (nblocks < kernel_min_blocks)
+        {
+            for (std::size_t i = 0; i < nblocks; i++)
+            {
+                std::span<const std::uint8_t, block_bytes> src(in.data() + i * block_bytes, block_bytes);
+                std::span<std::uint8_t, block_bytes> dst(out.data() + i * block_bytes, block_bytes);
+                if constexpr (Enc)
+                    encrypt_block(src, dst);
+                else
+                    decrypt_block(src, dst);
+            }
+            return;
+        }
+        if constexpr (Block == BLOCK64)
+            (Enc ? SWAN64_encrypt_blocks : SWAN64_decrypt_blocks)(&subkeys_[0][0], rounds, in.data(), out.data(), nblocks);
+        else if constexpr (Block == BLOCK128)
+            (Enc ? SWAN128_encrypt_blocks : SWAN128_decrypt_blocks)(&subkeys_[0][0], rounds, in.data(), out.data(), nblocks);
+        else
+            (Enc ? SWAN256_encrypt_blocks : SWAN256_decrypt_blocks)(&subkeys_[0][0], rounds, in.data(), out.data(), nblocks);
+    }
+
+    lane_type subkeys_[2 * rounds][4];
+};
+
+using SWAN64_K128 = Cipher<BLOCK64, KEY128>;
+using SWAN64_K256 = Cipher<BLOCK64, KEY256>;
+using SWAN128_K128 = Cipher<BLOCK128, KEY128>;
+using SWAN128_K256 = Cipher<BLOCK128, KEY256>;
+using SWAN256_K256 = Cipher<BLOCK256, KEY256>;
+
+//Owning swan_ctx for a variant chosen at run time, with span-based modes of operation;
+class Context
+{
+public:
+    Context(std::uint16_t blocksize, std::uint16_t keysize, std::span<const std::uint8_t> key)
+    {
+        if (key.size() != keysize / 8u || swan_set_key(&ctx_, blocksize, keysize, key.data()) != 0)
+            throw std::invalid_argument("swan::Context: not a SWAN variant or wrong key length");
+    }
+
+    //XTS: data key, tweak key and data unit size (0 for SWAN_XTS_UNIT);
+    Context(std::uint16_t blocksize, std::uint16_t keysize, std::span<const std::uint8_t> key,
+            std::span<const std::uint8_t> tweak_key, std::uint32_t unit = 0)
+    {
+        if (key.size() != keysize / 8u || tweak_key.size() != keysize / 8u ||
+            swan_set_xts_key(&ctx_, blocksize, keysize, key.data(), tweak_key.data(), unit) != 0)
+            throw std::invalid_argument("swan::Context: not a SWAN variant, wrong key length or bad XTS unit");
+    }
+
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+    ~Context()
+    {
+        volatile std::uint8_t *v = reinterpret_cast<volatile std::uint8_t *>(&ctx_);
+        for (std::size_t i = 0; i < sizeof(ctx_); i++)
+            v[i] = 0;
+    }
+
+    std::size_t block_bytes() const noexcept
+    {
+        return swan_block_bytes(&ctx_);
+    }
+
+    const swan_ctx *get() const noexcept
+    {
+        return &ctx_;
+    }
+
+    //swan_crypt() over spans; iv may be empty for ECB. Throws std::invalid_argument where swan_crypt() fails;
+    void crypt(swan_mode mode, bool enc, std::span<std::uint8_t> iv, std::span<const std::uint8_t> in,
+               std::span<std::uint8_t> out) const
+    {
+        if (out.size() < in.size() || (!iv.empty() && iv.size() != block_bytes()) ||
+            swan_crypt(&ctx_, mode, enc ? SWAN_ENCRYPT : SWAN_DECRYPT, iv.empty() ? nullptr : iv.data(), in.data(),
+                       out.data(), in.size()) != 0)
+            throw std::invalid_argument("swan::Context: bad length, IV or mode");
+    }
+
+    void encrypt(swan_mode mode, std::span<std::uint8_t> iv, std::span<const std::uint8_t> in, std::span<std::uint8_t> out) const
+    {
+        crypt(mode, true, iv, in, out);
+    }
+
+    void decrypt(swan_mode mode, std::span<std::uint8_t> iv, std::span<const std::uint8_t> in, std::span<std::uint8_t> out) const
+    {
+        crypt(mode, false, iv, in, out);
+    }
+
+private:
+    swan_ctx ctx_;
+};
+
+} // namespace swan
+
+#endif
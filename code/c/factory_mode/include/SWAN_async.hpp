@@ -0,0 +1,368 @@
+/*
+ *  SWAN_async.hpp
+ *
+ *  Description: C++20 awaitables over the worker pool, for event loops that must not
+ *  block on large buffers:
+ *
+ *      swan::async_result r = co_await swan::encrypt_async(ctx, SWAN_MODE_CTR, iv, in, out);
+ *
+ *  The buffer is streamed through swan_parallel_submit() one window at a time; the
+ *  pool splits every window over its workers and advances the iv, so the next window
+ *  continues where the last one stopped. A swan::throttle shared by all operations
+ *  bounds the bytes in flight: an operation whose next window does not fit parks
+ *  until earlier windows complete. A std::stop_token cancels between windows; the
+ *  result then says how many bytes were done, and iv matches that point.
+ *
+ *  The coroutine is resumed on the worker that completed the last window, or through
+ *  async_options::resume, e.g. to post it back to the event loop.
+ */
+
+#ifndef SWAN_ASYNC_HPP_INCLUDED
+#define SWAN_ASYNC_HPP_INCLUDED
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+
+#include "SWAN.hpp"
+#include "SWAN_parallel.h"
+
+//default bytes per window handed to the pool;
+#define SWAN_ASYNC_WINDOW (4 * 1024 * 1024)
+//default bound on the bytes in flight over all operations sharing the default throttle;
+#define SWAN_ASYNC_INFLIGHT (64 * 1024 * 1024)
+
+namespace swan
+{
+
+struct async_result
+{
+    int status = 0;         //0, or -1 if the pool rejected a window
+    std::size_t bytes = 0;  //bytes encrypted or decrypted
+    bool cancelled = false; //stopped through the stop token before the end
+};
+
+class crypt_op;
+
+//Bound on the bytes in flight, shared by every operation that points at it;
+class throttle
+{
+public:
+    explicit throttle(std::size_t budget = SWAN_ASYNC_INFLIGHT) noexcept : budget_(budget > 0 ? budget : 1)
+    {
+    }
+
+    throttle(const throttle &) = delete;
+    throttle &operator=(const throttle &) = delete;
+
+    std::size_t budget() const noexcept
+    {
+        return budget_;
+    }
+
+    std::size_t in_flight() const
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return in_flight_;
+    }
+
+private:
+    friend class crypt_op;
+
+    struct waiter
+    {
+        crypt_op *op;
+        std::size_t want;
+    };
+
+    //Reserve want bytes, or queue op to be pumped once they are reserved for it;
+    bool acquire_or_park(crypt_op *op, std::size_t want)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        //waiters go first, and a lone window always fits so one larger than the budget cannot stall;
+        if (waiters_.empty() && (in_flight_ + want <= budget_ || in_flight_ == 0))
+        {
+            in_flight_ += want;
+            return true;
+        }
+        waiters_.push_back({op, want});
+        return false;
+    }
+
+    //Drop op from the queue; false if it was not parked;
+    bool unpark(crypt_op *op)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (auto it = waiters_.begin(); it != waiters_.end(); ++it)
+        {
+            if (it->op == op)
+            {
+                waiters_.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void release(std::size_t n);
+
+    std::size_t budget_;
+    std::size_t in_flight_ = 0;
+    std::deque<waiter> waiters_;
+    mutable std::mutex lock_;
+};
+
+inline throttle &default_throttle()
+{
+    static throttle t;
+    return t;
+}
+
+struct async_options
+{
+    throttle *limit = nullptr;                          //nullptr for default_throttle()
+    std::size_t window = SWAN_ASYNC_WINDOW;             //bytes per submission, rounded to whole blocks or XTS units
+    std::stop_token stop;                               //cancels between windows
+    std::function<void(std::coroutine_handle<>)> resume; //how to resume the caller, empty to resume in place
+};
+
+//Awaitable returned by encrypt_async()/decrypt_async(); the buffers must outlive the co_await. Throws
+//std::invalid_argument where swan_crypt() would fail on the lengths or the IV;
+class crypt_op
+{
+public:
+    crypt_op(const swan_ctx *ctx, swan_mode mode, bool enc, std::span<std::uint8_t> iv, std::span<const std::uint8_t> in,
+             std::span<std::uint8_t> out, async_options opts)
+        : ctx_(ctx), mode_(mode), enc_(enc), iv_(iv), in_(in), out_(out), opts_(std::move(opts))
+    {
+        std::size_t bs = swan_block_bytes(ctx);
+
+        limit_ = opts_.limit != nullptr ? opts_.limit : &default_throttle();
+        window_ = opts_.window - opts_.window % bs;
+        if (window_ < bs)
+            window_ = bs;
+        if (mode == SWAN_MODE_XTS && ctx->xts_unit != 0)
+            window_ = window_ < ctx->xts_unit ? ctx->xts_unit : window_ - window_ % ctx->xts_unit;
+        //swan_crypt()'s length rules, checked once here rather than per window;
+        if (out.size() < in.size() || (mode != SWAN_MODE_CTR && in.size() % bs != 0) ||
+            (mode != SWAN_MODE_ECB && iv.size() != bs))
+            throw std::invalid_argument("swan::encrypt_async: bad length or IV");
+    }
+
+    crypt_op(const crypt_op &) = delete;
+    crypt_op &operator=(const crypt_op &) = delete;
+
+    bool await_ready() const noexcept
+    {
+        return in_.empty();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        handle_ = h;
+        state_.store(SUSPENDING);
+        if (opts_.stop.stop_possible())
+        {
+            stop_.emplace(opts_.stop, [this] {
+                if (limit_->unpark(this))
+                    pump();
+            });
+        }
+        pump();
+        //finished before we got here: carry on without suspending;
+        return state_.exchange(SUSPENDED) != DONE;
+    }
+
+    async_result await_resume() noexcept
+    {
+        return result_;
+    }
+
+private:
+    friend class throttle;
+
+    enum
+    {
+        SUSPENDING,
+        SUSPENDED,
+        DONE
+    };
+
+    enum step_result
+    {
+        WAITING,
+        FINISHED
+    };
+
+    //Serialise the steps: whoever finds pending_ at 0 runs them until nothing is left;
+    void pump()
+    {
+        if (pending_.fetch_add(1) != 0)
+            return;
+        do
+        {
+            if (step() == FINISHED)
+            {
+                //nothing is in flight and nothing parked, so no one else will touch this op;
+                finish();
+                return;
+            }
+        } while (pending_.fetch_sub(1) != 1);
+    }
+
+    step_result step()
+    {
+        std::size_t n;
+
+        if (running_)
+        {
+            //a window has completed;
+            running_ = false;
+            limit_->release(reserved_);
+            reserved_ = 0;
+            if (task_.status != 0)
+            {
+                result_.status = -1;
+                return FINISHED;
+            }
+            result_.bytes += task_.len;
+        }
+        if (result_.bytes == in_.size())
+            return FINISHED;
+        if (opts_.stop.stop_requested())
+        {
+            if (reserved_ > 0)
+                limit_->release(reserved_);
+            reserved_ = 0;
+            result_.cancelled = true;
+            return FINISHED;
+        }
+
+        n = in_.size() - result_.bytes < window_ ? in_.size() - result_.bytes : window_;
+        if (reserved_ == 0)
+        {
+            if (!limit_->acquire_or_park(this, n))
+                return WAITING;
+            reserved_ = n;
+        }
+
+        task_.ctx = ctx_;
+        task_.mode = mode_;
+        task_.enc = enc_ ? SWAN_ENCRYPT : SWAN_DECRYPT;
+        task_.iv = iv_.empty() ? nullptr : iv_.data();
+        task_.in = in_.data() + result_.bytes;
+        task_.out = out_.data() + result_.bytes;
+        task_.len = n;
+        task_.status = 0;
+        running_ = true;
+        if (swan_parallel_submit(&task_, &crypt_op::on_done, this) != 0)
+        {
+            running_ = false;
+            limit_->release(reserved_);
+            reserved_ = 0;
+            result_.status = -1;
+            return FINISHED;
+        }
+        return WAITING;
+    }
+
+    static void on_done(swan_task *, void *arg)
+    {
+        static_cast<crypt_op *>(arg)->pump();
+    }
+
+    void finish()
+    {
+        std::coroutine_handle<> h = handle_;
+
+        if (state_.exchange(DONE) == SUSPENDING)
+            return;
+        if (opts_.resume)
+            opts_.resume(h);
+        else
+            h.resume();
+    }
+
+    const swan_ctx *ctx_;
+    swan_mode mode_;
+    bool enc_;
+    std::span<std::uint8_t> iv_;
+    std::span<const std::uint8_t> in_;
+    std::span<std::uint8_t> out_;
+    async_options opts_;
+    throttle *limit_;
+    std::size_t window_;
+    std::size_t reserved_ = 0;
+    bool running_ = false;
+    swan_task task_{};
+    async_result result_;
+    std::coroutine_handle<> handle_;
+    std::atomic<int> state_{SUSPENDING};
+    std::atomic<unsigned> pending_{0};
+    std::optional<std::stop_callback<std::function<void()>>> stop_;
+};
+
+inline void throttle::release(std::size_t n)
+{
+    std::deque<waiter> ready;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        in_flight_ -= n;
+        while (!waiters_.empty() && (in_flight_ + waiters_.front().want <= budget_ || in_flight_ == 0))
+        {
+            in_flight_ += waiters_.front().want;
+            waiters_.front().op->reserved_ = waiters_.front().want;
+            ready.push_back(waiters_.front());
+            waiters_.pop_front();
+        }
+    }
+    for (waiter &w : ready)
+        w.op->pump();
+}
+
+inline crypt_op encrypt_async(const swan_ctx *ctx, swan_mode mode, std::span<std::uint8_t> iv,
+                              std::span<const std::uint8_t> in, std::span<std::uint8_t> out, async_options opts = {})
+{
+    return crypt_op(ctx, mode, true, iv, in, out, std::move(opts));
+}
+
+inline crypt_op decrypt_async(const swan_ctx *ctx, swan_mode mode, std::span<std::uint8_t> iv,
+                              std::span<const std::uint8_t> in, std::span<std::uint8_t> out, async_options opts = {})
+{
+    return crypt_op(ctx, mode, false, iv, in, out, std::move(opts));
+}
+
+inline crypt_op encrypt_async(const Context &ctx, swan_mode mode, std::span<std::uint8_t> iv,
+                              std::span<const std::uint8_t> in, std::span<std::uint8_t> out, async_options opts = {})
+{
+    return crypt_op(ctx.get(), mode, true, iv, in, out, std::move(opts));
+}
+
+inline crypt_op decrypt_async(const Context &ctx, swan_mode mode, std::span<std::uint8_t> iv,
+                              std::span<const std::uint8_t> in, std::span<std::uint8_t> out, async_options opts = {})
+{
+    return crypt_op(ctx.get(), mode, false, iv, in, out, std::move(opts));
+}
+
+//ECB in place, the short form: co_await swan::encrypt_async(ctx, data);
+inline crypt_op encrypt_async(const Context &ctx, std::span<std::uint8_t> data, async_options opts = {})
+{
+    return crypt_op(ctx.get(), SWAN_MODE_ECB, true, {}, data, data, std::move(opts));
+}
+
+inline crypt_op decrypt_async(const Context &ctx, std::span<std::uint8_t> data, async_options opts = {})
+{
+    return crypt_op(ctx.get(), SWAN_MODE_ECB, false, {}, data, data, std::move(opts));
+}
+
+} // namespace swan
+
+#endif
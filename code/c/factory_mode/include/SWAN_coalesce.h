@@ -0,0 +1,95 @@
+/*
+ *  SWAN_coalesce.h
+ *
+ *  Description: Opt-in coalescing front end for callers that encrypt one or two blocks
+ *  at a time. Requests from any number of threads are queued; a dispatcher thread
+ *  gathers requests for the same key and direction until max_blocks blocks are queued
+ *  or the oldest request has waited deadline_us, then runs them in one batch kernel
+ *  call and completes each request through its callback or future.
+ */
+
+#ifndef SWAN_COALESCE_H_INCLUDED
+#define SWAN_COALESCE_H_INCLUDED
+#include "SWAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//largest configurable batch, in blocks;
+#define SWAN_COALESCE_MAX_BLOCKS (4 * SWAN_KERNEL_WAYS)
+//default wait for a batch to fill, in microseconds;
+#define SWAN_COALESCE_DEADLINE_US 20
+//buckets of the queueing-delay histogram, bucket i counts delays below 2^i microseconds;
+#define SWAN_COALESCE_DELAY_BUCKETS 16
+
+typedef struct swan_coalescer swan_coalescer;
+typedef struct swan_request swan_request;
+
+//Completion callback, called on the dispatcher thread; it must not block for long;
+typedef void (*swan_request_done)(swan_request *req, void *arg);
+
+typedef struct
+{
+    unsigned max_blocks;  //blocks per kernel call, 0 for SWAN_KERNEL_WAYS, at most SWAN_COALESCE_MAX_BLOCKS
+    unsigned deadline_us; //longest wait for a batch to fill, 0 for SWAN_COALESCE_DEADLINE_US
+} swan_coalescer_config;
+
+/*
+ * One ECB encryption or decryption of nblocks blocks. Fill in the first fields; the
+ * rest belongs to the coalescer until the request completes. With done == NULL the
+ * request is a future and the caller collects it with swan_coalesce_wait().
+ */
+struct swan_request
+{
+    const swan_ctx *ctx;
+    int enc;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t nblocks;
+    swan_request_done done;
+    void *arg;
+    int status; //set to 0 once the request has run
+
+    swan_request *next;
+    uint64_t submit_ns;
+    int complete;
+};
+
+typedef struct
+{
+    uint64_t requests;
+    uint64_t blocks;
+    uint64_t batches;
+    uint64_t full_batches;     //batches that reached max_blocks
+    uint64_t deadline_batches; //batches sent by the deadline before they were full
+    double avg_fill;           //blocks per batch over max_blocks
+    uint64_t fill[SWAN_COALESCE_MAX_BLOCKS + 1]; //batches by number of blocks
+    uint64_t delay_ns_total;   //submit to kernel call, summed over requests
+    uint64_t delay_ns_max;
+    uint64_t delay_hist[SWAN_COALESCE_DELAY_BUCKETS];
+} swan_coalescer_stats;
+
+//Start a coalescer and its dispatcher thread; cfg may be NULL for the defaults. Returns NULL on failure;
+swan_coalescer *swan_coalescer_create(const swan_coalescer_config *cfg);
+
+//Run every queued request, then stop the dispatcher and free the coalescer;
+void swan_coalescer_destroy(swan_coalescer *c);
+
+//Queue req; returns -1, without completing it, if req is invalid or the coalescer is stopping;
+int swan_coalesce_submit(swan_coalescer *c, swan_request *req);
+
+//Wait for a request submitted without a callback and return its status;
+int swan_coalesce_wait(swan_coalescer *c, swan_request *req);
+
+//Submit and wait, for callers that simply want a batched swan_encrypt_blocks();
+int swan_coalesce_crypt(swan_coalescer *c, const swan_ctx *ctx, int enc, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+//Copy the batch-fill and queueing-delay metrics;
+void swan_coalescer_stats_get(swan_coalescer *c, swan_coalescer_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
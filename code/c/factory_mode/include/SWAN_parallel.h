@@ -0,0 +1,102 @@
+/*
+ *  SWAN_parallel.h
+ *
+ *  Description: Library-managed work-stealing worker pool that spreads large
+ *  swan_crypt() calls, and batches of many small ones, over several cores.
+ *  When built with libnuma (SWAN_HAVE_NUMA) on a multi-node machine, workers are
+ *  bound to nodes, large buffers are handed to the node that holds their pages and
+ *  every node reads its own copy of the key schedule, kept across calls until
+ *  swan_pool_stop().
+ */
+
+#ifndef SWAN_PARALLEL_H_INCLUDED
+#define SWAN_PARALLEL_H_INCLUDED
+#include "SWAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//bytes per task, small enough to stay in L2 with its output;
+#define SWAN_PARALLEL_CHUNK (64 * 1024)
+//buffers below this run in the calling thread;
+#define SWAN_PARALLEL_THRESHOLD (256 * 1024)
+
+typedef struct
+{
+    unsigned threads; //worker threads, 0 for one per online CPU minus the caller
+    int pin;          //pin worker i to CPU i modulo the online CPUs
+    size_t chunk;     //bytes per task, 0 for SWAN_PARALLEL_CHUNK
+    size_t threshold; //direct-path limit in bytes, 0 for SWAN_PARALLEL_THRESHOLD
+    int numa;         //0 on with more than one node, 1 always on, -1 off; ignored without libnuma
+} swan_pool_config;
+
+//One swan_crypt() call for swan_parallel_batch();
+typedef struct
+{
+    const swan_ctx *ctx;
+    swan_mode mode;
+    int enc;
+    uint8_t *iv;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+    int status; //swan_crypt() result, set on completion
+} swan_task;
+
+//Completion callback of swan_parallel_submit(), called on a worker thread;
+typedef void (*swan_task_done)(swan_task *task, void *arg);
+
+typedef struct
+{
+    uint64_t tasks;     //chunks executed
+    uint64_t bytes;     //bytes encrypted or decrypted
+    uint64_t steals;    //chunks taken from another worker's deque
+    uint64_t busy_ns;   //time spent inside the kernels
+    double utilisation; //busy_ns over the time since the pool started
+    int node;           //NUMA node the worker is bound to, -1 without NUMA placement
+} swan_worker_stats;
+
+//Start the pool; cfg may be NULL for the defaults. Returns -1 if it is already running or a thread cannot start,
+//in which case the threads that did start are stopped again and the pool is left stopped;
+int swan_pool_start(const swan_pool_config *cfg);
+
+//Stop and join the workers; pending calls finish first, calls made meanwhile run in the calling thread;
+void swan_pool_stop(void);
+
+//Number of worker threads, 0 when the pool is not running;
+unsigned swan_pool_threads(void);
+
+//Copy the counters of up to max workers into stats; returns how many were written;
+unsigned swan_pool_stats(swan_worker_stats *stats, unsigned max);
+
+/*
+ * Same contract as swan_crypt(), but ECB, CTR, XTS and CBC decryption are split into
+ * chunks that the workers and the calling thread process concurrently. CBC encryption
+ * and buffers below the threshold take the direct path. The pool is started with the
+ * default configuration on first use.
+ */
+int swan_parallel_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                        const uint8_t *in, uint8_t *out, size_t len);
+
+/*
+ * Run n independent tasks of any size on the pool and wait for all of them. Small
+ * tasks run whole, large ones are split into chunks like swan_parallel_crypt(); CBC
+ * encryption tasks run whole on one worker. Returns 0 if every task succeeded.
+ */
+int swan_parallel_batch(swan_task *tasks, size_t n);
+
+/*
+ * Queue one task and return without waiting. When it has run, task->status and iv are
+ * set as by swan_parallel_crypt() and done(task, arg) is called on the worker that
+ * finished it; task and its buffers must stay valid until then. Without worker
+ * threads the task runs, and done is called, before this returns. Returns -1, and
+ * never calls done, if the task is invalid.
+ */
+int swan_parallel_submit(swan_task *task, swan_task_done done, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ *  SWAN_sampler.h
+ *
+ *  Description: Latency histograms. swan_hist is a fixed-size HDR-style histogram:
+ *  values below 128 are counted exactly, larger ones in buckets 1/64 of their power
+ *  of two wide, so every percentile is within 1.6% of the recorded value, up to
+ *  2^40 ns. Recording is a few relaxed atomic adds, safe from any number of threads.
+ *
+ *  The sampler, built with SWAN_SAMPLER, records the latency of one in period calls
+ *  of swan_set_key()/swan_set_xts_key() and swan_crypt() per variant, mode and
+ *  direction into such histograms, so a running service can report its own tail
+ *  latency. While it is stopped each call pays one load and a branch.
+ */
+
+#ifndef SWAN_SAMPLER_H_INCLUDED
+#define SWAN_SAMPLER_H_INCLUDED
+#include "SWAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//values below 2^SWAN_HIST_SUB_BITS are exact, larger ones have SWAN_HIST_SUB_BITS-1 significant bits;
+#define SWAN_HIST_SUB_BITS 7
+//largest value kept, larger ones are counted as this;
+#define SWAN_HIST_MAX ((UINT64_C(1) << 40) - 1)
+#define SWAN_HIST_BUCKETS ((40 - SWAN_HIST_SUB_BITS + 2) << (SWAN_HIST_SUB_BITS - 1))
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t bucket[SWAN_HIST_BUCKETS];
+} swan_hist;
+
+void swan_hist_reset(swan_hist *h);
+void swan_hist_record(swan_hist *h, uint64_t v);
+void swan_hist_merge(swan_hist *dst, const swan_hist *src);
+
+//The smallest recorded value (to histogram precision) that p percent of the values do not exceed; 0 if empty;
+uint64_t swan_hist_percentile(const swan_hist *h, double p);
+
+//for swan_sampler_read(): key setup instead of a swan_mode;
+#define SWAN_SAMPLE_SET_KEY 4
+
+/*
+ * Sample one in period calls on each thread, period 1 for every call, from now on;
+ * the histograms start empty. Returns -1 with errno ENOSYS if the library was built
+ * without SWAN_SAMPLER, or ENOMEM.
+ */
+int swan_sampler_start(unsigned period);
+
+void swan_sampler_stop(void);
+
+/*
+ * Copy the histogram of call latencies in ns for a variant and op, a swan_mode or
+ * SWAN_SAMPLE_SET_KEY; enc picks the direction of a mode and is ignored for key
+ * setup. Returns -1 if the variant or op is invalid or the sampler never ran.
+ */
+int swan_sampler_read(uint16_t blocksize, uint16_t keysize, int op, int enc, swan_hist *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ *  SWAN_stats.h
+ *
+ *  Description: Per-thread counters of the library's hot paths, built with SWAN_STATS:
+ *  key setups, swan_crypt() calls per mode, and which batch kernel ran on how many
+ *  blocks at a time, so a service can see which paths its traffic takes and how
+ *  often batches are underfilled. Every thread counts into its own block, a plain
+ *  add with no shared cache line; readers sum the blocks.
+ */
+
+#ifndef SWAN_STATS_H_INCLUDED
+#define SWAN_STATS_H_INCLUDED
+#include "SWAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//batch_size[] buckets: k holds kernel runs of [2^k, 2^(k+1)) blocks, the last also everything larger;
+#define SWAN_STATS_SIZES 16
+
+typedef struct
+{
+    uint64_t key_setups;                //swan_set_key() and swan_set_xts_key()
+    uint64_t crypt_calls[4];            //swan_crypt() by swan_mode
+    uint64_t kernel_calls[3][2];        //batch kernel runs by block width (64, 128, 256) and direction (decrypt, encrypt)
+    uint64_t blocks[3][2];              //blocks through them
+    uint64_t partial;                   //kernel runs ending in a pass of fewer than SWAN_KERNEL_WAYS blocks
+    uint64_t batch_size[SWAN_STATS_SIZES];
+} swan_stats;
+
+/*
+ * The counts of the calling thread, or summed over every thread that has used the
+ * library, exited ones included. The counts only grow; take differences between two
+ * reads. Both return -1 with errno ENOSYS if the library was built without
+ * SWAN_STATS, and swan_stats_thread() ENOMEM if this thread's block cannot be made.
+ */
+int swan_stats_thread(swan_stats *s);
+int swan_stats_total(swan_stats *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
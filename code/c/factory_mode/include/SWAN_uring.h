@@ -0,0 +1,44 @@
+/*
+ *  SWAN_uring.h
+ *
+ *  Description: io_uring pipeline that encrypts one file into another. Reads into
+ *  registered buffers stay in flight while completed buffers are encrypted on the
+ *  worker pool and written back without blocking, so the disk and the cores are
+ *  busy at the same time.
+ */
+
+#ifndef SWAN_URING_H_INCLUDED
+#define SWAN_URING_H_INCLUDED
+#include "SWAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//buffers in flight;
+#define SWAN_URING_DEPTH 8
+//bytes per buffer;
+#define SWAN_URING_BUF (1024 * 1024)
+
+typedef struct
+{
+    unsigned depth;  //buffers in flight, 0 for SWAN_URING_DEPTH
+    size_t buf_size; //bytes per buffer, 0 for SWAN_URING_BUF; rounded to whole blocks or XTS units
+} swan_uring_config;
+
+/*
+ * Encrypt or decrypt the first len bytes of in_fd into out_fd at the same offsets,
+ * with the same contract as swan_crypt() for mode, iv and len. Both descriptors
+ * must support positional I/O. CBC encryption is one serial chain and is not
+ * pipelined. cfg may be NULL for the defaults.
+ * Returns 0 on success and -1 on failure. errno is ENOSYS when io_uring is not
+ * available (kernel, seccomp or build), so the caller can fall back to read/write.
+ */
+int swan_uring_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                     int in_fd, int out_fd, uint64_t len, const swan_uring_config *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ *  SWAN_wb.h
+ *
+ *  Description: White-box SWAN128. swan_wb_generate() turns a SWAN128 key into lookup
+ *  tables that merge the round keys, Beta, SwitchLanes and random encodings of the
+ *  state, and swan_wb_encrypt()/swan_wb_decrypt() run the cipher from those tables
+ *  alone; the key is not kept.
+ *
+ *  Each half is held in S-box order, nibble s carrying bit s+rot[i] of lane i, so
+ *  ShiftLanes costs nothing. A half round is then
+ *      y = RE(y) ^ T_0[x_0] ^ ... ^ T_{n-1}[x_{n-1}]
+ *  over the encoded blocks x_b of the other half: T_b decodes its block, adds the
+ *  round key, applies Beta and SwitchLanes, routes the bits into y's nibbles and
+ *  encodes them for y's next encoding; RE moves y itself to that encoding. Encodings
+ *  are random block-diagonal affine maps, fresh for every half round, so the XORs
+ *  stay valid, and the T outputs carry random masks that cancel within a half round.
+ *
+ *  With 4-bit blocks every T entry shrinks to the one encoded bit an S-box sends to
+ *  each of four nibbles of y, so a half round is 64 16-entry nibble tables plus 16 for
+ *  RE. The runtime keeps 16 (SSSE3) or 32 (AVX2) blocks as nibble planes and evaluates
+ *  each table for all of them with one PSHUFB, instead of scalar gathers.
+ *  16-bit blocks go the other way: four lookups per half round into 64K-entry tables.
+ */
+
+#ifndef SWAN_WB_H_INCLUDED
+#define SWAN_WB_H_INCLUDED
+#include "SWAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWAN_WB_ENCRYPT 1
+#define SWAN_WB_DECRYPT 2
+
+//bytes of generator seed;
+#define SWAN_WB_SEED_BYTES 32
+
+typedef struct swan_wb swan_wb;
+
+/*
+ * Cache budgets, each with its own block width. Wider encodings mix more bits per
+ * table, which is the security margin, and cost lookups further from the core:
+ *   L1         4-bit blocks, nibble tables run with PSHUFB; one half round reads 1.25 KiB
+ *   L2         8-bit blocks, 1.7 MiB (SWAN128-128) or 2.3 MiB (SWAN128-256) per direction
+ *   UNLIMITED  16-bit blocks, 240 or 320 MiB per direction, every lookup a cache miss
+ */
+typedef enum
+{
+    SWAN_WB_TIER_NONE, //use swan_wb_config.width
+    SWAN_WB_TIER_L1,
+    SWAN_WB_TIER_L2,
+    SWAN_WB_TIER_UNLIMITED
+} swan_wb_tier;
+
+/*
+ * Order of the tables in memory. PLAIN keeps every kind of table in its own section;
+ * INTERLEAVED stores each half round's tables together in execution order, and the
+ * runtime then prefetches the entries the next half round will read while the
+ * current one runs, which pays off once the tables no longer fit the caches.
+ */
+typedef enum
+{
+    SWAN_WB_LAYOUT_PLAIN,
+    SWAN_WB_LAYOUT_INTERLEAVED
+} swan_wb_layout_kind;
+
+typedef struct
+{
+    unsigned dirs;       //SWAN_WB_ENCRYPT and/or SWAN_WB_DECRYPT, 0 for both
+    const uint8_t *seed; //SWAN_WB_SEED_BYTES for reproducible tables, NULL to draw a seed from /dev/urandom
+    unsigned threads;    //generator threads, 0 for one per CPU; the tables do not depend on it
+    unsigned width;      //bits per encoded block: 4, 8 or 16; 0 for 8. Ignored if tier is set
+    swan_wb_tier tier;   //cache budget, picks the width
+    swan_wb_layout_kind layout;
+    int hugepages;       //back the tables with 2 MiB pages (transparent hugepages)
+} swan_wb_config;
+
+typedef struct
+{
+    unsigned width;    //bits per encoded block
+    size_t bytes;      //table file size
+    int level;         //cache level one direction's tables fit in, 4 for memory
+    double cycles;     //predicted cycles per block on this CPU
+} swan_wb_estimate;
+
+/*
+ * Predict the tables cfg would generate for a keysize-bit key without generating them:
+ * their size, where they fit in this CPU's caches, and the cycles per block of the
+ * runtime swan_wb_encrypt() would pick. The cycle figure is a simple model (lookups
+ * per block times the latency of that cache level plus a page walk when the tables
+ * outgrow the TLB on 4 KiB pages, divided by the lookups in flight), good for
+ * comparing tiers rather than for exact numbers. Returns -1 if cfg is invalid;
+ */
+int swan_wb_estimate_config(uint16_t keysize, const swan_wb_config *cfg, swan_wb_estimate *est);
+
+//Build the tables for a SWAN128 key of keysize bits; cfg may be NULL. Returns NULL on failure;
+swan_wb *swan_wb_generate(const uint8_t *key, uint16_t keysize, const swan_wb_config *cfg);
+
+void swan_wb_free(swan_wb *wb);
+
+/*
+ * Write the tables to path as a table file: a versioned header page followed by
+ * page-aligned sections. The file is written under a temporary name and renamed
+ * into place, so processes that have the old file mapped are not disturbed.
+ * Returns 0 on success, -1 on failure.
+ */
+int swan_wb_save(const swan_wb *wb, const char *path);
+
+/*
+ * Map a table file read-only and use the tables in place: loading costs one mmap and
+ * a header check, and the pages are shared with every other process that maps the
+ * file. Returns NULL if the file is missing, truncated, from another version or byte
+ * order, or its header is corrupt. The tables themselves are only checked by
+ * swan_wb_verify(), which reads all of them.
+ */
+swan_wb *swan_wb_load(const char *path);
+
+//for swan_wb_load_flags();
+#define SWAN_WB_LOAD_HUGEPAGES 1
+
+/*
+ * swan_wb_load() with options. SWAN_WB_LOAD_HUGEPAGES copies the tables into private
+ * memory on 2 MiB pages (hugetlbfs pages if the system has reserved some, transparent
+ * hugepages otherwise), trading the shared page-cache copy for far fewer TLB misses.
+ */
+swan_wb *swan_wb_load_flags(const char *path, unsigned flags);
+
+//Compare the tables with the checksum taken at generation; returns 0 if they match;
+int swan_wb_verify(const swan_wb *wb);
+
+//The encoding ID of the tables, which names them in the registry below;
+uint64_t swan_wb_id(const swan_wb *wb);
+
+/*
+ * Publish the tables in POSIX shared memory under their ID, so that every process on
+ * the host can swan_wb_attach() one copy instead of generating or loading its own.
+ * The object is written under a temporary name and linked into place complete, so
+ * attachers never see it half written. Publishing an ID that is already published
+ * succeeds if the published tables have the same checksum; an object under the ID that
+ * does not attach, left half written by a crashed publisher, is replaced.
+ * Returns 0 on success, -1 on failure.
+ */
+int swan_wb_publish(const swan_wb *wb);
+
+/*
+ * Map published tables read-only: one shm_open, one mmap and a header check, like
+ * swan_wb_load(). The pages are shared, so the host holds one copy however many
+ * processes attach. swan_wb_free() detaches. Returns NULL if nothing complete is
+ * published under id.
+ */
+swan_wb *swan_wb_attach(uint64_t id);
+
+//Remove id from the registry; processes attached to it keep their mapping until they detach;
+int swan_wb_unpublish(uint64_t id);
+
+typedef struct
+{
+    unsigned dirs;        //directions to re-encode, 0 for every one the tables have
+    unsigned first_round; //re-encode the state encodings produced in rounds first_round..first_round+rounds-1;
+    unsigned rounds;      //0 for every round from first_round on. Round 0 includes the input tables' encodings
+    const uint8_t *seed;  //SWAN_WB_SEED_BYTES for a reproducible refresh, NULL to draw one from /dev/urandom
+    unsigned threads;     //0 for one per CPU
+} swan_wb_refresh_config;
+
+/*
+ * Replace some of the internal encodings with fresh random ones without the key and
+ * without regenerating: each chosen encoding is composed with a random block-affine
+ * map, the tables that produce that state are mapped through it with fresh masks, and
+ * the tables that read it are permuted by its inverse. Only tables next to a chosen
+ * encoding change; the cipher does not. The tables get a new encoding ID and checksum,
+ * and no longer follow from the generation seed. Works on generated tables only, as
+ * loaded ones are read-only; returns -1 on failure.
+ */
+int swan_wb_refresh(swan_wb *wb, const swan_wb_refresh_config *cfg);
+
+/*
+ * swan_wb_refresh() on a table file in place: only the pages of the changed tables and
+ * the header are rewritten, header last. Processes that have the file mapped see the
+ * tables change under them and must not use them meanwhile; to swap tables under live
+ * processes, refresh generated tables and swan_wb_save() them instead. Returns 0 on
+ * success, -1 on failure.
+ */
+int swan_wb_refresh_file(const char *path, const swan_wb_refresh_config *cfg);
+
+typedef enum
+{
+    SWAN_WB_AUTO,   //the fastest this CPU supports
+    SWAN_WB_SCALAR, //one table lookup at a time
+    SWAN_WB_SSSE3,  //16 blocks per PSHUFB, 4-bit tables only
+    SWAN_WB_AVX2    //32 blocks per VPSHUFB, 4-bit tables only
+} swan_wb_backend;
+
+//Choose the runtime; returns -1 if these tables or this CPU cannot use it;
+int swan_wb_set_backend(swan_wb *wb, swan_wb_backend backend);
+
+//The runtime swan_wb_encrypt()/swan_wb_decrypt() will use;
+swan_wb_backend swan_wb_get_backend(const swan_wb *wb);
+
+//Bytes of the table image, header page included;
+size_t swan_wb_size(const swan_wb *wb);
+
+//ECB over nblocks SWAN128 blocks; in == out is allowed. Return -1 if the tables were built without that direction;
+int swan_wb_encrypt(const swan_wb *wb, const uint8_t *in, uint8_t *out, size_t nblocks);
+int swan_wb_decrypt(const swan_wb *wb, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
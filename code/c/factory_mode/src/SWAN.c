@@ -6,8 +6,7 @@
 void RotateKeyByte(uint8_t *key, uint16_t keylength, uint8_t Rlength)
 {
     uint8_t i;
-    uint8_t *temp;
-    temp = (uint8_t *)malloc(sizeof(uint8_t) * Rlength);
+    uint8_t temp[KEY256 / 8];
 
     for (i = 0; i < Rlength; i++)
     {
@@ -15,7 +14,7 @@ void RotateKeyByte(uint8_t *key, uint16_t keylength, uint8_t Rlength)
     }
 
     //Right rotate every byte of the key;
-    for (i = 0; i < (keylength / 8) - 1; i++)
+    for (i = 0; i < (keylength / 8) - Rlength; i++)
     {
         key[i] = key[i + Rlength];
     }
@@ -29,14 +28,13 @@ void RotateKeyByte(uint8_t *key, uint16_t keylength, uint8_t Rlength)
 void InvRotateKeyByte(uint8_t *key, uint16_t keylength, uint8_t Rlength)
 {
     uint8_t i;
-    uint8_t *temp;
-    temp = (uint8_t *)malloc(sizeof(uint8_t) * Rlength);
+    uint8_t temp[KEY256 / 8];
     for (i = 0; i < Rlength; i++)
     {
         temp[i] = key[(keylength / 8) - (Rlength - i)];
     }
     //Right rotate every byte of the key;
-    for (i = (keylength / 8) - 1; i > 0; i--)
+    for (i = (keylength / 8) - 1; i >= Rlength; i--)
     {
         key[i] = key[i - Rlength];
     }
@@ -561,4 +561,142 @@ void SWAN128_K256_decrypt_rounds(const uint16_t *cipher, const uint16_t *masterk
     plain[7] = R[3];
 }
 
+//Expand the masterkey into the 2*rounds half round subkeys, the same sequence the on-the-fly schedule produces;
+void SWAN128_key_schedule(const uint16_t *masterkey, const uint16_t keysize, const uint8_t rounds, uint16_t *subkeys)
+{
+    uint16_t i;
+    uint16_t key[KEY256 / 16];
+    uint16_t subkey[4];
+    uint64_t round_constant = 0;
+    memcpy(key, masterkey, keysize / 8);
+
+    for (i = 0; i < 2 * rounds; i++)
+    {
+        RotateKeyByte((uint8_t *)key, keysize, ROTATE_128);
+        subkey[0] = key[0];
+        subkey[1] = key[1];
+        subkey[2] = key[2];
+        subkey[3] = key[3];
+        round_constant = round_constant + DELTA_128;
+        AddRoundConstant64(subkey, round_constant);
+        key[0] = subkey[0];
+        key[1] = subkey[1];
+        key[2] = subkey[2];
+        key[3] = subkey[3];
+
+        memcpy(subkeys + 4 * i, subkey, 8);
+    }
+}
+
+//uint16_t lanes of SWAN_KERNEL_WAYS blocks side by side;
+typedef uint16_t SWAN128_lanes __attribute__((vector_size(sizeof(uint16_t) * SWAN_KERNEL_WAYS)));
+
+//One half round on all ways at once: y ^= SwitchLanes(Beta(ShiftLanes(x) ^ k));
+static inline void SWAN128_F(const SWAN128_lanes x[4], const uint16_t k[4], SWAN128_lanes y[4])
+{
+    SWAN128_lanes a0, a1, a2, a3;
+    SWAN128_lanes b0, b1, b2, b3;
+
+    a0 = x[0] ^ k[0];
+    a1 = ROL16(x[1], A_128) ^ k[1];
+    a2 = ROL16(x[2], B_128) ^ k[2];
+    a3 = ROL16(x[3], C_128) ^ k[3];
+
+    b0 = ~(a0 ^ a1 ^ a3 ^ (a2 & a3));
+    b1 = a0 ^ (a0 & a1) ^ a2 ^ (a0 & a3) ^ (a1 & a3) ^ (a0 & a1 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3) ^ (a1 & a2 & a3);
+    b2 = a1 ^ a2 ^ (a0 & a2) ^ a3 ^ (a0 & a1 & a3) ^ (a1 & a2 & a3);
+    b3 = a1 ^ (a0 & a1) ^ (a0 & a2) ^ (a0 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3);
+
+    y[0] ^= b1 ^ b2 ^ b3;
+    y[1] ^= b0 ^ b2 ^ b3;
+    y[2] ^= b0 ^ b1 ^ b3;
+    y[3] ^= b0 ^ b1 ^ b2;
+}
 
+//Transpose up to SWAN_KERNEL_WAYS blocks into lane vectors and back;
+static inline void SWAN128_load(const uint8_t *in, size_t m, SWAN128_lanes L[4], SWAN128_lanes R[4])
+{
+    size_t j;
+    int l;
+    uint16_t w[8];
+
+    memset(L, 0, sizeof(SWAN128_lanes) * 4);
+    memset(R, 0, sizeof(SWAN128_lanes) * 4);
+    for (j = 0; j < m; j++)
+    {
+        memcpy(w, in + j * (BLOCK128 / 8), BLOCK128 / 8);
+        for (l = 0; l < 4; l++)
+        {
+            L[l][j] = w[l];
+            R[l][j] = w[l + 4];
+        }
+    }
+}
+
+static inline void SWAN128_store(uint8_t *out, size_t m, const SWAN128_lanes L[4], const SWAN128_lanes R[4])
+{
+    size_t j;
+    int l;
+    uint16_t w[8];
+
+    for (j = 0; j < m; j++)
+    {
+        for (l = 0; l < 4; l++)
+        {
+            w[l] = L[l][j];
+            w[l + 4] = R[l][j];
+        }
+        memcpy(out + j * (BLOCK128 / 8), w, BLOCK128 / 8);
+    }
+}
+
+void SWAN128_encrypt_blocks(const uint16_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    size_t m;
+    uint16_t i;
+    SWAN128_lanes L[4];
+    SWAN128_lanes R[4];
+
+    while (nblocks > 0)
+    {
+        m = nblocks < SWAN_KERNEL_WAYS ? nblocks : SWAN_KERNEL_WAYS;
+        SWAN128_load(in, m, L, R);
+
+        for (i = 0; i < 2 * rounds; i += 2)
+        {
+            SWAN128_F(L, subkeys + 4 * i, R);
+            SWAN128_F(R, subkeys + 4 * (i + 1), L);
+        }
+
+        SWAN128_store(out, m, L, R);
+        in += m * (BLOCK128 / 8);
+        out += m * (BLOCK128 / 8);
+        nblocks -= m;
+    }
+}
+
+void SWAN128_decrypt_blocks(const uint16_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    size_t m;
+    uint16_t i;
+    SWAN128_lanes L[4];
+    SWAN128_lanes R[4];
+
+    while (nblocks > 0)
+    {
+        m = nblocks < SWAN_KERNEL_WAYS ? nblocks : SWAN_KERNEL_WAYS;
+        SWAN128_load(in, m, L, R);
+
+        //walk the subkeys backwards, undoing the second half round first;
+        for (i = 2 * rounds; i > 0; i -= 2)
+        {
+            SWAN128_F(R, subkeys + 4 * (i - 1), L);
+            SWAN128_F(L, subkeys + 4 * (i - 2), R);
+        }
+
+        SWAN128_store(out, m, L, R);
+        in += m * (BLOCK128 / 8);
+        out += m * (BLOCK128 / 8);
+        nblocks -= m;
+    }
+}
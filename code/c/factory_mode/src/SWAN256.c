@@ -363,3 +363,144 @@ void SWAN256_decrypt_rounds(const uint32_t *cipher, const uint32_t *masterkey, c
     plain[6] = R[2];
     plain[7] = R[3];
 }
+
+//Expand the masterkey into the 2*rounds half round subkeys, the same sequence the on-the-fly schedule produces;
+void SWAN256_key_schedule(const uint32_t *masterkey, const uint16_t keysize, const uint8_t rounds, uint32_t *subkeys)
+{
+    uint16_t i;
+    uint32_t key[KEY256 / 32];
+    uint32_t subkey[4];
+    uint32_t round_constant[4];
+    memcpy(key, masterkey, keysize / 8);
+    memset(round_constant, 0, sizeof(round_constant));
+
+    for (i = 0; i < 2 * rounds; i++)
+    {
+        RotateKeyByte((uint8_t *)key, keysize, ROTATE_256);
+        subkey[0] = key[0];
+        subkey[1] = key[1];
+        subkey[2] = key[2];
+        subkey[3] = key[3];
+        ADD128(round_constant, delta);
+        ADD128(subkey, round_constant);
+        key[0] = subkey[0];
+        key[1] = subkey[1];
+        key[2] = subkey[2];
+        key[3] = subkey[3];
+
+        memcpy(subkeys + 4 * i, subkey, 16);
+    }
+}
+
+//uint32_t lanes of SWAN_KERNEL_WAYS blocks side by side;
+typedef uint32_t SWAN256_lanes __attribute__((vector_size(sizeof(uint32_t) * SWAN_KERNEL_WAYS)));
+
+//One half round on all ways at once: y ^= SwitchLanes(Beta(ShiftLanes(x) ^ k));
+static inline void SWAN256_F(const SWAN256_lanes x[4], const uint32_t k[4], SWAN256_lanes y[4])
+{
+    SWAN256_lanes a0, a1, a2, a3;
+    SWAN256_lanes b0, b1, b2, b3;
+
+    a0 = x[0] ^ k[0];
+    a1 = ROL32(x[1], A_256) ^ k[1];
+    a2 = ROL32(x[2], B_256) ^ k[2];
+    a3 = ROL32(x[3], C_256) ^ k[3];
+
+    b0 = ~(a0 ^ a1 ^ a3 ^ (a2 & a3));
+    b1 = a0 ^ (a0 & a1) ^ a2 ^ (a0 & a3) ^ (a1 & a3) ^ (a0 & a1 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3) ^ (a1 & a2 & a3);
+    b2 = a1 ^ a2 ^ (a0 & a2) ^ a3 ^ (a0 & a1 & a3) ^ (a1 & a2 & a3);
+    b3 = a1 ^ (a0 & a1) ^ (a0 & a2) ^ (a0 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3);
+
+    y[0] ^= b1 ^ b2 ^ b3;
+    y[1] ^= b0 ^ b2 ^ b3;
+    y[2] ^= b0 ^ b1 ^ b3;
+    y[3] ^= b0 ^ b1 ^ b2;
+}
+
+//Transpose up to SWAN_KERNEL_WAYS blocks into lane vectors and back;
+static inline void SWAN256_load(const uint8_t *in, size_t m, SWAN256_lanes L[4], SWAN256_lanes R[4])
+{
+    size_t j;
+    int l;
+    uint32_t w[8];
+
+    memset(L, 0, sizeof(SWAN256_lanes) * 4);
+    memset(R, 0, sizeof(SWAN256_lanes) * 4);
+    for (j = 0; j < m; j++)
+    {
+        memcpy(w, in + j * (BLOCK256 / 8), BLOCK256 / 8);
+        for (l = 0; l < 4; l++)
+        {
+            L[l][j] = w[l];
+            R[l][j] = w[l + 4];
+        }
+    }
+}
+
+static inline void SWAN256_store(uint8_t *out, size_t m, const SWAN256_lanes L[4], const SWAN256_lanes R[4])
+{
+    size_t j;
+    int l;
+    uint32_t w[8];
+
+    for (j = 0; j < m; j++)
+    {
+        for (l = 0; l < 4; l++)
+        {
+            w[l] = L[l][j];
+            w[l + 4] = R[l][j];
+        }
+        memcpy(out + j * (BLOCK256 / 8), w, BLOCK256 / 8);
+    }
+}
+
+void SWAN256_encrypt_blocks(const uint32_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    size_t m;
+    uint16_t i;
+    SWAN256_lanes L[4];
+    SWAN256_lanes R[4];
+
+    while (nblocks > 0)
+    {
+        m = nblocks < SWAN_KERNEL_WAYS ? nblocks : SWAN_KERNEL_WAYS;
+        SWAN256_load(in, m, L, R);
+
+        for (i = 0; i < 2 * rounds; i += 2)
+        {
+            SWAN256_F(L, subkeys + 4 * i, R);
+            SWAN256_F(R, subkeys + 4 * (i + 1), L);
+        }
+
+        SWAN256_store(out, m, L, R);
+        in += m * (BLOCK256 / 8);
+        out += m * (BLOCK256 / 8);
+        nblocks -= m;
+    }
+}
+
+void SWAN256_decrypt_blocks(const uint32_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    size_t m;
+    uint16_t i;
+    SWAN256_lanes L[4];
+    SWAN256_lanes R[4];
+
+    while (nblocks > 0)
+    {
+        m = nblocks < SWAN_KERNEL_WAYS ? nblocks : SWAN_KERNEL_WAYS;
+        SWAN256_load(in, m, L, R);
+
+        //walk the subkeys backwards, undoing the second half round first;
+        for (i = 2 * rounds; i > 0; i -= 2)
+        {
+            SWAN256_F(R, subkeys + 4 * (i - 1), L);
+            SWAN256_F(L, subkeys + 4 * (i - 2), R);
+        }
+
+        SWAN256_store(out, m, L, R);
+        in += m * (BLOCK256 / 8);
+        out += m * (BLOCK256 / 8);
+        nblocks -= m;
+    }
+}
@@ -120,7 +120,7 @@ void SWAN64_K128_encrypt_rounds(const uint8_t *plain, const uint8_t *masterkey,
 
         Beta(tempL, BLOCK64);
 
-        SwitchLanes(tempL);
+        SwitchLanes(tempL, BLOCK64);
 
         R[0] = R[0] ^ tempL[0];
         R[1] = R[1] ^ tempL[1];
@@ -155,7 +155,7 @@ void SWAN64_K128_encrypt_rounds(const uint8_t *plain, const uint8_t *masterkey,
 
         Beta(tempR, BLOCK64);
 
-        SwitchLanes(tempR);
+        SwitchLanes(tempR, BLOCK64);
 
         L[0] = L[0] ^ tempR[0];
         L[1] = L[1] ^ tempR[1];
@@ -250,7 +250,7 @@ void SWAN64_K128_decrypt_rounds(const uint8_t *cipher, const uint8_t *masterkey,
 
         Beta(tempR,BLOCK64);
 
-        SwitchLanes(tempR);
+        SwitchLanes(tempR, BLOCK64);
 
         L[0] = L[0] ^ tempR[0];
         L[1] = L[1] ^ tempR[1];
@@ -289,7 +289,7 @@ void SWAN64_K128_decrypt_rounds(const uint8_t *cipher, const uint8_t *masterkey,
 
         Beta(tempL,BLOCK64);
 
-        SwitchLanes(tempL);
+        SwitchLanes(tempL, BLOCK64);
 
         R[0] = tempL[0] ^ R[0];
         R[1] = tempL[1] ^ R[1];
@@ -553,3 +553,143 @@ void SWAN64_K256_decrypt_rounds(const uint8_t *cipher, const uint8_t *masterkey,
     plain[7] = R[3];
 }
 
+
+//Expand the masterkey into the 2*rounds half round subkeys, the same sequence the on-the-fly schedule produces;
+void SWAN64_key_schedule(const uint8_t *masterkey, const uint16_t keysize, const uint8_t rounds, uint8_t *subkeys)
+{
+    uint16_t i;
+    uint8_t key[KEY256 / 8];
+    uint8_t subkey[4];
+    uint32_t round_constant = 0;
+    memcpy(key, masterkey, keysize / 8);
+
+    for (i = 0; i < 2 * rounds; i++)
+    {
+        RotateKeyByte(key, keysize, ROTATE_64);
+        subkey[0] = key[0];
+        subkey[1] = key[1];
+        subkey[2] = key[2];
+        subkey[3] = key[3];
+        round_constant = round_constant + DELTA_64;
+        AddRoundConstant32(subkey, round_constant);
+        key[0] = subkey[0];
+        key[1] = subkey[1];
+        key[2] = subkey[2];
+        key[3] = subkey[3];
+
+        memcpy(subkeys + 4 * i, subkey, 4);
+    }
+}
+
+//uint8_t lanes of SWAN_KERNEL_WAYS blocks side by side;
+typedef uint8_t SWAN64_lanes __attribute__((vector_size(sizeof(uint8_t) * SWAN_KERNEL_WAYS)));
+
+//One half round on all ways at once: y ^= SwitchLanes(Beta(ShiftLanes(x) ^ k));
+static inline void SWAN64_F(const SWAN64_lanes x[4], const uint8_t k[4], SWAN64_lanes y[4])
+{
+    SWAN64_lanes a0, a1, a2, a3;
+    SWAN64_lanes b0, b1, b2, b3;
+
+    a0 = x[0] ^ k[0];
+    a1 = ROL8(x[1], A_64) ^ k[1];
+    a2 = ROL8(x[2], B_64) ^ k[2];
+    a3 = ROL8(x[3], C_64) ^ k[3];
+
+    b0 = ~(a0 ^ a1 ^ a3 ^ (a2 & a3));
+    b1 = a0 ^ (a0 & a1) ^ a2 ^ (a0 & a3) ^ (a1 & a3) ^ (a0 & a1 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3) ^ (a1 & a2 & a3);
+    b2 = a1 ^ a2 ^ (a0 & a2) ^ a3 ^ (a0 & a1 & a3) ^ (a1 & a2 & a3);
+    b3 = a1 ^ (a0 & a1) ^ (a0 & a2) ^ (a0 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3);
+
+    y[0] ^= b1 ^ b2 ^ b3;
+    y[1] ^= b0 ^ b2 ^ b3;
+    y[2] ^= b0 ^ b1 ^ b3;
+    y[3] ^= b0 ^ b1 ^ b2;
+}
+
+//Transpose up to SWAN_KERNEL_WAYS blocks into lane vectors and back;
+static inline void SWAN64_load(const uint8_t *in, size_t m, SWAN64_lanes L[4], SWAN64_lanes R[4])
+{
+    size_t j;
+    int l;
+    uint8_t w[8];
+
+    memset(L, 0, sizeof(SWAN64_lanes) * 4);
+    memset(R, 0, sizeof(SWAN64_lanes) * 4);
+    for (j = 0; j < m; j++)
+    {
+        memcpy(w, in + j * (BLOCK64 / 8), BLOCK64 / 8);
+        for (l = 0; l < 4; l++)
+        {
+            L[l][j] = w[l];
+            R[l][j] = w[l + 4];
+        }
+    }
+}
+
+static inline void SWAN64_store(uint8_t *out, size_t m, const SWAN64_lanes L[4], const SWAN64_lanes R[4])
+{
+    size_t j;
+    int l;
+    uint8_t w[8];
+
+    for (j = 0; j < m; j++)
+    {
+        for (l = 0; l < 4; l++)
+        {
+            w[l] = L[l][j];
+            w[l + 4] = R[l][j];
+        }
+        memcpy(out + j * (BLOCK64 / 8), w, BLOCK64 / 8);
+    }
+}
+
+void SWAN64_encrypt_blocks(const uint8_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    size_t m;
+    uint16_t i;
+    SWAN64_lanes L[4];
+    SWAN64_lanes R[4];
+
+    while (nblocks > 0)
+    {
+        m = nblocks < SWAN_KERNEL_WAYS ? nblocks : SWAN_KERNEL_WAYS;
+        SWAN64_load(in, m, L, R);
+
+        for (i = 0; i < 2 * rounds; i += 2)
+        {
+            SWAN64_F(L, subkeys + 4 * i, R);
+            SWAN64_F(R, subkeys + 4 * (i + 1), L);
+        }
+
+        SWAN64_store(out, m, L, R);
+        in += m * (BLOCK64 / 8);
+        out += m * (BLOCK64 / 8);
+        nblocks -= m;
+    }
+}
+
+void SWAN64_decrypt_blocks(const uint8_t *subkeys, const uint8_t rounds, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    size_t m;
+    uint16_t i;
+    SWAN64_lanes L[4];
+    SWAN64_lanes R[4];
+
+    while (nblocks > 0)
+    {
+        m = nblocks < SWAN_KERNEL_WAYS ? nblocks : SWAN_KERNEL_WAYS;
+        SWAN64_load(in, m, L, R);
+
+        //walk the subkeys backwards, undoing the second half round first;
+        for (i = 2 * rounds; i > 0; i -= 2)
+        {
+            SWAN64_F(R, subkeys + 4 * (i - 1), L);
+            SWAN64_F(L, subkeys + 4 * (i - 2), R);
+        }
+
+        SWAN64_store(out, m, L, R);
+        in += m * (BLOCK64 / 8);
+        out += m * (BLOCK64 / 8);
+        nblocks -= m;
+    }
+}
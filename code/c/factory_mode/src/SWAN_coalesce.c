@@ -0,0 +1,319 @@
+/*
+ *  SWAN_coalesce.c
+ *
+ *  Description: Coalescing dispatcher in front of the batch kernels. Requests wait in
+ *  one FIFO; the dispatcher takes the oldest, waits until max_blocks blocks with its
+ *  key and direction are queued or that request's deadline passes, and then packs every queued request with the
+ *  same key and direction, oldest first, into one kernel call of at most max_blocks
+ *  blocks. A request larger than max_blocks runs on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <SWAN_coalesce.h>
+#include "SWAN_internal.h"
+
+struct swan_coalescer
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work; //dispatcher: the first request arrived, a batch is full, or stopping
+    pthread_cond_t done; //futures: some request completed
+    pthread_t thread;
+    swan_request *head;
+    swan_request *tail;
+    size_t queued; //blocks in the queue with the head's key and direction, the ones a batch can take
+    unsigned max_blocks;
+    uint64_t deadline_ns;
+    int stopping;
+    swan_coalescer_stats stats;
+    uint64_t batched; //blocks that went through gather()
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void record_delay(swan_coalescer_stats *s, uint64_t delay)
+{
+    unsigned b = 0;
+    uint64_t us = delay / 1000;
+
+    s->delay_ns_total += delay;
+    if (delay > s->delay_ns_max)
+        s->delay_ns_max = delay;
+    while (us > 0 && b < SWAN_COALESCE_DELAY_BUCKETS - 1)
+    {
+        us >>= 1;
+        b++;
+    }
+    s->delay_hist[b]++;
+}
+
+//Unlink the next batch from the queue into batch[]; returns how many requests it holds;
+static unsigned gather(swan_coalescer *c, swan_request **batch, size_t *nblocks)
+{
+    swan_request *r = c->head;
+    swan_request *prev = NULL;
+    const swan_ctx *ctx = r->ctx;
+    int enc = r->enc;
+    unsigned n = 0;
+    uint64_t t = now_ns();
+
+    *nblocks = 0;
+    while (r != NULL && *nblocks < c->max_blocks)
+    {
+        if (r->ctx != ctx || r->enc != enc || (n > 0 && *nblocks + r->nblocks > c->max_blocks))
+        {
+            prev = r;
+            r = r->next;
+            continue;
+        }
+        if (prev == NULL)
+            c->head = r->next;
+        else
+            prev->next = r->next;
+        if (c->tail == r)
+            c->tail = prev;
+        batch[n++] = r;
+        *nblocks += r->nblocks;
+        record_delay(&c->stats, t - r->submit_ns);
+        r = r->next;
+    }
+
+    //the new head may have another key or direction;
+    c->queued = 0;
+    for (r = c->head; r != NULL; r = r->next)
+    {
+        if (r->ctx == c->head->ctx && r->enc == c->head->enc)
+            c->queued += r->nblocks;
+    }
+
+    c->stats.batches++;
+    c->batched += *nblocks;
+    c->stats.fill[*nblocks < c->max_blocks ? *nblocks : c->max_blocks]++;
+    if (*nblocks >= c->max_blocks)
+        c->stats.full_batches++;
+    else
+        c->stats.deadline_batches++;
+    return n;
+}
+
+static void run_batch(swan_request **batch, unsigned n, size_t nblocks)
+{
+    uint8_t buf[SWAN_COALESCE_MAX_BLOCKS * SWAN_MAX_BLOCK_BYTES];
+    const swan_ctx *ctx = batch[0]->ctx;
+    size_t bs = swan_block_bytes(ctx);
+    size_t off = 0;
+    unsigned i;
+
+    swan_probe_batch(n, nblocks);
+    //a lone request needs no staging copy, and may be larger than the buffer;
+    if (n == 1)
+    {
+        if (batch[0]->enc)
+            swan_encrypt_blocks(ctx, batch[0]->in, batch[0]->out, nblocks);
+        else
+            swan_decrypt_blocks(ctx, batch[0]->in, batch[0]->out, nblocks);
+        return;
+    }
+    for (i = 0; i < n; i++)
+    {
+        memcpy(buf + off, batch[i]->in, batch[i]->nblocks * bs);
+        off += batch[i]->nblocks * bs;
+    }
+    if (batch[0]->enc)
+        swan_encrypt_blocks(ctx, buf, buf, nblocks);
+    else
+        swan_decrypt_blocks(ctx, buf, buf, nblocks);
+    for (i = 0, off = 0; i < n; i++)
+    {
+        memcpy(batch[i]->out, buf + off, batch[i]->nblocks * bs);
+        off += batch[i]->nblocks * bs;
+    }
+    memset(buf, 0, off);
+}
+
+static void *dispatcher_main(void *arg)
+{
+    swan_coalescer *c = (swan_coalescer *)arg;
+    swan_request *batch[SWAN_COALESCE_MAX_BLOCKS];
+    swan_request *r;
+    struct timespec ts;
+    uint64_t deadline;
+    size_t nblocks;
+    unsigned n, i, k;
+    int futures;
+
+    pthread_mutex_lock(&c->lock);
+    while (1)
+    {
+        while (c->head == NULL && !c->stopping)
+        {
+            pthread_cond_wait(&c->work, &c->lock);
+        }
+        if (c->head == NULL)
+            break;
+
+        //wait for a full batch, but never past the oldest request's deadline;
+        deadline = c->head->submit_ns + c->deadline_ns;
+        while (!c->stopping && c->queued < c->max_blocks && now_ns() < deadline)
+        {
+            ts.tv_sec = (time_t)(deadline / 1000000000u);
+            ts.tv_nsec = (long)(deadline % 1000000000u);
+            pthread_cond_timedwait(&c->work, &c->lock, &ts);
+        }
+        n = gather(c, batch, &nblocks);
+        pthread_mutex_unlock(&c->lock);
+
+        run_batch(batch, n, nblocks);
+
+        //a completed future may be gone as soon as the lock drops, so only callback
+        //requests stay in batch[]; their callbacks run last and without the lock;
+        pthread_mutex_lock(&c->lock);
+        futures = 0;
+        for (i = 0, k = 0; i < n; i++)
+        {
+            r = batch[i];
+            r->status = 0;
+            if (r->done == NULL)
+            {
+                r->complete = 1;
+                futures = 1;
+            }
+            else
+            {
+                batch[k++] = r;
+            }
+        }
+        if (futures)
+            pthread_cond_broadcast(&c->done);
+        pthread_mutex_unlock(&c->lock);
+        for (i = 0; i < k; i++)
+        {
+            batch[i]->done(batch[i], batch[i]->arg);
+        }
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+swan_coalescer *swan_coalescer_create(const swan_coalescer_config *cfg)
+{
+    swan_coalescer *c = (swan_coalescer *)calloc(1, sizeof(swan_coalescer));
+    pthread_condattr_t attr;
+
+    if (c == NULL)
+        return NULL;
+    c->max_blocks = cfg != NULL && cfg->max_blocks != 0 ? cfg->max_blocks : SWAN_KERNEL_WAYS;
+    if (c->max_blocks > SWAN_COALESCE_MAX_BLOCKS)
+        c->max_blocks = SWAN_COALESCE_MAX_BLOCKS;
+    c->deadline_ns = 1000u * (cfg != NULL && cfg->deadline_us != 0 ? cfg->deadline_us : SWAN_COALESCE_DEADLINE_US);
+
+    pthread_mutex_init(&c->lock, NULL);
+    //deadlines are on the monotonic clock;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&c->work, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&c->done, NULL);
+    if (pthread_create(&c->thread, NULL, dispatcher_main, c) != 0)
+    {
+        pthread_cond_destroy(&c->work);
+        pthread_cond_destroy(&c->done);
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void swan_coalescer_destroy(swan_coalescer *c)
+{
+    if (c == NULL)
+        return;
+    pthread_mutex_lock(&c->lock);
+    c->stopping = 1;
+    pthread_cond_signal(&c->work);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+
+    pthread_cond_destroy(&c->work);
+    pthread_cond_destroy(&c->done);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+int swan_coalesce_submit(swan_coalescer *c, swan_request *req)
+{
+    if (req->ctx == NULL || req->nblocks == 0)
+        return -1;
+    req->next = NULL;
+    req->complete = 0;
+    req->status = -1;
+
+    pthread_mutex_lock(&c->lock);
+    if (c->stopping)
+    {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    req->submit_ns = now_ns();
+    if (c->tail == NULL)
+        c->head = req;
+    else
+        c->tail->next = req;
+    c->tail = req;
+    if (c->head == req)
+        c->queued = req->nblocks;
+    else if (req->ctx == c->head->ctx && req->enc == c->head->enc)
+        c->queued += req->nblocks;
+    c->stats.requests++;
+    c->stats.blocks += req->nblocks;
+    //the dispatcher sleeps untimed only on an empty queue, otherwise it needs waking for a full batch;
+    if (c->head == req || c->queued >= c->max_blocks)
+        pthread_cond_signal(&c->work);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+int swan_coalesce_wait(swan_coalescer *c, swan_request *req)
+{
+    pthread_mutex_lock(&c->lock);
+    while (!req->complete)
+    {
+        pthread_cond_wait(&c->done, &c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return req->status;
+}
+
+int swan_coalesce_crypt(swan_coalescer *c, const swan_ctx *ctx, int enc, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    swan_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.ctx = ctx;
+    req.enc = enc;
+    req.in = in;
+    req.out = out;
+    req.nblocks = nblocks;
+    if (swan_coalesce_submit(c, &req) != 0)
+        return -1;
+    return swan_coalesce_wait(c, &req);
+}
+
+void swan_coalescer_stats_get(swan_coalescer *c, swan_coalescer_stats *stats)
+{
+    pthread_mutex_lock(&c->lock);
+    *stats = c->stats;
+    stats->avg_fill = c->stats.batches > 0 ? (double)c->batched / ((double)c->stats.batches * c->max_blocks) : 0.0;
+    pthread_mutex_unlock(&c->lock);
+}
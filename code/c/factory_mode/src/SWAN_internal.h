@@ -0,0 +1,55 @@
+/*
+ *  SWAN_internal.h
+ *
+ *  Description: Helpers shared between the library sources, not part of the public API.
+ */
+
+#ifndef SWAN_INTERNAL_H_INCLUDED
+#define SWAN_INTERNAL_H_INCLUDED
+#include <stdint.h>
+#include <stddef.h>
+#include "SWAN.h"
+
+//Add n to a block-sized big-endian (CTR counter) or little-endian (XTS unit number) integer;
+void swan_add_be(uint8_t *block, size_t bs, uint64_t n);
+void swan_add_le(uint8_t *block, size_t bs, uint64_t n);
+
+//swan_set_key() and swan_crypt() without the sampler, for the library's own use;
+int swan_expand_key(swan_ctx *ctx, uint16_t blocksize, uint16_t keysize, const uint8_t *masterkey);
+int swan_mode_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+
+//Sampler hooks: begin returns a start time, or 0 if this call is not sampled;
+#ifdef SWAN_HAVE_SAMPLER
+uint64_t swan_sample_begin(void);
+void swan_sample_end(uint64_t start, uint16_t blocksize, uint16_t keysize, int op, int enc);
+#else
+#define swan_sample_begin() ((uint64_t)0)
+#define swan_sample_end(start, blocksize, keysize, op, enc) ((void)(start))
+#endif
+
+//USDT probes in the provider swan, built with SWAN_USDT;
+#ifdef SWAN_HAVE_SDT
+#include <sys/sdt.h>
+#define swan_probe_key(blocksize, keysize) DTRACE_PROBE2(swan, set_key, blocksize, keysize)
+#define swan_probe_crypt(blocksize, mode, enc, len) DTRACE_PROBE4(swan, crypt, blocksize, mode, enc, len)
+#define swan_probe_kernel(blocksize, enc, nblocks) DTRACE_PROBE3(swan, kernel, blocksize, enc, nblocks)
+#define swan_probe_batch(requests, nblocks) DTRACE_PROBE2(swan, coalesce_batch, requests, nblocks)
+#else
+#define swan_probe_key(blocksize, keysize) ((void)0)
+#define swan_probe_crypt(blocksize, mode, enc, len) ((void)0)
+#define swan_probe_kernel(blocksize, enc, nblocks) ((void)0)
+#define swan_probe_batch(requests, nblocks) ((void)0)
+#endif
+
+//Per-thread counters for SWAN_stats.h, built with SWAN_STATS;
+#ifdef SWAN_HAVE_STATS
+void swan_stats_key(void);
+void swan_stats_crypt(int mode);
+void swan_stats_kernel(uint16_t blocksize, int enc, size_t nblocks);
+#else
+#define swan_stats_key() ((void)0)
+#define swan_stats_crypt(mode) ((void)0)
+#define swan_stats_kernel(blocksize, enc, nblocks) ((void)0)
+#endif
+
+#endif
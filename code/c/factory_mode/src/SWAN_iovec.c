@@ -0,0 +1,129 @@
+/*
+ *  SWAN_iovec.c
+ *
+ *  Description: Scatter-gather (readv/writev style) front end for swan_crypt().
+ *  The message is never linearised; only a block straddling a segment boundary
+ *  goes through a one-block bounce buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <SWAN.h>
+
+//Position inside an iovec array;
+typedef struct
+{
+    const struct iovec *iov;
+    int cnt;
+    int idx;
+    size_t off;
+} iov_cursor;
+
+static size_t iov_total(const struct iovec *iov, int cnt)
+{
+    size_t total = 0;
+    int i;
+    for (i = 0; i < cnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+//Bytes left in the current segment, skipping empty segments;
+static size_t cursor_avail(iov_cursor *c)
+{
+    while (c->idx < c->cnt && c->off == c->iov[c->idx].iov_len)
+    {
+        c->idx++;
+        c->off = 0;
+    }
+    if (c->idx == c->cnt)
+        return 0;
+    return c->iov[c->idx].iov_len - c->off;
+}
+
+static uint8_t *cursor_ptr(const iov_cursor *c)
+{
+    return (uint8_t *)c->iov[c->idx].iov_base + c->off;
+}
+
+static void cursor_gather(iov_cursor *c, uint8_t *dst, size_t len)
+{
+    size_t n;
+    while (len > 0)
+    {
+        n = cursor_avail(c);
+        if (n > len)
+            n = len;
+        memcpy(dst, cursor_ptr(c), n);
+        c->off += n;
+        dst += n;
+        len -= n;
+    }
+}
+
+static void cursor_scatter(iov_cursor *c, const uint8_t *src, size_t len)
+{
+    size_t n;
+    while (len > 0)
+    {
+        n = cursor_avail(c);
+        if (n > len)
+            n = len;
+        memcpy(cursor_ptr(c), src, n);
+        c->off += n;
+        src += n;
+        len -= n;
+    }
+}
+
+int swan_crypt_iov(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                   const struct iovec *in, int in_cnt, const struct iovec *out, int out_cnt)
+{
+    size_t bs = swan_block_bytes(ctx);
+    size_t left = iov_total(in, in_cnt);
+    size_t run, in_avail, out_avail;
+    uint8_t bounce[SWAN_MAX_BLOCK_BYTES];
+    iov_cursor ic = {in, in_cnt, 0, 0};
+    iov_cursor oc = {out, out_cnt, 0, 0};
+
+    if (iov_total(out, out_cnt) < left)
+        return -1;
+    if (mode != SWAN_MODE_CTR && left % bs != 0)
+        return -1;
+    //XTS tweaks restart at every call, so a data unit cannot be split across runs;
+    if (mode == SWAN_MODE_XTS)
+        return -1;
+
+    while (left > 0)
+    {
+        in_avail = cursor_avail(&ic);
+        out_avail = cursor_avail(&oc);
+
+        //longest whole-block run both segments can take directly;
+        run = in_avail < out_avail ? in_avail : out_avail;
+        run -= run % bs;
+        if (run > 0)
+        {
+            if (swan_crypt(ctx, mode, enc, iv, cursor_ptr(&ic), cursor_ptr(&oc), run) != 0)
+                return -1;
+            ic.off += run;
+            oc.off += run;
+            left -= run;
+            continue;
+        }
+
+        //the next block straddles a boundary (or is the CTR tail);
+        run = left < bs ? left : bs;
+        cursor_gather(&ic, bounce, run);
+        if (swan_crypt(ctx, mode, enc, iv, bounce, bounce, run) != 0)
+            return -1;
+        cursor_scatter(&oc, bounce, run);
+        left -= run;
+    }
+    memset(bounce, 0, sizeof(bounce));
+    return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ *  SWAN_mode.c
+ *
+ *  Description: Key context with a precomputed key schedule and the ECB/CBC/CTR/XTS
+ *  modes of operation on top of the batch kernels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <SWAN.h>
+#include <SWAN_sampler.h>
+#include "SWAN_internal.h"
+
+static uint64_t key_generation;
+
+int swan_expand_key(swan_ctx *ctx, uint16_t blocksize, uint16_t keysize, const uint8_t *masterkey)
+{
+    uint32_t key[KEY256 / 32];
+
+    //the key schedules read the masterkey in lanes, copy it to an aligned buffer first;
+    memset(key, 0, sizeof(key));
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->blocksize = blocksize;
+    ctx->keysize = keysize;
+    ctx->generation = __atomic_add_fetch(&key_generation, 1, __ATOMIC_RELAXED);
+
+    switch (blocksize)
+    {
+    case BLOCK64:
+        if (keysize == KEY128)
+            ctx->rounds = ROUNDS64_K128;
+        else if (keysize == KEY256)
+            ctx->rounds = ROUNDS64_K256;
+        else
+            return -1;
+        memcpy(key, masterkey, keysize / 8);
+        SWAN64_key_schedule((const uint8_t *)key, keysize, ctx->rounds, (uint8_t *)ctx->subkeys);
+        break;
+
+    case BLOCK128:
+        if (keysize == KEY128)
+            ctx->rounds = ROUNDS128_128;
+        else if (keysize == KEY256)
+            ctx->rounds = ROUNDS128_256;
+        else
+            return -1;
+        memcpy(key, masterkey, keysize / 8);
+        SWAN128_key_schedule((const uint16_t *)key, keysize, ctx->rounds, (uint16_t *)ctx->subkeys);
+        break;
+
+    case BLOCK256:
+        if (keysize != KEY256)
+            return -1;
+        ctx->rounds = ROUNDS256_256;
+        memcpy(key, masterkey, keysize / 8);
+        SWAN256_key_schedule(key, keysize, ctx->rounds, (uint32_t *)ctx->subkeys);
+        break;
+
+    default:
+        return -1;
+    }
+    memset(key, 0, sizeof(key));
+    return 0;
+}
+
+int swan_set_key(swan_ctx *ctx, uint16_t blocksize, uint16_t keysize, const uint8_t *masterkey)
+{
+    uint64_t start = swan_sample_begin();
+    int r;
+
+    swan_probe_key(blocksize, keysize);
+    swan_stats_key();
+    r = swan_expand_key(ctx, blocksize, keysize, masterkey);
+    swan_sample_end(start, blocksize, keysize, SWAN_SAMPLE_SET_KEY, 0);
+    return r;
+}
+
+int swan_set_xts_key(swan_ctx *ctx, uint16_t blocksize, uint16_t keysize, const uint8_t *datakey,
+                     const uint8_t *tweakkey, uint32_t unit)
+{
+    uint64_t start = swan_sample_begin();
+    swan_ctx tweak;
+    int r = -1;
+
+    swan_probe_key(blocksize, keysize);
+    swan_stats_key();
+    if (unit == 0)
+        unit = SWAN_XTS_UNIT;
+    //expanding the tweak key first validates the variant, so blocksize is non-zero below;
+    if (swan_expand_key(&tweak, blocksize, keysize, tweakkey) == 0 && unit % (blocksize / 8) == 0)
+    {
+        swan_expand_key(ctx, blocksize, keysize, datakey);
+        memcpy(ctx->tweak_subkeys, tweak.subkeys, sizeof(tweak.subkeys));
+        ctx->xts_unit = unit;
+        r = 0;
+    }
+    memset(&tweak, 0, sizeof(tweak));
+    swan_sample_end(start, blocksize, keysize, SWAN_SAMPLE_SET_KEY, 0);
+    return r;
+}
+
+static void encrypt_with(const swan_ctx *ctx, const uint32_t subkeys[][SWAN_MAX_BLOCK_BYTES / 8],
+                         const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    swan_probe_kernel(ctx->blocksize, 1, nblocks);
+    swan_stats_kernel(ctx->blocksize, 1, nblocks);
+    switch (ctx->blocksize)
+    {
+    case BLOCK64:
+        SWAN64_encrypt_blocks((const uint8_t *)subkeys, ctx->rounds, in, out, nblocks);
+        break;
+    case BLOCK128:
+        SWAN128_encrypt_blocks((const uint16_t *)subkeys, ctx->rounds, in, out, nblocks);
+        break;
+    case BLOCK256:
+        SWAN256_encrypt_blocks((const uint32_t *)subkeys, ctx->rounds, in, out, nblocks);
+        break;
+    }
+}
+
+void swan_encrypt_blocks(const swan_ctx *ctx, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    encrypt_with(ctx, ctx->subkeys, in, out, nblocks);
+}
+
+void swan_decrypt_blocks(const swan_ctx *ctx, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    swan_probe_kernel(ctx->blocksize, 0, nblocks);
+    swan_stats_kernel(ctx->blocksize, 0, nblocks);
+    switch (ctx->blocksize)
+    {
+    case BLOCK64:
+        SWAN64_decrypt_blocks((const uint8_t *)ctx->subkeys, ctx->rounds, in, out, nblocks);
+        break;
+    case BLOCK128:
+        SWAN128_decrypt_blocks((const uint16_t *)ctx->subkeys, ctx->rounds, in, out, nblocks);
+        break;
+    case BLOCK256:
+        SWAN256_decrypt_blocks((const uint32_t *)ctx->subkeys, ctx->rounds, in, out, nblocks);
+        break;
+    }
+}
+
+static void xor_bytes(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        out[i] = a[i] ^ b[i];
+    }
+}
+
+void swan_add_be(uint8_t *block, size_t bs, uint64_t n)
+{
+    size_t i = bs;
+    uint64_t carry = n;
+    while (i > 0 && carry != 0)
+    {
+        i--;
+        carry += block[i];
+        block[i] = (uint8_t)carry;
+        carry >>= 8;
+    }
+}
+
+void swan_add_le(uint8_t *block, size_t bs, uint64_t n)
+{
+    size_t i;
+    uint64_t carry = n;
+    for (i = 0; i < bs && carry != 0; i++)
+    {
+        carry += block[i];
+        block[i] = (uint8_t)carry;
+        carry >>= 8;
+    }
+}
+
+//Multiply the tweak by x in GF(2^n), little-endian as in IEEE 1619;
+static void xts_double(uint8_t *t, size_t bs)
+{
+    size_t i;
+    uint8_t carry = t[bs - 1] >> 7;
+    for (i = bs - 1; i > 0; i--)
+    {
+        t[i] = (uint8_t)((t[i] << 1) | (t[i - 1] >> 7));
+    }
+    t[0] = (uint8_t)(t[0] << 1);
+    if (!carry)
+        return;
+    switch (bs * 8)
+    {
+    case BLOCK64:
+        //x^64 + x^4 + x^3 + x + 1
+        t[0] ^= 0x1B;
+        break;
+    case BLOCK128:
+        //x^128 + x^7 + x^2 + x + 1
+        t[0] ^= 0x87;
+        break;
+    case BLOCK256:
+        //x^256 + x^10 + x^5 + x^2 + 1
+        t[0] ^= 0x25;
+        t[1] ^= 0x04;
+        break;
+    }
+}
+
+static int cbc_crypt(const swan_ctx *ctx, int enc, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t bs = swan_block_bytes(ctx);
+    size_t nblocks = len / bs;
+    size_t n, i;
+    uint8_t buf[SWAN_BATCH_BLOCKS * SWAN_MAX_BLOCK_BYTES];
+
+    if (enc)
+    {
+        //CBC encryption is a serial chain, one block per kernel call;
+        for (n = 0; n < nblocks; n++)
+        {
+            xor_bytes(buf, in, iv, bs);
+            swan_encrypt_blocks(ctx, buf, out, 1);
+            memcpy(iv, out, bs);
+            in += bs;
+            out += bs;
+        }
+        return 0;
+    }
+
+    while (nblocks > 0)
+    {
+        n = nblocks < SWAN_BATCH_BLOCKS ? nblocks : SWAN_BATCH_BLOCKS;
+        //keep the ciphertext, out may alias in;
+        memcpy(buf, in, n * bs);
+        swan_decrypt_blocks(ctx, buf, out, n);
+        xor_bytes(out, out, iv, bs);
+        for (i = 1; i < n; i++)
+        {
+            xor_bytes(out + i * bs, out + i * bs, buf + (i - 1) * bs, bs);
+        }
+        memcpy(iv, buf + (n - 1) * bs, bs);
+        in += n * bs;
+        out += n * bs;
+        nblocks -= n;
+    }
+    return 0;
+}
+
+static int ctr_crypt(const swan_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t bs = swan_block_bytes(ctx);
+    size_t n, i, chunk;
+    uint8_t ctr[SWAN_BATCH_BLOCKS * SWAN_MAX_BLOCK_BYTES];
+    uint8_t ks[SWAN_BATCH_BLOCKS * SWAN_MAX_BLOCK_BYTES];
+
+    while (len > 0)
+    {
+        n = (len + bs - 1) / bs;
+        if (n > SWAN_BATCH_BLOCKS)
+            n = SWAN_BATCH_BLOCKS;
+        for (i = 0; i < n; i++)
+        {
+            memcpy(ctr + i * bs, iv, bs);
+            swan_add_be(iv, bs, 1);
+        }
+        swan_encrypt_blocks(ctx, ctr, ks, n);
+        chunk = n * bs < len ? n * bs : len;
+        xor_bytes(out, in, ks, chunk);
+        in += chunk;
+        out += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int xts_crypt(const swan_ctx *ctx, int enc, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t bs = swan_block_bytes(ctx);
+    size_t unit, n, i;
+    uint8_t t[SWAN_MAX_BLOCK_BYTES];
+    uint8_t tw[SWAN_BATCH_BLOCKS * SWAN_MAX_BLOCK_BYTES];
+    uint8_t buf[SWAN_BATCH_BLOCKS * SWAN_MAX_BLOCK_BYTES];
+
+    while (len > 0)
+    {
+        unit = len < ctx->xts_unit ? len : ctx->xts_unit;
+        encrypt_with(ctx, ctx->tweak_subkeys, iv, t, 1);
+        swan_add_le(iv, bs, 1);
+        len -= unit;
+
+        while (unit > 0)
+        {
+            n = unit / bs < SWAN_BATCH_BLOCKS ? unit / bs : SWAN_BATCH_BLOCKS;
+            for (i = 0; i < n; i++)
+            {
+                memcpy(tw + i * bs, t, bs);
+                xts_double(t, bs);
+            }
+            xor_bytes(buf, in, tw, n * bs);
+            if (enc)
+                swan_encrypt_blocks(ctx, buf, buf, n);
+            else
+                swan_decrypt_blocks(ctx, buf, buf, n);
+            xor_bytes(out, buf, tw, n * bs);
+            in += n * bs;
+            out += n * bs;
+            unit -= n * bs;
+        }
+    }
+    memset(t, 0, sizeof(t));
+    return 0;
+}
+
+int swan_mode_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t bs = swan_block_bytes(ctx);
+
+    switch (mode)
+    {
+    case SWAN_MODE_ECB:
+        if (len % bs != 0)
+            return -1;
+        if (enc)
+            swan_encrypt_blocks(ctx, in, out, len / bs);
+        else
+            swan_decrypt_blocks(ctx, in, out, len / bs);
+        return 0;
+
+    case SWAN_MODE_CBC:
+        if (len % bs != 0 || iv == NULL)
+            return -1;
+        return cbc_crypt(ctx, enc, iv, in, out, len);
+
+    case SWAN_MODE_CTR:
+        if (iv == NULL)
+            return -1;
+        return ctr_crypt(ctx, iv, in, out, len);
+
+    case SWAN_MODE_XTS:
+        if (len % bs != 0 || iv == NULL || ctx->xts_unit == 0)
+            return -1;
+        return xts_crypt(ctx, enc, iv, in, out, len);
+    }
+    return -1;
+}
+
+int swan_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint64_t start = swan_sample_begin();
+    int r;
+
+    swan_probe_crypt(ctx->blocksize, (int)mode, enc, len);
+    swan_stats_crypt((int)mode);
+    r = swan_mode_crypt(ctx, mode, enc, iv, in, out, len);
+
+    swan_sample_end(start, ctx->blocksize, ctx->keysize, (int)mode, enc);
+    return r;
+}
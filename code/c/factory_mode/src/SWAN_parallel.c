@@ -0,0 +1,1097 @@
+/*
+ *  SWAN_parallel.c
+ *
+ *  Description: Work-stealing worker pool behind swan_parallel_crypt() and
+ *  swan_parallel_batch(). Every call becomes a job covering a byte range; a worker
+ *  that picks up a range larger than the chunk size splits it in half, keeps the
+ *  front half and pushes the back half to the bottom of its own deque. Idle workers
+ *  steal from the top of other deques, where the largest pieces sit.
+ *  Every range derives its own starting counter, tweak or chaining block, so ranges
+ *  are independent and may run in any order.
+ *  With libnuma (SWAN_HAVE_NUMA) the workers are bound to NUMA nodes, a large job is
+ *  cut at chunk boundaries by the node holding the input pages and each piece goes to
+ *  a deque on that node; thieves look on their own node first, and every node reads
+ *  a node-local copy of the key context. The copies are cached across calls, so a
+ *  context used again costs a lookup, not an allocation. Without libnuma all of this
+ *  compiles away.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef SWAN_HAVE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+#include <SWAN_parallel.h>
+#include "SWAN_internal.h"
+
+typedef struct swan_group
+{
+    size_t remaining;
+    int complete;
+    //swan_parallel_submit(): called by the worker that finishes the job, instead of waking a waiter;
+    swan_task_done done;
+    void *arg;
+} swan_group;
+
+typedef struct swan_job
+{
+    swan_task *task;
+    uint8_t iv[SWAN_MAX_BLOCK_BYTES];
+    size_t chunk;
+    size_t remaining;
+    //CBC decryption: the ciphertext block in front of every chunk, saved before out overwrites it;
+    uint8_t *chain;
+    uint8_t last[SWAN_MAX_BLOCK_BYTES];
+    int err;
+    swan_group *group;
+    //node-local copies of task->ctx indexed by node, NULL without NUMA placement;
+    struct swan_replica **replicas;
+    int nodes;
+} swan_job;
+
+typedef struct
+{
+    swan_job *job;
+    size_t off;
+    size_t len;
+} swan_range;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    swan_range *ring;
+    size_t cap;
+    size_t top;
+    size_t bottom;
+    swan_worker_stats stats;
+    uint32_t seed;
+    int node;
+} swan_deque;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_cond_t idle; //swan_pool_stop(): the last caller left
+    pthread_t *workers;
+    swan_deque *deques;
+    unsigned threads;
+    unsigned next_deque;
+    int running;
+    int stopping;
+    size_t pending;
+    size_t chunk;
+    size_t threshold;
+    uint64_t start_ns;
+    int nodes; //size of the node id space when NUMA placement is on, else 0
+    size_t callers; //calls between pool_enter() and pool_leave()
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+          NULL, NULL, 0, 0, 0, 0, 0, SWAN_PARALLEL_CHUNK, SWAN_PARALLEL_THRESHOLD, 0, 0, 0};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+//Node id space to place work over, 0 to leave placement to the scheduler;
+static int numa_setup(int want)
+{
+#ifdef SWAN_HAVE_NUMA
+    if (want < 0 || numa_available() < 0)
+        return 0;
+    if (want == 0 && numa_num_configured_nodes() < 2)
+        return 0;
+    return numa_max_node() + 1;
+#else
+    (void)want;
+    return 0;
+#endif
+}
+
+//Nodes that have CPUs this process may run on, in ascending order; returns how many;
+static int numa_cpu_nodes(int *list, int max)
+{
+    int n = 0;
+#ifdef SWAN_HAVE_NUMA
+    int node;
+    unsigned cpu;
+    struct bitmask *cpus = numa_allocate_cpumask();
+
+    for (node = 0; node <= numa_max_node() && n < max; node++)
+    {
+        if (!numa_bitmask_isbitset(numa_all_nodes_ptr, node) || numa_node_to_cpus(node, cpus) != 0)
+            continue;
+        for (cpu = 0; cpu < cpus->size; cpu++)
+        {
+            if (numa_bitmask_isbitset(cpus, cpu) && numa_bitmask_isbitset(numa_all_cpus_ptr, cpu))
+            {
+                list[n++] = node;
+                break;
+            }
+        }
+    }
+    numa_free_cpumask(cpus);
+#else
+    (void)list;
+    (void)max;
+#endif
+    return n;
+}
+
+//Bind worker to its node, or to the k-th CPU of the node when pinning;
+static void numa_bind_worker(pthread_t thread, int node, unsigned k, int pin)
+{
+#ifdef SWAN_HAVE_NUMA
+    unsigned cpu, count = 0, pick;
+    cpu_set_t set;
+    struct bitmask *cpus = numa_allocate_cpumask();
+
+    CPU_ZERO(&set);
+    if (numa_node_to_cpus(node, cpus) == 0)
+    {
+        for (cpu = 0; cpu < cpus->size && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (numa_bitmask_isbitset(cpus, cpu) && numa_bitmask_isbitset(numa_all_cpus_ptr, cpu))
+                count++;
+        }
+        pick = count > 0 ? k % count : 0;
+        for (cpu = 0; cpu < cpus->size && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (!numa_bitmask_isbitset(cpus, cpu) || !numa_bitmask_isbitset(numa_all_cpus_ptr, cpu))
+                continue;
+            if (!pin || pick == 0)
+                CPU_SET(cpu, &set);
+            if (pin && pick-- == 0)
+                break;
+        }
+    }
+    numa_free_cpumask(cpus);
+    if (CPU_COUNT(&set) > 0)
+        pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+    (void)thread;
+    (void)node;
+    (void)k;
+    (void)pin;
+#endif
+}
+
+//Node of the first input page of every chunk, -1 where unknown (e.g. not faulted in yet);
+static void numa_chunk_nodes(const uint8_t *in, size_t chunk, int *nodes, size_t n)
+{
+    size_t c;
+#ifdef SWAN_HAVE_NUMA
+    uintptr_t mask = ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+    void **pages = (void **)malloc(n * sizeof(void *));
+
+    if (pages != NULL)
+    {
+        for (c = 0; c < n; c++)
+        {
+            pages[c] = (void *)((uintptr_t)(in + c * chunk) & mask);
+        }
+        //with no target nodes move_pages() only reports where each page lives;
+        if (move_pages(0, n, pages, NULL, nodes, 0) == 0)
+        {
+            for (c = 0; c < n; c++)
+            {
+                if (nodes[c] < 0 || nodes[c] >= pool.nodes)
+                    nodes[c] = -1;
+            }
+            free(pages);
+            return;
+        }
+        free(pages);
+    }
+#else
+    (void)in;
+    (void)chunk;
+#endif
+    for (c = 0; c < n; c++)
+    {
+        nodes[c] = -1;
+    }
+}
+
+static swan_ctx *numa_replica(const swan_ctx *ctx, int node)
+{
+#ifdef SWAN_HAVE_NUMA
+    swan_ctx *copy = (swan_ctx *)numa_alloc_onnode(sizeof(swan_ctx), node);
+    if (copy != NULL)
+        memcpy(copy, ctx, sizeof(swan_ctx));
+    return copy;
+#else
+    (void)ctx;
+    (void)node;
+    return NULL;
+#endif
+}
+
+static void numa_replica_free(swan_ctx *copy)
+{
+#ifdef SWAN_HAVE_NUMA
+    if (copy == NULL)
+        return;
+    //the copy holds expanded round keys;
+    memset(copy, 0, sizeof(swan_ctx));
+    numa_free(copy, sizeof(swan_ctx));
+#else
+    (void)copy;
+#endif
+}
+
+//Node-local key schedules kept across jobs, SWAN_REPLICAS per node. An entry is found by
+//context address and generation, so a re-keyed or reallocated context never matches a
+//stale copy, and it is only reused for another context when no job holds it;
+#define SWAN_REPLICAS 8
+
+typedef struct swan_replica
+{
+    const swan_ctx *ctx;
+    uint64_t generation;
+    swan_ctx *copy;
+    unsigned users;
+    uint64_t last;
+} swan_replica;
+
+static pthread_mutex_t replica_lock = PTHREAD_MUTEX_INITIALIZER;
+static swan_replica *replicas; //replica_nodes * SWAN_REPLICAS entries, allocated on first use
+static int replica_nodes;
+static uint64_t replica_clock;
+
+//The copy of ctx on node, made or refreshed if needed; NULL if every entry is busy or out of memory;
+static swan_replica *replica_get(const swan_ctx *ctx, int node)
+{
+    swan_replica *r, *victim = NULL;
+    unsigned i;
+
+    pthread_mutex_lock(&replica_lock);
+    if (replicas == NULL)
+    {
+        replicas = (swan_replica *)calloc((size_t)pool.nodes * SWAN_REPLICAS, sizeof(swan_replica));
+        replica_nodes = replicas != NULL ? pool.nodes : 0;
+    }
+    if (node < 0 || node >= replica_nodes)
+    {
+        pthread_mutex_unlock(&replica_lock);
+        return NULL;
+    }
+    r = &replicas[(size_t)node * SWAN_REPLICAS];
+    for (i = 0; i < SWAN_REPLICAS; i++)
+    {
+        if (r[i].copy != NULL && r[i].ctx == ctx && r[i].generation == ctx->generation)
+        {
+            victim = &r[i];
+            break;
+        }
+        //prefer an empty slot, then the least recently used idle one;
+        if (r[i].users == 0 && (victim == NULL || (victim->copy != NULL && (r[i].copy == NULL || r[i].last < victim->last))))
+            victim = &r[i];
+    }
+    if (victim != NULL && (victim->ctx != ctx || victim->generation != ctx->generation || victim->copy == NULL))
+    {
+        if (victim->copy == NULL)
+            victim->copy = numa_replica(ctx, node);
+        else
+            memcpy(victim->copy, ctx, sizeof(swan_ctx));
+        victim->ctx = ctx;
+        victim->generation = ctx->generation;
+        if (victim->copy == NULL)
+            victim = NULL;
+    }
+    if (victim != NULL)
+    {
+        victim->users++;
+        victim->last = ++replica_clock;
+    }
+    pthread_mutex_unlock(&replica_lock);
+    return victim;
+}
+
+static void replica_put(swan_replica *r)
+{
+    pthread_mutex_lock(&replica_lock);
+    r->users--;
+    pthread_mutex_unlock(&replica_lock);
+}
+
+//Wipe and free every cached copy; the pool is stopped, no job holds one;
+static void replicas_free(void)
+{
+    size_t i;
+
+    pthread_mutex_lock(&replica_lock);
+    for (i = 0; replicas != NULL && i < (size_t)replica_nodes * SWAN_REPLICAS; i++)
+    {
+        numa_replica_free(replicas[i].copy);
+    }
+    free(replicas);
+    replicas = NULL;
+    replica_nodes = 0;
+    pthread_mutex_unlock(&replica_lock);
+}
+
+//Next deque whose worker sits on node, or simply the next deque for node -1;
+static unsigned pick_deque(int node)
+{
+    unsigned i, d;
+    unsigned start = __atomic_fetch_add(&pool.next_deque, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < pool.threads; i++)
+    {
+        d = (start + i) % pool.threads;
+        if (node < 0 || pool.deques[d].node == node)
+            return d;
+    }
+    return start % pool.threads;
+}
+
+//Returns -1, queueing nothing, if the ring is full and cannot grow; the caller then runs r itself;
+static int deque_push(swan_deque *dq, swan_range r)
+{
+    size_t i;
+    swan_range *ring;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom - dq->top == dq->cap)
+    {
+        ring = (swan_range *)malloc(2 * dq->cap * sizeof(swan_range));
+        if (ring == NULL)
+        {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (i = dq->top; i < dq->bottom; i++)
+        {
+            ring[i % (2 * dq->cap)] = dq->ring[i % dq->cap];
+        }
+        free(dq->ring);
+        dq->ring = ring;
+        dq->cap *= 2;
+    }
+    //count it before it becomes visible so pending never dips below the number of queued ranges;
+    __atomic_add_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+    dq->ring[dq->bottom % dq->cap] = r;
+    dq->bottom++;
+    pthread_mutex_unlock(&dq->lock);
+
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_signal(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+//The owner takes the newest range from the bottom;
+static int deque_pop(swan_deque *dq, swan_range *r)
+{
+    int ok = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top)
+    {
+        dq->bottom--;
+        *r = dq->ring[dq->bottom % dq->cap];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    if (ok)
+        __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+    return ok;
+}
+
+//Thieves take the oldest, largest range from the top;
+static int deque_steal(swan_deque *dq, swan_range *r)
+{
+    int ok = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top)
+    {
+        *r = dq->ring[dq->top % dq->cap];
+        dq->top++;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    if (ok)
+        __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+    return ok;
+}
+
+//Try every deque except self, starting at a random victim; deques on the thief's node go first;
+static swan_deque *steal_any(swan_deque *self, uint32_t *seed, swan_range *r)
+{
+    unsigned i, v;
+    int pass;
+    int node = self != NULL ? self->node : -1;
+
+    if (__atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) == 0)
+        return NULL;
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    for (pass = node < 0 ? 1 : 0; pass < 2; pass++)
+    {
+        for (i = 0; i < pool.threads; i++)
+        {
+            v = (*seed + i) % pool.threads;
+            if (&pool.deques[v] == self || (pass == 0 && pool.deques[v].node != node))
+                continue;
+            if (deque_steal(&pool.deques[v], r))
+                return &pool.deques[v];
+        }
+    }
+    return NULL;
+}
+
+static void job_finish(swan_job *job);
+
+static void job_done(swan_job *job)
+{
+    swan_group *group = job->group;
+
+    if (group->done != NULL)
+    {
+        //job and group share one allocation, see swan_parallel_submit();
+        job_finish(job);
+        group->done(job->task, group->arg);
+        free(job);
+        return;
+    }
+    if (__atomic_sub_fetch(&job->group->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&pool.lock);
+        job->group->complete = 1;
+        pthread_cond_broadcast(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+//Run one range, splitting it down to the chunk size first; split halves go to dq;
+static void run_range(swan_deque *dq, swan_range r, swan_worker_stats *stats)
+{
+    swan_job *job = r.job;
+    swan_task *task = job->task;
+    const swan_ctx *ctx = task->ctx;
+    size_t bs = swan_block_bytes(task->ctx);
+    size_t half;
+    uint8_t iv[SWAN_MAX_BLOCK_BYTES];
+    uint64_t t0 = 0;
+
+    while (r.len > job->chunk)
+    {
+        half = ((r.len + job->chunk - 1) / job->chunk / 2) * job->chunk;
+        swan_range back = {job, r.off + half, r.len - half};
+        //out of memory: run the rest unsplit, every range may span several chunks;
+        if (deque_push(dq, back) != 0)
+            break;
+        r.len = half;
+    }
+
+    if (job->replicas != NULL && dq->node >= 0 && job->replicas[dq->node] != NULL)
+        ctx = job->replicas[dq->node]->copy;
+    if (stats != NULL)
+        t0 = now_ns();
+    memcpy(iv, job->iv, bs);
+    switch (task->mode)
+    {
+    case SWAN_MODE_CTR:
+        swan_add_be(iv, bs, r.off / bs);
+        break;
+    case SWAN_MODE_XTS:
+        swan_add_le(iv, bs, r.off / task->ctx->xts_unit);
+        break;
+    case SWAN_MODE_CBC:
+        if (r.off > 0)
+            memcpy(iv, job->chain + (r.off / job->chunk - 1) * bs, bs);
+        break;
+    default:
+        break;
+    }
+    if (swan_crypt(ctx, task->mode, task->enc, iv, task->in + r.off, task->out + r.off, r.len) != 0)
+        __atomic_store_n(&job->err, -1, __ATOMIC_RELAXED);
+    if (stats != NULL)
+    {
+        __atomic_add_fetch(&stats->busy_ns, now_ns() - t0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->tasks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->bytes, r.len, __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_sub_fetch(&job->remaining, r.len, __ATOMIC_ACQ_REL) == 0)
+        job_done(job);
+}
+
+static void *worker_main(void *arg)
+{
+    swan_deque *self = (swan_deque *)arg;
+    swan_range r;
+
+    while (1)
+    {
+        if (deque_pop(self, &r))
+        {
+            run_range(self, r, &self->stats);
+            continue;
+        }
+        if (steal_any(self, &self->seed, &r) != NULL)
+        {
+            __atomic_add_fetch(&self->stats.steals, 1, __ATOMIC_RELAXED);
+            run_range(self, r, &self->stats);
+            continue;
+        }
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.stopping && __atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) == 0)
+        {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        if (pool.stopping && __atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) == 0)
+        {
+            pthread_mutex_unlock(&pool.lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static unsigned online_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+static int pool_start_locked(const swan_pool_config *cfg)
+{
+    unsigned i, started;
+    unsigned ncpu = online_cpus();
+    int ok = 1;
+    unsigned threads = ncpu - 1;
+    int nodes[CPU_SETSIZE];
+    int nnodes = 0;
+    cpu_set_t set;
+
+    //stopping is still set while a failed start joins its threads without the lock;
+    if (pool.running || pool.stopping)
+        return -1;
+    if (cfg != NULL && cfg->threads != 0)
+        threads = cfg->threads;
+    pool.chunk = cfg != NULL && cfg->chunk != 0 ? cfg->chunk : SWAN_PARALLEL_CHUNK;
+    pool.threshold = cfg != NULL && cfg->threshold != 0 ? cfg->threshold : SWAN_PARALLEL_THRESHOLD;
+    pool.nodes = numa_setup(cfg != NULL ? cfg->numa : 0);
+    if (pool.nodes > 0)
+        nnodes = numa_cpu_nodes(nodes, CPU_SETSIZE);
+    if (nnodes == 0)
+        pool.nodes = 0;
+    pool.stopping = 0;
+    pool.threads = 0;
+    pool.pending = 0;
+    pool.workers = (pthread_t *)calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+    pool.deques = (swan_deque *)calloc(threads > 0 ? threads : 1, sizeof(swan_deque));
+    if (pool.workers == NULL || pool.deques == NULL)
+    {
+        free(pool.workers);
+        free(pool.deques);
+        return -1;
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].cap = 64;
+        pool.deques[i].ring = (swan_range *)malloc(pool.deques[i].cap * sizeof(swan_range));
+        if (pool.deques[i].ring == NULL)
+            ok = 0;
+        pool.deques[i].seed = 2463534242u + i;
+        //worker i serves node i modulo the nodes, so every node gets its share;
+        pool.deques[i].node = nnodes > 0 ? nodes[i % nnodes] : -1;
+        pool.deques[i].stats.node = pool.deques[i].node;
+    }
+    pool.start_ns = now_ns();
+
+    //threads count only the workers that started, so stealing never looks at an idle deque of a missing thread;
+    for (i = 0; ok && i < threads; i++)
+    {
+        if (pthread_create(&pool.workers[i], NULL, worker_main, &pool.deques[i]) != 0)
+            break;
+        if (pool.deques[i].node >= 0)
+        {
+            numa_bind_worker(pool.workers[i], pool.deques[i].node, i / nnodes, cfg != NULL && cfg->pin);
+        }
+        else if (cfg != NULL && cfg->pin)
+        {
+            CPU_ZERO(&set);
+            CPU_SET(i % ncpu, &set);
+            pthread_setaffinity_np(pool.workers[i], sizeof(set), &set);
+        }
+        pool.threads++;
+    }
+    if (ok && pool.threads == threads)
+    {
+        pool.running = 1;
+        return 0;
+    }
+
+    //all or nothing: stop the workers that did start; with threads at 0 callers take the direct path meanwhile;
+    started = pool.threads;
+    pool.threads = 0;
+    pool.stopping = 1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(pool.workers[i], NULL);
+    }
+    pthread_mutex_lock(&pool.lock);
+    for (i = 0; i < threads; i++)
+    {
+        free(pool.deques[i].ring);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.workers);
+    free(pool.deques);
+    pool.workers = NULL;
+    pool.deques = NULL;
+    pool.stopping = 0;
+    return -1;
+}
+
+int swan_pool_start(const swan_pool_config *cfg)
+{
+    int ret;
+    pthread_mutex_lock(&pool.lock);
+    ret = pool_start_locked(cfg);
+    pthread_mutex_unlock(&pool.lock);
+    return ret;
+}
+
+void swan_pool_stop(void)
+{
+    unsigned i;
+    unsigned threads;
+
+    pthread_mutex_lock(&pool.lock);
+    if (!pool.running || pool.stopping)
+    {
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+    //no new callers from here on; those inside still use the deques, let them finish;
+    pool.stopping = 1;
+    while (pool.callers > 0)
+    {
+        pthread_cond_wait(&pool.idle, &pool.lock);
+    }
+    threads = pool.threads;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(pool.workers[i], NULL);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    for (i = 0; i < threads; i++)
+    {
+        free(pool.deques[i].ring);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.workers);
+    free(pool.deques);
+    pool.workers = NULL;
+    pool.deques = NULL;
+    pool.threads = 0;
+    pool.running = 0;
+    replicas_free();
+    pool.stopping = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+unsigned swan_pool_threads(void)
+{
+    unsigned n;
+    pthread_mutex_lock(&pool.lock);
+    n = pool.threads;
+    pthread_mutex_unlock(&pool.lock);
+    return n;
+}
+
+unsigned swan_pool_stats(swan_worker_stats *stats, unsigned max)
+{
+    unsigned i, n;
+    uint64_t elapsed;
+    swan_worker_stats *s;
+
+    pthread_mutex_lock(&pool.lock);
+    n = pool.threads < max ? pool.threads : max;
+    elapsed = now_ns() - pool.start_ns;
+    for (i = 0; i < n; i++)
+    {
+        s = &pool.deques[i].stats;
+        stats[i].tasks = __atomic_load_n(&s->tasks, __ATOMIC_RELAXED);
+        stats[i].bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+        stats[i].steals = __atomic_load_n(&s->steals, __ATOMIC_RELAXED);
+        stats[i].busy_ns = __atomic_load_n(&s->busy_ns, __ATOMIC_RELAXED);
+        stats[i].utilisation = elapsed > 0 ? (double)stats[i].busy_ns / (double)elapsed : 0.0;
+        stats[i].node = s->node;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return n;
+}
+
+//Returns -1 if swan_crypt() would reject the task;
+static int task_check(const swan_task *task)
+{
+    size_t bs = swan_block_bytes(task->ctx);
+
+    if ((unsigned)task->mode > SWAN_MODE_XTS)
+        return -1;
+    if ((task->mode != SWAN_MODE_CTR && task->len % bs != 0) || (task->mode != SWAN_MODE_ECB && task->iv == NULL))
+        return -1;
+    if (task->mode == SWAN_MODE_XTS && task->ctx->xts_unit == 0)
+        return -1;
+    return 0;
+}
+
+//Check the task and fill in the job; returns -1 if swan_crypt() would reject it;
+static int job_prepare(swan_job *job, swan_task *task, size_t chunk, swan_group *group)
+{
+    const swan_ctx *ctx = task->ctx;
+    size_t bs = swan_block_bytes(ctx);
+    size_t c, nchunks;
+
+    memset(job, 0, sizeof(*job));
+    job->task = task;
+    job->group = group;
+    job->remaining = task->len;
+    if (task_check(task) != 0)
+        return -1;
+    if (task->iv != NULL)
+        memcpy(job->iv, task->iv, bs);
+
+    chunk -= chunk % bs;
+    if (chunk < bs)
+        chunk = bs;
+    if (task->mode == SWAN_MODE_XTS)
+        chunk = chunk < ctx->xts_unit ? ctx->xts_unit : chunk - chunk % ctx->xts_unit;
+    //CBC encryption is one serial chain and cannot be split;
+    if (task->mode == SWAN_MODE_CBC && task->enc)
+        chunk = task->len > 0 ? task->len : bs;
+    job->chunk = chunk;
+
+    if (task->mode == SWAN_MODE_CBC && task->len > 0)
+    {
+        nchunks = (task->len + chunk - 1) / chunk;
+        if (!task->enc && nchunks > 1)
+        {
+            job->chain = (uint8_t *)malloc((nchunks - 1) * bs);
+            if (job->chain == NULL)
+                return -1;
+            for (c = 1; c < nchunks; c++)
+            {
+                memcpy(job->chain + (c - 1) * bs, task->in + c * chunk - bs, bs);
+            }
+        }
+        memcpy(job->last, task->in + task->len - bs, bs);
+    }
+    return 0;
+}
+
+//Advance iv past len bytes the way a single swan_crypt() call would;
+static void job_finish(swan_job *job)
+{
+    swan_task *task = job->task;
+    size_t bs = swan_block_bytes(task->ctx);
+    int node;
+
+    free(job->chain);
+    if (job->replicas != NULL)
+    {
+        for (node = 0; node < job->nodes; node++)
+        {
+            if (job->replicas[node] != NULL)
+                replica_put(job->replicas[node]);
+        }
+        free(job->replicas);
+    }
+    task->status = job->err;
+    if (job->err != 0 || task->iv == NULL || task->len == 0)
+        return;
+    switch (task->mode)
+    {
+    case SWAN_MODE_CTR:
+        swan_add_be(task->iv, bs, (task->len + bs - 1) / bs);
+        break;
+    case SWAN_MODE_XTS:
+        swan_add_le(task->iv, bs, (task->len + task->ctx->xts_unit - 1) / task->ctx->xts_unit);
+        break;
+    case SWAN_MODE_CBC:
+        if (task->enc)
+            memcpy(task->iv, task->out + task->len - bs, bs);
+        else
+            memcpy(task->iv, job->last, bs);
+        break;
+    default:
+        break;
+    }
+}
+
+//Cut a multi-chunk job into runs of chunks whose input lives on one node, look up the
+//key context's copy on every node with workers and queue each run on its node;
+static int numa_place_job(swan_job *job)
+{
+    //workers drain job->remaining as soon as the first run is queued, read the length from the task;
+    size_t len = job->task->len;
+    size_t nchunks = (len + job->chunk - 1) / job->chunk;
+    size_t c, first;
+    unsigned i;
+    int *where;
+    swan_deque *dq;
+
+    if (pool.nodes == 0 || nchunks < 2)
+        return 0;
+    where = (int *)malloc(nchunks * sizeof(int));
+    job->replicas = (swan_replica **)calloc(pool.nodes, sizeof(swan_replica *));
+    if (where == NULL || job->replicas == NULL)
+    {
+        free(where);
+        free(job->replicas);
+        job->replicas = NULL;
+        return 0;
+    }
+    job->nodes = pool.nodes;
+    for (i = 0; i < pool.threads; i++)
+    {
+        if (job->replicas[pool.deques[i].node] == NULL)
+            job->replicas[pool.deques[i].node] = replica_get(job->task->ctx, pool.deques[i].node);
+    }
+
+    numa_chunk_nodes(job->task->in, job->chunk, where, nchunks);
+    for (first = 0, c = 1; c <= nchunks; c++)
+    {
+        if (c < nchunks && where[c] == where[first])
+            continue;
+        swan_range run = {job, first * job->chunk, 0};
+        run.len = (c < nchunks ? c * job->chunk : len) - run.off;
+        dq = &pool.deques[pick_deque(where[first])];
+        if (deque_push(dq, run) != 0)
+            run_range(dq, run, NULL);
+        first = c;
+    }
+    free(where);
+    return 1;
+}
+
+//Spread the jobs over the deques;
+static void queue_jobs(swan_job *jobs, size_t n)
+{
+    size_t i;
+    swan_deque *dq;
+
+    for (i = 0; i < n; i++)
+    {
+        //an empty submitted job still goes through a worker, done must not run on the caller;
+        if (jobs[i].remaining == 0 && jobs[i].group->done == NULL)
+        {
+            job_done(&jobs[i]);
+            continue;
+        }
+        if (numa_place_job(&jobs[i]))
+            continue;
+        swan_range root = {&jobs[i], 0, jobs[i].remaining};
+        dq = &pool.deques[pick_deque(-1)];
+        if (deque_push(dq, root) != 0)
+            run_range(dq, root, NULL);
+    }
+}
+
+//Queue the jobs, help with stealing, and wait for all of them;
+static void run_jobs(swan_job *jobs, size_t n, swan_group *group)
+{
+    uint32_t seed = 2654435761u;
+    swan_range r;
+    swan_deque *victim;
+
+    queue_jobs(jobs, n);
+
+    pthread_mutex_lock(&pool.lock);
+    while (!group->complete)
+    {
+        pthread_mutex_unlock(&pool.lock);
+        victim = steal_any(NULL, &seed, &r);
+        if (victim != NULL)
+        {
+            run_range(victim, r, NULL);
+            pthread_mutex_lock(&pool.lock);
+            continue;
+        }
+        pthread_mutex_lock(&pool.lock);
+        if (!group->complete && __atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) == 0)
+            pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * Start the pool on first use and count the caller in, so that swan_pool_stop() keeps
+ * the deques until it leaves. Returns 0, counting nothing, if the call has to run
+ * without the pool: no worker threads, or the pool is stopping.
+ */
+static int pool_enter(size_t *chunk, size_t *threshold)
+{
+    int ok;
+
+    pthread_mutex_lock(&pool.lock);
+    if (!pool.running && !pool.stopping)
+        pool_start_locked(NULL);
+    ok = pool.running && !pool.stopping && pool.threads > 0;
+    if (ok)
+        pool.callers++;
+    *chunk = pool.chunk;
+    *threshold = pool.threshold;
+    pthread_mutex_unlock(&pool.lock);
+    return ok;
+}
+
+static void pool_leave(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.callers == 0)
+        pthread_cond_broadcast(&pool.idle);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+int swan_parallel_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                        const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t chunk, threshold;
+    swan_task task = {ctx, mode, enc, iv, in, out, len, 0};
+    swan_group group = {1, 0, NULL, NULL};
+    swan_job job;
+
+    if (!pool_enter(&chunk, &threshold))
+        return swan_crypt(ctx, mode, enc, iv, in, out, len);
+    if (len < threshold || (mode == SWAN_MODE_CBC && enc))
+    {
+        pool_leave();
+        return swan_crypt(ctx, mode, enc, iv, in, out, len);
+    }
+
+    if (job_prepare(&job, &task, chunk, &group) != 0)
+    {
+        free(job.chain);
+        pool_leave();
+        return -1;
+    }
+    run_jobs(&job, 1, &group);
+    //job_finish() hands back the node-local key copies, which swan_pool_stop() frees;
+    job_finish(&job);
+    pool_leave();
+    return task.status;
+}
+
+int swan_parallel_batch(swan_task *tasks, size_t n)
+{
+    size_t i;
+    size_t k = 0;
+    size_t chunk, threshold;
+    int ret = 0;
+    swan_group group = {0, 0, NULL, NULL};
+    swan_job *jobs;
+
+    if (!pool_enter(&chunk, &threshold))
+    {
+        for (i = 0; i < n; i++)
+        {
+            tasks[i].status = swan_crypt(tasks[i].ctx, tasks[i].mode, tasks[i].enc, tasks[i].iv,
+                                         tasks[i].in, tasks[i].out, tasks[i].len);
+            ret |= tasks[i].status;
+        }
+        return ret;
+    }
+
+    jobs = (swan_job *)malloc(n * sizeof(swan_job));
+    if (jobs == NULL)
+    {
+        pool_leave();
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (job_prepare(&jobs[i], &tasks[i], chunk, &group) != 0)
+        {
+            tasks[i].status = -1;
+            ret = -1;
+            //keep the job out of the group, it never runs;
+            jobs[i].task = NULL;
+            continue;
+        }
+        group.remaining++;
+    }
+
+    //pack the valid jobs to the front;
+    for (i = 0; i < n; i++)
+    {
+        if (jobs[i].task != NULL)
+            jobs[k++] = jobs[i];
+    }
+    if (k > 0)
+        run_jobs(jobs, k, &group);
+    for (i = 0; i < k; i++)
+    {
+        job_finish(&jobs[i]);
+        ret |= jobs[i].task->status;
+    }
+    free(jobs);
+    pool_leave();
+    return ret;
+}
+
+int swan_parallel_submit(swan_task *task, swan_task_done done, void *arg)
+{
+    size_t chunk, threshold;
+    struct
+    {
+        swan_job job;
+        swan_group group;
+    } *async;
+
+    if (done == NULL || task_check(task) != 0)
+        return -1;
+    if (!pool_enter(&chunk, &threshold))
+    {
+        task->status = swan_crypt(task->ctx, task->mode, task->enc, task->iv, task->in, task->out, task->len);
+        done(task, arg);
+        return 0;
+    }
+
+    //the job comes first, so job_done() frees the whole block through the job pointer;
+    async = malloc(sizeof(*async));
+    if (async == NULL)
+    {
+        pool_leave();
+        return -1;
+    }
+    async->group.remaining = 1;
+    async->group.complete = 0;
+    async->group.done = done;
+    async->group.arg = arg;
+    if (job_prepare(&async->job, task, chunk, &async->group) != 0)
+    {
+        free(async->job.chain);
+        free(async);
+        pool_leave();
+        return -1;
+    }
+    //the workers drain the queue before they exit, only the queueing needs the deques;
+    queue_jobs(&async->job, 1);
+    pool_leave();
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ *  SWAN_sampler.c
+ *
+ *  Description: HDR-style latency histograms and the call sampler; see SWAN_sampler.h.
+ *  The sampler's histograms are allocated by the first swan_sampler_start() and never
+ *  freed, so a thread still inside a sampled call when the sampler stops records into
+ *  valid memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <SWAN_sampler.h>
+#include "SWAN_internal.h"
+
+#define HALF (1u << (SWAN_HIST_SUB_BITS - 1))
+
+static unsigned hist_index(uint64_t v)
+{
+    unsigned e;
+
+    if (v < 2 * HALF)
+        return (unsigned)v;
+    //v is m << e with m in [HALF, 2*HALF);
+    e = (unsigned)(63 - __builtin_clzll(v)) - (SWAN_HIST_SUB_BITS - 1);
+    return e * HALF + (unsigned)(v >> e);
+}
+
+//Largest value that lands in bucket i;
+static uint64_t hist_top(unsigned i)
+{
+    unsigned e;
+
+    if (i < 2 * HALF)
+        return i;
+    e = i / HALF - 1;
+    return (((uint64_t)(i - e * HALF) + 1) << e) - 1;
+}
+
+void swan_hist_reset(swan_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void swan_hist_record(swan_hist *h, uint64_t v)
+{
+    uint64_t m;
+
+    if (v > SWAN_HIST_MAX)
+        v = SWAN_HIST_MAX;
+    __atomic_fetch_add(&h->bucket[hist_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > m && !__atomic_compare_exchange_n(&h->max, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    m = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (v < m && !__atomic_compare_exchange_n(&h->min, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void swan_hist_merge(swan_hist *dst, const swan_hist *src)
+{
+    unsigned i;
+
+    for (i = 0; i < SWAN_HIST_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+}
+
+uint64_t swan_hist_percentile(const swan_hist *h, double p)
+{
+    uint64_t rank, seen = 0;
+    unsigned i;
+
+    if (h->count == 0)
+        return 0;
+    rank = (uint64_t)ceil(p / 100 * (double)h->count);
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < SWAN_HIST_BUCKETS; i++)
+    {
+        seen += h->bucket[i];
+        if (seen >= rank)
+            return hist_top(i) < h->max ? hist_top(i) : h->max;
+    }
+    return h->max;
+}
+
+#ifndef SWAN_HAVE_SAMPLER
+
+int swan_sampler_start(unsigned period)
+{
+    (void)period;
+    errno = ENOSYS;
+    return -1;
+}
+
+void swan_sampler_stop(void)
+{
+}
+
+int swan_sampler_read(uint16_t blocksize, uint16_t keysize, int op, int enc, swan_hist *h)
+{
+    (void)blocksize;
+    (void)keysize;
+    (void)op;
+    (void)enc;
+    (void)h;
+    return -1;
+}
+
+#else
+
+//per variant: the four modes in both directions, then key setup;
+#define OPS (2 * SWAN_SAMPLE_SET_KEY + 1)
+#define VARIANTS 5
+
+static swan_hist *samples; //[VARIANTS][OPS]
+static unsigned sampler_period;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static swan_hist *sample_of(uint16_t blocksize, uint16_t keysize, int op, int enc)
+{
+    int v;
+
+    if (blocksize == BLOCK64 && (keysize == KEY128 || keysize == KEY256))
+        v = keysize == KEY128 ? 0 : 1;
+    else if (blocksize == BLOCK128 && (keysize == KEY128 || keysize == KEY256))
+        v = keysize == KEY128 ? 2 : 3;
+    else if (blocksize == BLOCK256 && keysize == KEY256)
+        v = 4;
+    else
+        v = -1;
+    if (v < 0 || op < 0 || op > SWAN_SAMPLE_SET_KEY || samples == NULL)
+        return NULL;
+    return &samples[v * OPS + (op == SWAN_SAMPLE_SET_KEY ? 2 * op : 2 * op + (enc != 0))];
+}
+
+int swan_sampler_start(unsigned period)
+{
+    unsigned i;
+
+    if (period == 0)
+        period = 1;
+    if (samples == NULL)
+    {
+        samples = (swan_hist *)malloc(VARIANTS * OPS * sizeof(swan_hist));
+        if (samples == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    for (i = 0; i < VARIANTS * OPS; i++)
+        swan_hist_reset(&samples[i]);
+    __atomic_store_n(&sampler_period, period, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void swan_sampler_stop(void)
+{
+    __atomic_store_n(&sampler_period, 0, __ATOMIC_RELEASE);
+}
+
+int swan_sampler_read(uint16_t blocksize, uint16_t keysize, int op, int enc, swan_hist *h)
+{
+    swan_hist *s = sample_of(blocksize, keysize, op, enc);
+    unsigned i;
+
+    if (s == NULL)
+        return -1;
+    //a consistent enough copy while other threads keep recording;
+    for (i = 0; i < SWAN_HIST_BUCKETS; i++)
+        h->bucket[i] = __atomic_load_n(&s->bucket[i], __ATOMIC_RELAXED);
+    h->count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    h->sum = __atomic_load_n(&s->sum, __ATOMIC_RELAXED);
+    h->min = __atomic_load_n(&s->min, __ATOMIC_RELAXED);
+    h->max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+    return 0;
+}
+
+uint64_t swan_sample_begin(void)
+{
+    static __thread unsigned tick;
+    unsigned period = __atomic_load_n(&sampler_period, __ATOMIC_ACQUIRE);
+
+    if (period == 0 || ++tick < period)
+        return 0;
+    tick = 0;
+    return now_ns();
+}
+
+void swan_sample_end(uint64_t start, uint16_t blocksize, uint16_t keysize, int op, int enc)
+{
+    swan_hist *s;
+
+    if (start == 0 || (s = sample_of(blocksize, keysize, op, enc)) == NULL)
+        return;
+    swan_hist_record(s, now_ns() - start);
+}
+
+#endif
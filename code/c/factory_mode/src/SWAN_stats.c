@@ -0,0 +1,142 @@
+/*
+ *  SWAN_stats.c
+ *
+ *  Description: Per-thread hot path counters; see SWAN_stats.h. A thread's block is
+ *  allocated on its first count, in whole cache lines of its own, and linked into a
+ *  list that is never shortened, so the counts of exited threads stay in the totals.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <SWAN_stats.h>
+#include "SWAN_internal.h"
+
+#ifndef SWAN_HAVE_STATS
+
+int swan_stats_thread(swan_stats *s)
+{
+    (void)s;
+    errno = ENOSYS;
+    return -1;
+}
+
+int swan_stats_total(swan_stats *s)
+{
+    (void)s;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else
+
+#include <pthread.h>
+
+typedef struct stats_block
+{
+    swan_stats s;
+    struct stats_block *next;
+} stats_block;
+
+#define STATS_LINE 64
+#define STATS_BLOCK_SIZE ((sizeof(stats_block) + STATS_LINE - 1) / STATS_LINE * STATS_LINE)
+
+static __thread stats_block *mine;
+static stats_block *blocks;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static swan_stats *self(void)
+{
+    stats_block *b = mine;
+
+    if (b == NULL)
+    {
+        //aligned and padded, so no other thread's counters share its cache lines;
+        b = (stats_block *)aligned_alloc(STATS_LINE, STATS_BLOCK_SIZE);
+        if (b == NULL)
+            return NULL;
+        memset(b, 0, STATS_BLOCK_SIZE);
+        pthread_mutex_lock(&blocks_lock);
+        b->next = blocks;
+        blocks = b;
+        pthread_mutex_unlock(&blocks_lock);
+        mine = b;
+    }
+    return &b->s;
+}
+
+//Only the owner writes a counter, so a load and a store suffice; they are atomic for the readers;
+static void bump(uint64_t *c, uint64_t n)
+{
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void swan_stats_key(void)
+{
+    swan_stats *s = self();
+
+    if (s != NULL)
+        bump(&s->key_setups, 1);
+}
+
+void swan_stats_crypt(int mode)
+{
+    swan_stats *s = self();
+
+    if (s != NULL && mode >= 0 && mode < 4)
+        bump(&s->crypt_calls[mode], 1);
+}
+
+void swan_stats_kernel(uint16_t blocksize, int enc, size_t nblocks)
+{
+    swan_stats *s = self();
+    int w = blocksize == BLOCK64 ? 0 : blocksize == BLOCK128 ? 1 : 2;
+    unsigned k = nblocks > 0 ? 63 - __builtin_clzll((unsigned long long)nblocks) : 0;
+
+    if (s == NULL || nblocks == 0)
+        return;
+    bump(&s->kernel_calls[w][enc != 0], 1);
+    bump(&s->blocks[w][enc != 0], nblocks);
+    if (nblocks % SWAN_KERNEL_WAYS != 0)
+        bump(&s->partial, 1);
+    bump(&s->batch_size[k < SWAN_STATS_SIZES ? k : SWAN_STATS_SIZES - 1], 1);
+}
+
+static void add(swan_stats *dst, const swan_stats *src)
+{
+    const uint64_t *from = (const uint64_t *)src;
+    uint64_t *to = (uint64_t *)dst;
+    size_t i;
+
+    //swan_stats is nothing but uint64_t counters;
+    for (i = 0; i < sizeof(swan_stats) / sizeof(uint64_t); i++)
+        to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+int swan_stats_thread(swan_stats *s)
+{
+    swan_stats *own = self();
+
+    if (own == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    add(s, own);
+    return 0;
+}
+
+int swan_stats_total(swan_stats *s)
+{
+    const stats_block *b;
+
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_lock(&blocks_lock);
+    for (b = blocks; b != NULL; b = b->next)
+        add(s, &b->s);
+    pthread_mutex_unlock(&blocks_lock);
+    return 0;
+}
+
+#endif
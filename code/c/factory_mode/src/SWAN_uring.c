@@ -0,0 +1,560 @@
+/*
+ *  SWAN_uring.c
+ *
+ *  Description: io_uring read -> encrypt -> write pipeline over raw system calls, so
+ *  liburing is not needed. Every buffer cycles through READING, CRYPT and WRITING:
+ *  the calling thread submits reads and reaps completions, a finished read is handed
+ *  to the worker pool with swan_parallel_submit(), and the worker that finishes the
+ *  encryption queues the write itself. A finished write reuses the buffer for the next
+ *  read, so up to depth buffers are in flight in some stage at any time.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <SWAN_uring.h>
+
+#ifndef SWAN_HAVE_IO_URING
+
+int swan_uring_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                     int in_fd, int out_fd, uint64_t len, const swan_uring_config *cfg)
+{
+    (void)ctx;
+    (void)mode;
+    (void)enc;
+    (void)iv;
+    (void)in_fd;
+    (void)out_fd;
+    (void)len;
+    (void)cfg;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <SWAN_parallel.h>
+#include "SWAN_internal.h"
+
+//room in front of the data for the CBC chaining block; a page keeps the data aligned for O_DIRECT;
+#define URING_HEAD 4096
+
+enum
+{
+    BUF_IDLE,
+    BUF_READING,
+    BUF_CRYPT,
+    BUF_WRITING,
+    BUF_FAILED
+};
+
+typedef struct
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+} swan_ring;
+
+struct swan_pipe;
+
+typedef struct
+{
+    uint8_t *base;
+    uint8_t *data;
+    uint64_t off; //file offset of data
+    size_t len;   //bytes of data
+    size_t head;  //bytes read in front of data, the CBC chaining block
+    size_t done;  //bytes of the current read or write already transferred
+    int state;
+    unsigned index;
+    uint8_t iv[SWAN_MAX_BLOCK_BYTES];
+    swan_task task;
+    struct swan_pipe *pipe;
+} swan_uring_buf;
+
+typedef struct swan_pipe
+{
+    swan_ring ring;
+    //serialises the submission queue between the reaping thread and the workers;
+    pthread_mutex_t lock;
+    //signalled when the last buffer leaves BUF_CRYPT after the reaper gave up;
+    pthread_cond_t idle;
+    swan_uring_buf *bufs;
+    unsigned depth;
+    unsigned busy;
+    unsigned crypting;
+    //set when the reaper gave up: workers then leave the ring alone;
+    int closed;
+    int fixed;
+    int err;
+    const swan_ctx *ctx;
+    swan_mode mode;
+    int enc;
+    const uint8_t *iv;
+    uint8_t last[SWAN_MAX_BLOCK_BYTES];
+    int in_fd;
+    int out_fd;
+    uint64_t len;
+    uint64_t next;
+    size_t chunk;
+} swan_pipe;
+
+static int ring_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int ring_setup(swan_ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED)
+        goto fail;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    r->sq_head = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((uint8_t *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((uint8_t *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((uint8_t *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((uint8_t *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+fail:
+    if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    close(r->fd);
+    return -1;
+}
+
+static void ring_close(swan_ring *r)
+{
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+//Fill the next SQE for b and submit everything queued; pipe->lock must be held;
+static int ring_submit(swan_pipe *p, swan_uring_buf *b, uint8_t opcode, int fd, uint8_t *addr, size_t len, uint64_t off)
+{
+    swan_ring *r = &p->ring;
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    int ret;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = (uint32_t)len;
+    sqe->off = off;
+    if (opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED)
+        sqe->buf_index = (uint16_t)b->index;
+    sqe->user_data = b->index;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    //submit whatever the kernel has not consumed yet, an earlier enter may have been short;
+    do
+    {
+        ret = ring_enter(r->fd, tail + 1 - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE), 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -1 : 0;
+}
+
+static int submit_read(swan_pipe *p, swan_uring_buf *b)
+{
+    uint8_t op = p->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    return ring_submit(p, b, op, p->in_fd, b->data - b->head + b->done, b->head + b->len - b->done,
+                       b->off - b->head + b->done);
+}
+
+static int submit_write(swan_pipe *p, swan_uring_buf *b)
+{
+    uint8_t op = p->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    return ring_submit(p, b, op, p->out_fd, b->data + b->done, b->len - b->done, b->off + b->done);
+}
+
+static void buf_idle(swan_pipe *p, swan_uring_buf *b)
+{
+    b->state = BUF_IDLE;
+    p->busy--;
+}
+
+//Give b the next piece of the input, or retire it; pipe->lock must be held;
+static void start_read(swan_pipe *p, swan_uring_buf *b)
+{
+    size_t bs = swan_block_bytes(p->ctx);
+
+    if (p->err || p->next >= p->len)
+    {
+        buf_idle(p, b);
+        return;
+    }
+    b->off = p->next;
+    b->len = p->len - p->next < p->chunk ? (size_t)(p->len - p->next) : p->chunk;
+    b->head = p->mode == SWAN_MODE_CBC && b->off > 0 ? bs : 0;
+    b->done = 0;
+    b->state = BUF_READING;
+    p->next += b->len;
+    if (submit_read(p, b) != 0)
+    {
+        p->err = errno;
+        buf_idle(p, b);
+    }
+}
+
+//Worker side: queue the write, or a NOP carrying the failure so the reaper wakes up;
+static void crypt_done(swan_task *task, void *arg)
+{
+    swan_uring_buf *b = (swan_uring_buf *)arg;
+    swan_pipe *p = b->pipe;
+    int ret;
+
+    pthread_mutex_lock(&p->lock);
+    p->crypting--;
+    if (p->closed)
+    {
+        buf_idle(p, b);
+        if (p->crypting == 0)
+            pthread_cond_signal(&p->idle);
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+    b->done = 0;
+    if (task->status == 0)
+    {
+        b->state = BUF_WRITING;
+        ret = submit_write(p, b);
+    }
+    else
+    {
+        b->state = BUF_FAILED;
+        ret = ring_submit(p, b, IORING_OP_NOP, -1, NULL, 0, 0);
+    }
+    if (ret != 0)
+    {
+        p->err = errno;
+        buf_idle(p, b);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+//Reaper side: the read of b has finished, derive its iv and hand it to the pool; pipe->lock
+//is dropped around the submission since the task may complete, and lock it, right away;
+static void start_crypt(swan_pipe *p, swan_uring_buf *b)
+{
+    const swan_ctx *ctx = p->ctx;
+    size_t bs = swan_block_bytes(ctx);
+
+    if (p->iv != NULL)
+        memcpy(b->iv, p->iv, bs);
+    switch (p->mode)
+    {
+    case SWAN_MODE_CTR:
+        swan_add_be(b->iv, bs, b->off / bs);
+        break;
+    case SWAN_MODE_XTS:
+        swan_add_le(b->iv, bs, b->off / ctx->xts_unit);
+        break;
+    case SWAN_MODE_CBC:
+        if (b->head > 0)
+            memcpy(b->iv, b->data - bs, bs);
+        if (b->off + b->len == p->len)
+            memcpy(p->last, b->data + b->len - bs, bs);
+        break;
+    default:
+        break;
+    }
+    b->state = BUF_CRYPT;
+    p->crypting++;
+    b->task.ctx = ctx;
+    b->task.mode = p->mode;
+    b->task.enc = p->enc;
+    b->task.iv = b->iv;
+    b->task.in = b->data;
+    b->task.out = b->data;
+    b->task.len = b->len;
+    b->task.status = 0;
+    pthread_mutex_unlock(&p->lock);
+    if (swan_parallel_submit(&b->task, crypt_done, b) != 0)
+    {
+        pthread_mutex_lock(&p->lock);
+        p->err = EINVAL;
+        p->crypting--;
+        buf_idle(p, b);
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+}
+
+//Handle one completion; pipe->lock must be held;
+static void complete(swan_pipe *p, swan_uring_buf *b, int res)
+{
+    size_t want;
+
+    if (b->state == BUF_FAILED)
+    {
+        p->err = EIO;
+        buf_idle(p, b);
+        return;
+    }
+    want = b->state == BUF_READING ? b->head + b->len : b->len;
+    if (res == -EINTR || res == -EAGAIN)
+        res = 0;
+    else if (res < 0 || (res == 0 && b->state == BUF_READING))
+    {
+        //a read of 0 bytes means the file is shorter than len;
+        p->err = res < 0 ? -res : EIO;
+        buf_idle(p, b);
+        return;
+    }
+    b->done += (size_t)res;
+    if (b->done < want)
+    {
+        if ((b->state == BUF_READING ? submit_read(p, b) : submit_write(p, b)) != 0)
+        {
+            p->err = errno;
+            buf_idle(p, b);
+        }
+        return;
+    }
+    if (b->state == BUF_READING)
+        start_crypt(p, b);
+    else
+        start_read(p, b);
+}
+
+static int pipe_run(swan_pipe *p)
+{
+    swan_ring *r = &p->ring;
+    struct io_uring_cqe *cqe;
+    unsigned head, i;
+    uint64_t index;
+    int res;
+
+    pthread_mutex_lock(&p->lock);
+    p->busy = p->depth;
+    for (i = 0; i < p->depth; i++)
+    {
+        start_read(p, &p->bufs[i]);
+    }
+    while (p->busy > 0)
+    {
+        pthread_mutex_unlock(&p->lock);
+        head = *r->cq_head;
+        while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if (ring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN &&
+                errno != EBUSY)
+            {
+                pthread_mutex_lock(&p->lock);
+                p->err = errno;
+                pthread_mutex_unlock(&p->lock);
+                return -1;
+            }
+        }
+        pthread_mutex_lock(&p->lock);
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            cqe = &r->cqes[head & *r->cq_mask];
+            index = cqe->user_data;
+            res = cqe->res;
+            head++;
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+            complete(p, &p->bufs[index], res);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return p->err != 0 ? -1 : 0;
+}
+
+static void pipe_free(swan_pipe *p)
+{
+    unsigned i;
+
+    ring_close(&p->ring);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->idle);
+    if (p->bufs != NULL)
+    {
+        for (i = 0; i < p->depth; i++)
+        {
+            free(p->bufs[i].base);
+        }
+    }
+    free(p->bufs);
+    free(p);
+}
+
+int swan_uring_crypt(const swan_ctx *ctx, swan_mode mode, int enc, uint8_t *iv,
+                     int in_fd, int out_fd, uint64_t len, const swan_uring_config *cfg)
+{
+    size_t bs = swan_block_bytes(ctx);
+    size_t chunk = cfg != NULL && cfg->buf_size != 0 ? cfg->buf_size : SWAN_URING_BUF;
+    unsigned depth = cfg != NULL && cfg->depth != 0 ? cfg->depth : SWAN_URING_DEPTH;
+    struct iovec *iov;
+    swan_pipe *p;
+    unsigned i;
+    int err;
+
+    if ((mode != SWAN_MODE_CTR && len % bs != 0) || (mode != SWAN_MODE_ECB && iv == NULL) ||
+        (mode == SWAN_MODE_XTS && ctx->xts_unit == 0) || (mode == SWAN_MODE_CBC && enc))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (len == 0)
+        return 0;
+
+    chunk -= chunk % bs;
+    if (chunk < bs)
+        chunk = bs;
+    if (mode == SWAN_MODE_XTS)
+        chunk = chunk < ctx->xts_unit ? ctx->xts_unit : chunk - chunk % ctx->xts_unit;
+    if (depth > len / chunk + 1)
+        depth = (unsigned)(len / chunk + 1);
+
+    //workers reach the pipe through their buffers, so it lives on the heap;
+    p = (swan_pipe *)calloc(1, sizeof(swan_pipe));
+    if (p == NULL)
+        return -1;
+    if (ring_setup(&p->ring, depth) != 0)
+    {
+        //old kernels, seccomp filters and io_uring_disabled all end up on the fallback;
+        free(p);
+        errno = ENOSYS;
+        return -1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    p->depth = depth;
+    p->ctx = ctx;
+    p->mode = mode;
+    p->enc = enc;
+    p->iv = iv;
+    p->in_fd = in_fd;
+    p->out_fd = out_fd;
+    p->len = len;
+    p->chunk = chunk;
+    p->bufs = (swan_uring_buf *)calloc(depth, sizeof(swan_uring_buf));
+    iov = (struct iovec *)calloc(depth, sizeof(struct iovec));
+    if (p->bufs == NULL || iov == NULL)
+    {
+        free(iov);
+        pipe_free(p);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < depth; i++)
+    {
+        if (posix_memalign((void **)&p->bufs[i].base, URING_HEAD, URING_HEAD + chunk) != 0)
+        {
+            free(iov);
+            pipe_free(p);
+            errno = ENOMEM;
+            return -1;
+        }
+        p->bufs[i].data = p->bufs[i].base + URING_HEAD;
+        p->bufs[i].index = i;
+        p->bufs[i].pipe = p;
+        iov[i].iov_base = p->bufs[i].base;
+        iov[i].iov_len = URING_HEAD + chunk;
+    }
+    //fixed buffers skip the page pinning on every I/O; RLIMIT_MEMLOCK may refuse them;
+    p->fixed = syscall(__NR_io_uring_register, p->ring.fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+    free(iov);
+
+    if (pipe_run(p) != 0)
+    {
+        err = p->err;
+        //the reaper gave up; buffers in the pool still finish their encryption, so wait for
+        //them before the ring goes. Those still owned by the kernel may be written to after
+        //the ring is closed, so the pipe and buffers are then leaked on purpose;
+        pthread_mutex_lock(&p->lock);
+        p->closed = 1;
+        while (p->crypting > 0)
+        {
+            pthread_cond_wait(&p->idle, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+        if (p->busy > 0)
+            ring_close(&p->ring);
+        else
+            pipe_free(p);
+        errno = err;
+        return -1;
+    }
+
+    switch (mode)
+    {
+    case SWAN_MODE_CTR:
+        swan_add_be(iv, bs, (len + bs - 1) / bs);
+        break;
+    case SWAN_MODE_XTS:
+        swan_add_le(iv, bs, (len + ctx->xts_unit - 1) / ctx->xts_unit);
+        break;
+    case SWAN_MODE_CBC:
+        memcpy(iv, p->last, bs);
+        break;
+    default:
+        break;
+    }
+    pipe_free(p);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,947 @@
+/*
+ *  SWAN_wb.c
+ *
+ *  Description: Table-driven white-box SWAN128 runtime. A half round is one lookup per
+ *  encoded block of x into 64-bit entries plus one lookup per block of y, with a few
+ *  blocks in flight at once so the lookups of independent blocks overlap; 4-bit blocks
+ *  use PSHUFB instead.
+ *
+ *  A table file is the in-memory image itself: a header page (variant, rounds, block
+ *  width, encoding scheme and ID, checksums, section table) followed by page-aligned
+ *  sections, so swan_wb_load() maps it read-only and the runtime reads the tables in
+ *  place. Every process that loads the same file shares its page-cache copy.
+ *
+ *  The registry does the same through POSIX shared memory for tables that have no file,
+ *  or whose file is not on every worker's filesystem: swan_wb_publish() copies the image
+ *  into an object named after the encoding ID, header last, and swan_wb_attach() maps
+ *  that object read-only.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SWAN_wb.h>
+#include "SWAN_wb_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SWAN_WB_X86
+#endif
+
+//blocks interleaved by the runtime;
+#define SWAN_WB_WAYS 4
+
+//cache line, the alignment of each half round in the interleaved layout, and hugepage size;
+#define SWAN_WB_LINE 64
+#define SWAN_WB_HUGEPAGE ((size_t)2 << 20)
+
+static size_t page_up(size_t n)
+{
+    return (n + SWAN_WB_PAGE - 1) & ~(size_t)(SWAN_WB_PAGE - 1);
+}
+
+static void add_section(swan_wb *wb, uint32_t kind, uint32_t dir, size_t *off, size_t size)
+{
+    swan_wb_section *sec = &wb->section[wb->nsections++];
+
+    sec->kind = kind;
+    sec->dir = dir;
+    sec->offset = *off;
+    sec->size = size;
+    *off = page_up(*off + size);
+}
+
+//Size of a data cache level, with a typical size where the C library cannot tell;
+static size_t cache_size(int level)
+{
+    static const size_t fallback[3] = {32 << 10, 1 << 20, 8 << 20};
+    static const int name[3] = {_SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE};
+    long n = sysconf(name[level - 1]);
+
+    return n > 0 ? (size_t)n : fallback[level - 1];
+}
+
+size_t swan_wb_layout(swan_wb *wb)
+{
+    size_t ents = (size_t)1 << wb->width;
+    //per half round: T (or the nibble tables) and RE;
+    size_t t_bytes = wb->width == 4 ? SWAN_WB_TN_BYTES : swan_wb_blocks(wb) * ents * sizeof(uint64_t);
+    size_t re_bytes = swan_wb_blocks(wb) * ents * swan_wb_re_bytes(wb);
+    size_t stride = (t_bytes + re_bytes + SWAN_WB_LINE - 1) & ~(size_t)(SWAN_WB_LINE - 1);
+    size_t off = SWAN_WB_PAGE;
+    unsigned hr = 2u * wb->rounds;
+    unsigned i;
+    uint32_t d;
+
+    wb->nsections = 0;
+    for (d = 0; d < 2; d++)
+    {
+        if (!(wb->dirs & (d == 0 ? SWAN_WB_ENCRYPT : SWAN_WB_DECRYPT)))
+            continue;
+        add_section(wb, SWAN_WB_SEC_IN, d, &off, 2 * SWAN_WB_NIBBLES * 16 * sizeof(uint64_t));
+        if (wb->layout == SWAN_WB_LAYOUT_INTERLEAVED)
+            add_section(wb, SWAN_WB_SEC_HR, d, &off, hr * stride);
+        else
+        {
+            //nibble tables for the PSHUFB runtime, one 64-bit word per entry otherwise;
+            add_section(wb, wb->width == 4 ? SWAN_WB_SEC_TN : SWAN_WB_SEC_T, d, &off, hr * t_bytes);
+            add_section(wb, SWAN_WB_SEC_RE, d, &off, hr * re_bytes);
+        }
+        add_section(wb, SWAN_WB_SEC_OUT, d, &off, 2 * swan_wb_blocks(wb) * ents * sizeof(uint64_t));
+    }
+
+    //prefetching costs more than it saves while the tables of a direction fit in L2;
+    wb->prefetch = wb->layout == SWAN_WB_LAYOUT_INTERLEAVED && hr * stride > cache_size(2);
+    memset(wb->tab, 0, sizeof(wb->tab));
+    for (d = 0; d < 2; d++)
+    {
+        wb->tab[d].t_stride = wb->layout == SWAN_WB_LAYOUT_INTERLEAVED ? stride : t_bytes;
+        wb->tab[d].re_stride = wb->layout == SWAN_WB_LAYOUT_INTERLEAVED ? stride : re_bytes;
+    }
+    for (i = 0; wb->mem != NULL && i < wb->nsections; i++)
+    {
+        const uint8_t *p = wb->mem + wb->section[i].offset;
+        swan_wb_tables *tb = &wb->tab[wb->section[i].dir];
+        uint32_t kind = wb->section[i].kind;
+
+        if (kind == SWAN_WB_SEC_HR)
+        {
+            kind = wb->width == 4 ? SWAN_WB_SEC_TN : SWAN_WB_SEC_T;
+            tb->re = p + t_bytes;
+            tb->re16 = (const uint16_t *)tb->re;
+        }
+        switch (kind)
+        {
+        case SWAN_WB_SEC_IN:
+            tb->in = (const uint64_t *)p;
+            break;
+        case SWAN_WB_SEC_T:
+            tb->t = (const uint64_t *)p;
+            break;
+        case SWAN_WB_SEC_TN:
+            tb->tn = p;
+            break;
+        case SWAN_WB_SEC_RE:
+            tb->re = p;
+            tb->re16 = (const uint16_t *)p;
+            break;
+        case SWAN_WB_SEC_OUT:
+            tb->out = (const uint64_t *)p;
+            break;
+        }
+    }
+    return off;
+}
+
+//Four multiply-rotate lanes over 64-bit words, folded together at the end;
+uint64_t swan_wb_checksum(const uint8_t *p, size_t len)
+{
+    static const uint64_t prime = 0x9e3779b97f4a7c15u;
+    uint64_t h[4] = {1, 2, 3, 4};
+    uint64_t w;
+    size_t i;
+    int k;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        for (k = 0; k < 4; k++)
+        {
+            memcpy(&w, p + i + 8 * k, 8);
+            h[k] = (h[k] ^ w) * prime;
+            h[k] = (h[k] << 31) | (h[k] >> 33);
+        }
+    }
+    for (; i < len; i++)
+        h[0] = (h[0] ^ p[i]) * prime;
+    w = len;
+    for (k = 0; k < 4; k++)
+    {
+        w = (w ^ h[k]) * prime;
+        w ^= w >> 29;
+    }
+    return w;
+}
+
+void swan_wb_free(swan_wb *wb)
+{
+    if (wb == NULL)
+        return;
+    if (wb->mapped)
+        munmap(wb->mem, wb->map_size);
+    else
+        free(wb->mem);
+    free(wb);
+}
+
+//Anonymous memory on 2 MiB pages: reserved hugetlbfs pages if there are enough, else THP;
+static void *hugepage_map(size_t size, size_t *map_size)
+{
+    size_t len = (size + SWAN_WB_HUGEPAGE - 1) & ~(size_t)(SWAN_WB_HUGEPAGE - 1);
+    uint8_t *p, *aligned;
+
+    p = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+    {
+        *map_size = len;
+        return p;
+    }
+    //over-allocate so the region can start on a 2 MiB boundary, which THP needs;
+    p = (uint8_t *)mmap(NULL, len + SWAN_WB_HUGEPAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    aligned = (uint8_t *)(((uintptr_t)p + SWAN_WB_HUGEPAGE - 1) & ~(uintptr_t)(SWAN_WB_HUGEPAGE - 1));
+    if (aligned > p)
+        munmap(p, (size_t)(aligned - p));
+    munmap(aligned + len, (size_t)(p + SWAN_WB_HUGEPAGE - aligned));
+    madvise(aligned, len, MADV_HUGEPAGE);
+    *map_size = len;
+    return aligned;
+}
+
+int swan_wb_alloc(swan_wb *wb, int hugepages)
+{
+    if (hugepages)
+    {
+        wb->mem = (uint8_t *)hugepage_map(wb->size, &wb->map_size);
+        wb->mapped = wb->mem != NULL;
+    }
+    else
+    {
+        wb->mem = (uint8_t *)aligned_alloc(SWAN_WB_PAGE, wb->size);
+        if (wb->mem != NULL)
+            memset(wb->mem, 0, wb->size);
+    }
+    return wb->mem != NULL ? 0 : -1;
+}
+
+size_t swan_wb_size(const swan_wb *wb)
+{
+    return wb->size;
+}
+
+static void fill_header(const swan_wb *wb, swan_wb_header *h)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SWAN_WB_MAGIC, sizeof(SWAN_WB_MAGIC));
+    h->version = SWAN_WB_VERSION;
+    h->byte_order = SWAN_WB_BYTE_ORDER;
+    h->blocksize = BLOCK128;
+    h->keysize = wb->keysize;
+    h->rounds = wb->rounds;
+    h->width = wb->width;
+    h->dirs = (uint8_t)wb->dirs;
+    h->scheme = SWAN_WB_SCHEME_AFFINE;
+    h->encoding_id = wb->encoding_id;
+    h->file_size = wb->size;
+    h->table_checksum = wb->checksum;
+    h->nsections = wb->nsections;
+    h->layout = wb->layout;
+    memcpy(h->section, wb->section, sizeof(h->section));
+    h->header_checksum = swan_wb_checksum((const uint8_t *)h, sizeof(*h));
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, buf, len);
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int swan_wb_save(const swan_wb *wb, const char *path)
+{
+    uint8_t page[SWAN_WB_PAGE];
+    char *tmp = (char *)malloc(strlen(path) + 8);
+    int fd;
+    int ok;
+
+    if (tmp == NULL)
+        return -1;
+    //write a new file and rename it over the old one, so processes that map the old file keep it intact;
+    sprintf(tmp, "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0)
+    {
+        free(tmp);
+        return -1;
+    }
+    memset(page, 0, sizeof(page));
+    fill_header(wb, (swan_wb_header *)page);
+    ok = fchmod(fd, 0644) == 0 && write_all(fd, page, sizeof(page)) == 0 &&
+         write_all(fd, wb->mem + SWAN_WB_PAGE, wb->size - SWAN_WB_PAGE) == 0 && fsync(fd) == 0;
+    if (close(fd) != 0)
+        ok = 0;
+    if (ok)
+        ok = rename(tmp, path) == 0;
+    if (!ok)
+        unlink(tmp);
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+static int check_header(const swan_wb_header *h, size_t file_size)
+{
+    swan_wb_header copy = *h;
+
+    copy.header_checksum = 0;
+    if (memcmp(h->magic, SWAN_WB_MAGIC, sizeof(SWAN_WB_MAGIC)) != 0 || h->version != SWAN_WB_VERSION ||
+        h->byte_order != SWAN_WB_BYTE_ORDER || swan_wb_checksum((const uint8_t *)&copy, sizeof(copy)) != h->header_checksum)
+        return -1;
+    if (h->blocksize != BLOCK128 || h->scheme != SWAN_WB_SCHEME_AFFINE || (h->width != 4 && h->width != 8 && h->width != 16) ||
+        (h->keysize != KEY128 && h->keysize != KEY256) ||
+        h->rounds != (h->keysize == KEY128 ? ROUNDS128_128 : ROUNDS128_256) ||
+        h->dirs == 0 || (h->dirs & ~(SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT)) != 0 || h->file_size != file_size ||
+        h->layout > SWAN_WB_LAYOUT_INTERLEAVED)
+        return -1;
+    return 0;
+}
+
+swan_wb *swan_wb_load(const char *path)
+{
+    return swan_wb_load_flags(path, 0);
+}
+
+//Check a mapped table file and describe it; NULL if this runtime cannot use it;
+static swan_wb *wb_attach(const uint8_t *map, size_t size)
+{
+    const swan_wb_header *h = (const swan_wb_header *)map;
+    swan_wb *wb = (swan_wb *)calloc(1, sizeof(swan_wb));
+
+    if (wb == NULL || check_header(h, size) != 0)
+        goto fail;
+    wb->keysize = h->keysize;
+    wb->rounds = h->rounds;
+    wb->width = h->width;
+    wb->layout = (uint8_t)h->layout;
+    wb->dirs = h->dirs;
+    wb->encoding_id = h->encoding_id;
+    wb->checksum = h->table_checksum;
+    //the sections must be exactly where this runtime would put them;
+    if (swan_wb_layout(wb) != h->file_size || wb->nsections != h->nsections ||
+        memcmp(wb->section, h->section, sizeof(wb->section)) != 0)
+        goto fail;
+    wb->size = size;
+    return wb;
+
+fail:
+    free(wb);
+    return NULL;
+}
+
+//Map an open table file or shared memory object whole and close it, read-only or writable; NULL on failure;
+static uint8_t *map_fd(int fd, int writable, size_t *size)
+{
+    struct stat st;
+    void *map;
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < SWAN_WB_PAGE)
+    {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = (size_t)st.st_size;
+    return (uint8_t *)map;
+}
+
+static uint8_t *map_file(const char *path, int writable, size_t *size)
+{
+    return map_fd(open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC), writable, size);
+}
+
+//Use a mapping of a whole table image in place; NULL if this runtime cannot use it;
+static swan_wb *wb_use_map(uint8_t *map, size_t size)
+{
+    swan_wb *wb = wb_attach(map, size);
+
+    if (wb == NULL)
+    {
+        munmap(map, size);
+        return NULL;
+    }
+    wb->mem = map;
+    wb->map_size = size;
+    wb->mapped = 1;
+    swan_wb_layout(wb);
+    return wb;
+}
+
+swan_wb *swan_wb_load_flags(const char *path, unsigned flags)
+{
+    size_t size;
+    uint8_t *map = map_file(path, 0, &size);
+    swan_wb *wb;
+
+    if (map == NULL)
+        return NULL;
+    if (!(flags & SWAN_WB_LOAD_HUGEPAGES))
+        return wb_use_map(map, size);
+    wb = wb_attach(map, size);
+    if (wb == NULL || swan_wb_alloc(wb, 1) != 0)
+    {
+        munmap(map, size);
+        free(wb);
+        return NULL;
+    }
+    memcpy(wb->mem, map, size);
+    munmap(map, size);
+    mprotect(wb->mem, wb->map_size, PROT_READ);
+    swan_wb_layout(wb);
+    return wb;
+}
+
+uint64_t swan_wb_id(const swan_wb *wb)
+{
+    return wb->encoding_id;
+}
+
+static void shm_name(uint64_t id, char name[SWAN_WB_SHM_NAME])
+{
+    snprintf(name, SWAN_WB_SHM_NAME, SWAN_WB_SHM_PREFIX "%016" PRIx64, id);
+}
+
+int swan_wb_publish(const swan_wb *wb)
+{
+    static unsigned seq;
+    uint8_t page[SWAN_WB_PAGE];
+    char name[SWAN_WB_SHM_NAME];
+    //name, "." and a 20-digit pid, "." and a 10-digit sequence number;
+    char tmp[SWAN_WB_SHM_NAME + 32];
+    char from[sizeof(SWAN_WB_SHM_DIR) + sizeof(tmp)];
+    char to[sizeof(SWAN_WB_SHM_DIR) + SWAN_WB_SHM_NAME];
+    swan_wb *old;
+    int fd;
+    int ok;
+    int n;
+
+    //write the whole object under a name of its own, so the ID only ever names complete tables;
+    shm_name(wb->encoding_id, name);
+    n = snprintf(tmp, sizeof(tmp), "%s.%ld.%u", name, (long)getpid(), __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+    //a cut-off name could collide with another process's temporary object;
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        return -1;
+    fd = shm_open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    memset(page, 0, sizeof(page));
+    fill_header(wb, (swan_wb_header *)page);
+    ok = ftruncate(fd, (off_t)wb->size) == 0 && write_all(fd, page, sizeof(page)) == 0 &&
+         write_all(fd, wb->mem + SWAN_WB_PAGE, wb->size - SWAN_WB_PAGE) == 0;
+    close(fd);
+    if (!ok)
+    {
+        shm_unlink(tmp);
+        return -1;
+    }
+
+    //link() never replaces, so the first complete object under the ID stays;
+    snprintf(from, sizeof(from), SWAN_WB_SHM_DIR "%s", tmp);
+    snprintf(to, sizeof(to), SWAN_WB_SHM_DIR "%s", name);
+    if (link(from, to) == 0)
+    {
+        shm_unlink(tmp);
+        return 0;
+    }
+    if (errno != EEXIST)
+    {
+        shm_unlink(tmp);
+        return -1;
+    }
+    //published before, by this process or another; an object that does not attach was left
+    //half written by an older publisher that crashed, and is replaced in one step;
+    old = swan_wb_attach(wb->encoding_id);
+    if (old == NULL)
+    {
+        ok = rename(from, to) == 0;
+        if (!ok)
+            shm_unlink(tmp);
+        return ok ? 0 : -1;
+    }
+    ok = old->checksum == wb->checksum;
+    swan_wb_free(old);
+    shm_unlink(tmp);
+    return ok ? 0 : -1;
+}
+
+swan_wb *swan_wb_attach(uint64_t id)
+{
+    char name[SWAN_WB_SHM_NAME];
+    size_t size;
+    uint8_t *map;
+    swan_wb *wb;
+
+    shm_name(id, name);
+    map = map_fd(shm_open(name, O_RDONLY | O_CLOEXEC, 0), 0, &size);
+    if (map == NULL)
+        return NULL;
+    wb = wb_use_map(map, size);
+    if (wb != NULL && wb->encoding_id != id)
+    {
+        swan_wb_free(wb);
+        return NULL;
+    }
+    return wb;
+}
+
+int swan_wb_unpublish(uint64_t id)
+{
+    char name[SWAN_WB_SHM_NAME];
+
+    shm_name(id, name);
+    return shm_unlink(name) == 0 ? 0 : -1;
+}
+
+int swan_wb_refresh_file(const char *path, const swan_wb_refresh_config *cfg)
+{
+    size_t size;
+    uint8_t *map = map_file(path, 1, &size);
+    swan_wb *wb;
+    int ok;
+
+    if (map == NULL || (wb = wb_use_map(map, size)) == NULL)
+        return -1;
+    wb->writable = 1;
+    //tables that do not match their checksum would only be re-encoded garbage;
+    ok = swan_wb_verify(wb) == 0 && swan_wb_refresh(wb, cfg) == 0;
+    if (ok)
+    {
+        //the header goes last, so a refresh cut short leaves a checksum mismatch behind;
+        ok = msync(map, size, MS_SYNC) == 0;
+        memset(map, 0, SWAN_WB_PAGE);
+        fill_header(wb, (swan_wb_header *)map);
+        ok = msync(map, SWAN_WB_PAGE, MS_SYNC) == 0 && ok;
+    }
+    swan_wb_free(wb);
+    return ok ? 0 : -1;
+}
+
+int swan_wb_verify(const swan_wb *wb)
+{
+    return swan_wb_checksum(wb->mem + SWAN_WB_PAGE, wb->size - SWAN_WB_PAGE) == wb->checksum ? 0 : -1;
+}
+
+//Lane-packed halves of a block: bit 16*i+j of a half is bit j of lane i;
+static inline void wb_load(const uint8_t *in, uint64_t p[2])
+{
+    uint16_t w[8];
+    int i;
+
+    memcpy(w, in, sizeof(w));
+    p[0] = p[1] = 0;
+    for (i = 0; i < 4; i++)
+    {
+        p[0] |= (uint64_t)w[i] << (16 * i);
+        p[1] |= (uint64_t)w[i + 4] << (16 * i);
+    }
+}
+
+static inline void wb_store(uint8_t *out, const uint64_t p[2])
+{
+    uint16_t w[8];
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        w[i] = (uint16_t)(p[0] >> (16 * i));
+        w[i + 4] = (uint16_t)(p[1] >> (16 * i));
+    }
+    memcpy(out, w, sizeof(w));
+}
+
+//Plaintext block to its two encoded halves, and back;
+static inline void wb_enter(const swan_wb_tables *tb, const uint8_t *in, uint64_t h[2])
+{
+    uint64_t p[2];
+    int k, n;
+
+    wb_load(in, p);
+    for (k = 0; k < 2; k++)
+    {
+        h[k] = 0;
+        for (n = 0; n < SWAN_WB_NIBBLES; n++)
+            h[k] ^= tb->in[(k * SWAN_WB_NIBBLES + n) * 16 + ((p[k] >> (4 * n)) & 15)];
+    }
+}
+
+static inline void wb_leave(const swan_wb *wb, const swan_wb_tables *tb, const uint64_t h[2], uint8_t *out)
+{
+    unsigned w = wb->width, nb = swan_wb_blocks(wb);
+    size_t ents = (size_t)1 << w;
+    uint64_t p[2];
+    unsigned b;
+    int k;
+
+    for (k = 0; k < 2; k++)
+    {
+        p[k] = 0;
+        for (b = 0; b < nb; b++)
+            p[k] ^= tb->out[(k * nb + b) * ents + ((h[k] >> (w * b)) & (ents - 1))];
+    }
+    wb_store(out, p);
+}
+
+/*
+ * Up to SWAN_WB_WAYS blocks through the 8- or 16-bit block tables; x is the half read by
+ * the first half round. With wb->prefetch each block, once its new half is known,
+ * prefetches the T entries that half selects in the next half round and the RE entries
+ * of the other half, so the next half round's misses overlap this one's work.
+ */
+#define WB_SCALAR_KERNEL(name, W, re_type, re_member)                                                 \
+    static void name(const swan_wb *wb, const swan_wb_tables *tb, unsigned x, const uint8_t *in, uint8_t *out, \
+                     size_t m)                                                                        \
+    {                                                                                                 \
+        const unsigned nb = 64 / (W), hr = 2u * wb->rounds;                                           \
+        const uint64_t mask = ((uint64_t)1 << (W)) - 1;                                               \
+        const int pf = wb->prefetch;                                                                  \
+        uint64_t h[SWAN_WB_WAYS][2];                                                                  \
+        uint64_t acc, xv, yv, ny;                                                                     \
+        const uint64_t *T, *NT;                                                                       \
+        const re_type *RE, *NRE;                                                                      \
+        unsigned t, b;                                                                                \
+        size_t j;                                                                                     \
+                                                                                                      \
+        for (j = 0; j < m; j++)                                                                       \
+            wb_enter(tb, in + 16 * j, h[j]);                                                          \
+                                                                                                      \
+        for (t = 0; t < hr; t++)                                                                      \
+        {                                                                                             \
+            T = (const uint64_t *)swan_wb_step(tb->t, tb->t_stride, t);                               \
+            RE = (const re_type *)swan_wb_step(tb->re_member, tb->re_stride, t);                      \
+            NT = (const uint64_t *)swan_wb_step(tb->t, tb->t_stride, t + 1);                          \
+            NRE = (const re_type *)swan_wb_step(tb->re_member, tb->re_stride, t + 1);                 \
+            for (j = 0; j < m; j++)                                                                   \
+            {                                                                                         \
+                xv = h[j][x];                                                                         \
+                yv = h[j][x ^ 1];                                                                     \
+                acc = 0;                                                                              \
+                ny = 0;                                                                               \
+                for (b = 0; b < nb; b++)                                                              \
+                {                                                                                     \
+                    acc ^= T[(b << (W)) + ((xv >> ((W) * b)) & mask)];                                \
+                    ny |= (uint64_t)RE[(b << (W)) + ((yv >> ((W) * b)) & mask)] << ((W) * b);         \
+                }                                                                                     \
+                h[j][x ^ 1] = ny ^ acc;                                                               \
+                if (pf && t + 1 < hr)                                                                 \
+                {                                                                                     \
+                    for (b = 0; b < nb; b++)                                                          \
+                    {                                                                                 \
+                        __builtin_prefetch(&NT[(b << (W)) + (((ny ^ acc) >> ((W) * b)) & mask)]);     \
+                        __builtin_prefetch(&NRE[(b << (W)) + ((xv >> ((W) * b)) & mask)]);            \
+                    }                                                                                 \
+                }                                                                                     \
+            }                                                                                         \
+            x ^= 1;                                                                                   \
+        }                                                                                             \
+                                                                                                      \
+        for (j = 0; j < m; j++)                                                                       \
+            wb_leave(wb, tb, h[j], out + 16 * j);                                                     \
+    }
+
+WB_SCALAR_KERNEL(wb_run8, 8, uint8_t, re)
+//four lookups per half into 64K-entry tables;
+WB_SCALAR_KERNEL(wb_run16, 16, uint16_t, re16)
+
+//Nibble tables one block at a time, for CPUs without PSHUFB;
+static void wb_run4(const swan_wb *wb, const swan_wb_tables *tb, unsigned x, const uint8_t *in, uint8_t *out, size_t m)
+{
+    static const unsigned rot[4] = SWAN_WB_ROT;
+    uint64_t h[SWAN_WB_WAYS][2];
+    uint64_t acc, xv, yv;
+    const uint8_t *T;
+    const uint8_t *RE;
+    unsigned t, s, i, xn;
+    size_t j;
+
+    for (j = 0; j < m; j++)
+        wb_enter(tb, in + 16 * j, h[j]);
+
+    for (t = 0; t < 2u * wb->rounds; t++)
+    {
+        T = (const uint8_t *)swan_wb_step(tb->tn, tb->t_stride, t);
+        RE = (const uint8_t *)swan_wb_step(tb->re, tb->re_stride, t);
+        for (j = 0; j < m; j++)
+        {
+            xv = h[j][x];
+            yv = h[j][x ^ 1];
+            acc = 0;
+            for (s = 0; s < SWAN_WB_NIBBLES; s++)
+            {
+                acc ^= (uint64_t)RE[s * 16 + ((yv >> (4 * s)) & 15)] << (4 * s);
+                xn = (unsigned)(xv >> (4 * s)) & 15;
+                for (i = 0; i < 4; i++)
+                    acc ^= (uint64_t)T[(s * 4 + i) * 16 + xn] << (4 * ((s + 16 - rot[i]) % 16));
+            }
+            h[j][x ^ 1] = acc;
+        }
+        x ^= 1;
+    }
+
+    for (j = 0; j < m; j++)
+        wb_leave(wb, tb, h[j], out + 16 * j);
+}
+
+#ifdef SWAN_WB_X86
+/*
+ * PSHUFB runtime: the blocks are held as nibble planes, plane s of a half carrying
+ * nibble s of every block in one byte, so one shuffle looks a 16-entry table up for
+ * all of them. WB_PSHUFB_KERNEL expands to the SSSE3 and the AVX2 version, which only
+ * differ in the vector type, the number of blocks and the table broadcast.
+ */
+#define WB_PSHUFB_KERNEL(name, isa, vec, nblk, load_table, shuffle, xor, load, store)                  \
+    __attribute__((target(isa))) static void name(const swan_wb *wb, const swan_wb_tables *tb, unsigned x, \
+                                                      const uint8_t *in, uint8_t *out, size_t m)             \
+    {                                                                                                    \
+        uint8_t plane[2][SWAN_WB_NIBBLES][nblk] __attribute__((aligned(32)));                            \
+        vec P[2][SWAN_WB_NIBBLES];                                                                       \
+        vec acc[SWAN_WB_NIBBLES];                                                                        \
+        vec *X, *Y;                                                                                      \
+        const uint8_t *T;                                                                                \
+        const uint8_t *RE;                                                                               \
+        uint64_t h[2];                                                                                   \
+        unsigned t, s;                                                                                   \
+        size_t j;                                                                                        \
+        int k;                                                                                           \
+                                                                                                         \
+        memset(plane, 0, sizeof(plane));                                                                 \
+        for (j = 0; j < m; j++)                                                                          \
+        {                                                                                                \
+            wb_enter(tb, in + 16 * j, h);                                                                \
+            for (k = 0; k < 2; k++)                                                                      \
+                for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                    \
+                    plane[k][s][j] = (uint8_t)(h[k] >> (4 * s)) & 15;                                    \
+        }                                                                                                \
+        for (k = 0; k < 2; k++)                                                                          \
+            for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                        \
+                P[k][s] = load(plane[k][s]);                                                             \
+                                                                                                         \
+        for (t = 0; t < 2u * wb->rounds; t++)                                                            \
+        {                                                                                                \
+            T = (const uint8_t *)swan_wb_step(tb->tn, tb->t_stride, t);                                  \
+            RE = (const uint8_t *)swan_wb_step(tb->re, tb->re_stride, t);                                \
+            /* the whole of the next half round's tables is read, 1.25 KiB */                           \
+            if (wb->prefetch && t + 1 < 2u * wb->rounds)                                                 \
+            {                                                                                            \
+                for (s = 0; s < SWAN_WB_TN_BYTES; s += 64)                                               \
+                    __builtin_prefetch(T + tb->t_stride + s);                                            \
+                for (s = 0; s < SWAN_WB_NIBBLES * 16; s += 64)                                           \
+                    __builtin_prefetch(RE + tb->re_stride + s);                                          \
+            }                                                                                            \
+            X = P[x];                                                                                    \
+            Y = P[x ^ 1];                                                                                \
+            for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                        \
+                acc[s] = shuffle(load_table(RE + 16 * s), Y[s]);                                         \
+            /* S-box s reaches y's nibbles s, s-1, s-7 and s-13 (ShiftLanes 0, 1, 7, 13) */              \
+            for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                        \
+            {                                                                                            \
+                acc[s] = xor(acc[s], shuffle(load_table(T + (s * 4 + 0) * 16), X[s]));                  \
+                acc[(s + 15) % 16] = xor(acc[(s + 15) % 16], shuffle(load_table(T + (s * 4 + 1) * 16), X[s])); \
+                acc[(s + 9) % 16] = xor(acc[(s + 9) % 16], shuffle(load_table(T + (s * 4 + 2) * 16), X[s]));  \
+                acc[(s + 3) % 16] = xor(acc[(s + 3) % 16], shuffle(load_table(T + (s * 4 + 3) * 16), X[s]));  \
+            }                                                                                            \
+            for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                        \
+                Y[s] = acc[s];                                                                           \
+            x ^= 1;                                                                                      \
+        }                                                                                                \
+                                                                                                         \
+        for (k = 0; k < 2; k++)                                                                          \
+            for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                        \
+                store(plane[k][s], P[k][s]);                                                             \
+        for (j = 0; j < m; j++)                                                                          \
+        {                                                                                                \
+            for (k = 0; k < 2; k++)                                                                      \
+            {                                                                                            \
+                h[k] = 0;                                                                                \
+                for (s = 0; s < SWAN_WB_NIBBLES; s++)                                                    \
+                    h[k] |= (uint64_t)plane[k][s][j] << (4 * s);                                         \
+            }                                                                                            \
+            wb_leave(wb, tb, h, out + 16 * j);                                                           \
+        }                                                                                                \
+    }
+
+#define WB_LOAD128(p) _mm_load_si128((const __m128i *)(p))
+#define WB_STORE128(p, v) _mm_store_si128((__m128i *)(p), (v))
+#define WB_TABLE128(p) _mm_loadu_si128((const __m128i *)(p))
+#define WB_LOAD256(p) _mm256_load_si256((const __m256i *)(p))
+#define WB_STORE256(p, v) _mm256_store_si256((__m256i *)(p), (v))
+#define WB_TABLE256(p) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(p)))
+
+WB_PSHUFB_KERNEL(wb_run4_ssse3, "ssse3", __m128i, 16, WB_TABLE128, _mm_shuffle_epi8, _mm_xor_si128, WB_LOAD128, WB_STORE128)
+WB_PSHUFB_KERNEL(wb_run4_avx2, "avx2", __m256i, 32, WB_TABLE256, _mm256_shuffle_epi8, _mm256_xor_si256, WB_LOAD256, WB_STORE256)
+#endif
+
+typedef void (*wb_kernel)(const swan_wb *wb, const swan_wb_tables *tb, unsigned x, const uint8_t *in, uint8_t *out, size_t m);
+
+//The runtime for these tables on this CPU, and how many blocks it takes per call;
+static wb_kernel pick_kernel(const swan_wb *wb, size_t *ways)
+{
+    swan_wb_backend b = swan_wb_get_backend(wb);
+
+    *ways = SWAN_WB_WAYS;
+    if (wb->width == 8)
+        return wb_run8;
+    if (wb->width == 16)
+        return wb_run16;
+#ifdef SWAN_WB_X86
+    if (b == SWAN_WB_AVX2)
+    {
+        *ways = 32;
+        return wb_run4_avx2;
+    }
+    if (b == SWAN_WB_SSSE3)
+    {
+        *ways = 16;
+        return wb_run4_ssse3;
+    }
+#endif
+    return wb_run4;
+}
+
+static int cpu_has(swan_wb_backend b)
+{
+#ifdef SWAN_WB_X86
+    __builtin_cpu_init();
+    if (b == SWAN_WB_AVX2)
+        return __builtin_cpu_supports("avx2");
+    if (b == SWAN_WB_SSSE3)
+        return __builtin_cpu_supports("ssse3");
+#endif
+    return b == SWAN_WB_SCALAR;
+}
+
+int swan_wb_set_backend(swan_wb *wb, swan_wb_backend backend)
+{
+    if (backend != SWAN_WB_AUTO && backend != SWAN_WB_SCALAR && (wb->width != 4 || !cpu_has(backend)))
+        return -1;
+    wb->backend = backend;
+    return 0;
+}
+
+swan_wb_backend swan_wb_get_backend(const swan_wb *wb)
+{
+    if (wb->backend != SWAN_WB_AUTO || wb->width != 4)
+        return wb->backend == SWAN_WB_AUTO ? SWAN_WB_SCALAR : wb->backend;
+    if (cpu_has(SWAN_WB_AVX2))
+        return SWAN_WB_AVX2;
+    if (cpu_has(SWAN_WB_SSSE3))
+        return SWAN_WB_SSSE3;
+    return SWAN_WB_SCALAR;
+}
+
+unsigned swan_wb_config_width(const swan_wb_config *cfg)
+{
+    static const unsigned tier_width[] = {8, 4, 8, 16};
+
+    if (cfg != NULL && cfg->tier != SWAN_WB_TIER_NONE)
+        return (unsigned)cfg->tier < sizeof(tier_width) / sizeof(tier_width[0]) ? tier_width[cfg->tier] : 0;
+    return cfg != NULL && cfg->width != 0 ? cfg->width : 8;
+}
+
+int swan_wb_estimate_config(uint16_t keysize, const swan_wb_config *cfg, swan_wb_estimate *est)
+{
+    //load-to-use latency in cycles of L1, L2, L3 and memory, and the misses a core keeps in flight;
+    static const double latency[5] = {0, 5, 14, 45, 300};
+    static const double in_flight = 10;
+    //a page walk, and what the second-level TLB covers with 4 KiB pages (1536 entries);
+    static const double page_walk = 40;
+    static const size_t tlb_reach = (size_t)1536 * 4096;
+    swan_wb wb;
+    size_t dir_bytes;
+    double lookups, vector_ops, per_lookup, par;
+    unsigned hr, lanes;
+
+    memset(&wb, 0, sizeof(wb));
+    wb.keysize = keysize;
+    wb.rounds = keysize == KEY128 ? 48 : keysize == KEY256 ? 64 : 0;
+    wb.width = (uint8_t)swan_wb_config_width(cfg);
+    wb.dirs = cfg != NULL && cfg->dirs != 0 ? cfg->dirs : SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT;
+    wb.layout = cfg != NULL ? (uint8_t)cfg->layout : SWAN_WB_LAYOUT_PLAIN;
+    if (wb.rounds == 0 || (wb.width != 4 && wb.width != 8 && wb.width != 16) ||
+        (wb.dirs & ~(unsigned)(SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT)) != 0 || wb.layout > SWAN_WB_LAYOUT_INTERLEAVED)
+        return -1;
+    est->width = wb.width;
+    est->bytes = swan_wb_layout(&wb);
+    dir_bytes = (est->bytes - SWAN_WB_PAGE) / (wb.dirs == (SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT) ? 2 : 1);
+    for (est->level = 1; est->level < 4 && dir_bytes > cache_size(est->level); est->level++)
+        ;
+
+    //IN and OUT, a few KiB that stay in L1, and the half rounds;
+    hr = 2u * wb.rounds;
+    lookups = 2 * SWAN_WB_NIBBLES + 2 * swan_wb_blocks(&wb);
+    vector_ops = 0;
+    lanes = swan_wb_get_backend(&wb) == SWAN_WB_AVX2 ? 32 : 16;
+    //nibble tables are read in order, 1.25 KiB per half round, so they stream like L1;
+    if (wb.width == 4 && swan_wb_get_backend(&wb) != SWAN_WB_SCALAR)
+    {
+        //a load, a shuffle and an XOR per table for all lanes, plus a byte store and load per
+        //nibble to move a block into the planes and back, counted like lookups;
+        vector_ops = hr * (SWAN_WB_TN_BYTES + SWAN_WB_NIBBLES * 16) / 16 * 3.0 / lanes;
+        lookups += 2 * 2 * SWAN_WB_NIBBLES;
+    }
+    else if (wb.width == 4)
+        lookups += hr * (SWAN_WB_TN_BYTES + SWAN_WB_NIBBLES * 16) / 16.0;
+    else
+        lookups += hr * 2.0 * swan_wb_blocks(&wb);
+
+    //a lookup is a shift, a mask, the load and an XOR, and waits for its cache level
+    //behind the lookups of the other blocks in flight;
+    par = SWAN_WB_WAYS * swan_wb_blocks(&wb);
+    if (par > in_flight)
+        par = in_flight;
+    per_lookup = latency[wb.width == 4 || est->level == 1 ? 1 : est->level] / par;
+    //random lookups over more than the TLB covers walk the page tables too, unless on 2 MiB pages;
+    if (wb.width != 4 && dir_bytes > tlb_reach && !(cfg != NULL && cfg->hugepages))
+        per_lookup += page_walk / par;
+    est->cycles = lookups * (1 + per_lookup) + vector_ops;
+    return 0;
+}
+
+static int wb_crypt(const swan_wb *wb, int d, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    const swan_wb_tables *tb = &wb->tab[d];
+    size_t m, ways;
+    wb_kernel run;
+
+    if (tb->in == NULL)
+        return -1;
+    run = pick_kernel(wb, &ways);
+    while (nblocks > 0)
+    {
+        m = nblocks < ways ? nblocks : ways;
+        //encryption starts with R ^= F(L), decryption with L ^= F(R);
+        run(wb, tb, (unsigned)d, in, out, m);
+        in += 16 * m;
+        out += 16 * m;
+        nblocks -= m;
+    }
+    return 0;
+}
+
+int swan_wb_encrypt(const swan_wb *wb, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    return wb_crypt(wb, 0, in, out, nblocks);
+}
+
+int swan_wb_decrypt(const swan_wb *wb, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    return wb_crypt(wb, 1, in, out, nblocks);
+}
@@ -0,0 +1,133 @@
+/*
+ *  SWAN_wb_internal.h
+ *
+ *  Description: Layout of a white-box table set, shared by the generator and the runtime.
+ */
+
+#ifndef SWAN_WB_INTERNAL_H_INCLUDED
+#define SWAN_WB_INTERNAL_H_INCLUDED
+#include <stdint.h>
+#include <stddef.h>
+#include "SWAN_wb.h"
+
+//nibbles, that is S-boxes, per half;
+#define SWAN_WB_NIBBLES 16
+
+//ShiftLanes rotations of the four lanes; nibble s of a half in S-box order holds bit s+rot[i] of lane i;
+#define SWAN_WB_ROT {0, A_128, B_128, C_128}
+
+//file layout: a header page, then every table in its own page-aligned section;
+#define SWAN_WB_MAGIC "SWANWBT"
+#define SWAN_WB_VERSION 1
+#define SWAN_WB_PAGE 4096
+//written in host order, so a file from a host of the other byte order is rejected;
+#define SWAN_WB_BYTE_ORDER 0x01020304u
+//encoding schemes;
+#define SWAN_WB_SCHEME_AFFINE 1
+
+#define SWAN_WB_MAX_SECTIONS 16
+
+//shared memory object of a published table set: the prefix and the encoding ID in hex;
+//a publisher writes it under a temporary name with its pid appended and links it into
+//place through the directory glibc keeps the objects in;
+#define SWAN_WB_SHM_PREFIX "/swan-wb-"
+#define SWAN_WB_SHM_NAME 64
+#define SWAN_WB_SHM_DIR "/dev/shm"
+
+enum
+{
+    SWAN_WB_SEC_IN = 1,
+    SWAN_WB_SEC_T,
+    SWAN_WB_SEC_RE,
+    SWAN_WB_SEC_OUT,
+    SWAN_WB_SEC_TN,
+    SWAN_WB_SEC_HR //interleaved layout: every half round's T (or TN) followed by its RE
+};
+
+typedef struct
+{
+    uint32_t kind; //SWAN_WB_SEC_*
+    uint32_t dir;  //0 encryption, 1 decryption
+    uint64_t offset;
+    uint64_t size;
+} swan_wb_section;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint16_t blocksize;
+    uint16_t keysize;
+    uint8_t rounds;
+    uint8_t width;  //bits per encoded block
+    uint8_t dirs;   //SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT
+    uint8_t scheme; //SWAN_WB_SCHEME_*
+    uint64_t encoding_id; //random per generation, tells encodings of the same key apart
+    uint64_t file_size;
+    uint64_t table_checksum;  //swan_wb_checksum() of everything after the header page
+    uint64_t header_checksum; //of this header with the field itself zero
+    uint32_t nsections;
+    uint32_t layout; //swan_wb_layout_kind
+    swan_wb_section section[SWAN_WB_MAX_SECTIONS];
+} swan_wb_header;
+
+typedef struct
+{
+    const uint64_t *in;  //[2][16][16]: plaintext nibble n of a half to its share of the encoded half
+    const uint64_t *t;   //[2*rounds][blocks][1<<width]: encoded block of x to its encoded share of y
+    const uint8_t *tn;   //width 4 instead of t: [2*rounds][16][4][16], S-box s and lane i to y's nibble s-rot[i]
+    const uint8_t *re;   //[2*rounds][blocks][1<<width]: encoded block of y to y's next encoding
+    const uint16_t *re16; //width 16 instead of re, same shape
+    const uint64_t *out; //[2][blocks][1<<width]: encoded block of a half to its plaintext lane bits
+    size_t t_stride;     //bytes from one half round's T or TN to the next
+    size_t re_stride;    //and from one half round's RE to the next
+} swan_wb_tables;
+
+//Tables of half round t;
+static inline const void *swan_wb_step(const void *base, size_t stride, unsigned t)
+{
+    return (const uint8_t *)base + (size_t)t * stride;
+}
+
+struct swan_wb
+{
+    uint16_t keysize;
+    uint8_t rounds;
+    uint8_t width; //bits per encoded block
+    uint8_t layout; //swan_wb_layout_kind
+    int prefetch;   //interleaved and larger than L2: the runtime prefetches a half round ahead
+    unsigned dirs; //SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT
+    uint64_t encoding_id;
+    uint64_t checksum;
+    uint8_t *mem;  //the file image, header page included
+    size_t size;
+    int mapped;    //mem is a mapping, of the file or of anonymous memory
+    size_t map_size; //bytes to unmap
+    int writable;  //the tables may be rewritten in place: generated, or opened by swan_wb_refresh_file()
+    swan_wb_backend backend;
+    swan_wb_section section[SWAN_WB_MAX_SECTIONS];
+    unsigned nsections;
+    swan_wb_tables tab[2]; //encryption, decryption
+};
+
+#define swan_wb_blocks(wb) (64u / (wb)->width)
+
+//bytes per RE entry: one encoded block of y;
+#define swan_wb_re_bytes(wb) ((wb)->width > 8 ? 2u : 1u)
+
+//bytes of the nibble tables of one half round: 16 S-boxes, each sending one encoded bit to 4 nibbles of y;
+#define SWAN_WB_TN_BYTES (SWAN_WB_NIBBLES * 4 * 16)
+
+//Lay the sections out after the header page, point wb->tab into wb->mem if it is set, and return the image size;
+size_t swan_wb_layout(swan_wb *wb);
+
+uint64_t swan_wb_checksum(const uint8_t *p, size_t len);
+
+//Zeroed memory for wb->size bytes of image, on 2 MiB pages if hugepages is set; swan_wb_free() releases it;
+int swan_wb_alloc(swan_wb *wb, int hugepages);
+
+//Block width a configuration asks for: its tier's if it names one, else its width, else 8;
+unsigned swan_wb_config_width(const swan_wb_config *cfg);
+
+#endif
@@ -0,0 +1,926 @@
+/*
+ *  SWAN_wbgen.c
+ *
+ *  Description: White-box SWAN128 table generator. Randomness comes from SWAN128-256 in
+ *  CTR mode keyed with the seed, one counter stream per encoding and per table job, so
+ *  the jobs can run on any number of threads in any order and a seed still reproduces
+ *  its tables bit for bit.
+ *
+ *  Generation runs in two phases: first every encoding of the state, one per half round
+ *  plus the two initial ones, then the tables, which only read the encodings.
+ *
+ *  swan_wb_refresh() replaces some of those encodings without the key: it draws a
+ *  random block-affine delta for each, maps the outputs of the tables that produce the
+ *  state through the delta (with fresh masks) and permutes the inputs of the tables
+ *  that read it by the inverse, so only the tables next to a changed encoding move.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <SWAN_wb.h>
+#include "SWAN_internal.h"
+#include "SWAN_wb_internal.h"
+
+//largest block width the generator handles, in bits;
+#define WB_MAX_WIDTH 16
+
+//RNG stream of one encoding or table job: kind, direction and index in the counter's top bytes;
+#define WB_STREAM(kind, d, i) (((uint64_t)(kind) << 56) | ((uint64_t)(d) << 48) | (uint64_t)(i))
+
+enum
+{
+    WB_STREAM_ID,
+    WB_STREAM_ENCODING,
+    WB_STREAM_IN,
+    WB_STREAM_HALF_ROUND,
+    WB_STREAM_OUT,
+    WB_STREAM_DELTA,  //re-encoding: the delta of one encoding version
+    WB_STREAM_REFRESH //and the masks of one table job
+};
+
+typedef struct
+{
+    swan_ctx ctx;
+    uint8_t ctr[BLOCK128 / 8];
+    uint8_t buf[4096];
+    size_t pos;
+} wb_rng;
+
+//Affine map on width bits: column i of the linear part is m[i];
+typedef struct
+{
+    uint16_t m[WB_MAX_WIDTH];
+    uint16_t inv[WB_MAX_WIDTH];
+    uint16_t c;
+} wb_affine;
+
+//Block-diagonal encoding of a half in S-box order;
+typedef struct
+{
+    wb_affine blk[64 / 4];
+} wb_encoding;
+
+typedef struct
+{
+    unsigned width;
+    unsigned blocks;
+    uint16_t mask;
+    //plaintext contribution to y of S-box s on input v: SwitchLanes(Beta(v)) routed into y's nibbles;
+    uint64_t contrib[SWAN_WB_NIBBLES][16];
+} wb_gen;
+
+static const unsigned wb_rot[4] = SWAN_WB_ROT;
+
+static void rng_init(wb_rng *r, const uint8_t *seed, uint64_t stream)
+{
+    int i;
+
+    swan_expand_key(&r->ctx, BLOCK128, KEY256, seed);
+    //the stream number fills the upper half of the big-endian counter, the lower half counts blocks;
+    memset(r->ctr, 0, sizeof(r->ctr));
+    for (i = 0; i < 8; i++)
+        r->ctr[i] = (uint8_t)(stream >> (56 - 8 * i));
+    r->pos = sizeof(r->buf);
+}
+
+static uint64_t rng_u64(wb_rng *r)
+{
+    uint64_t v;
+
+    if (r->pos + sizeof(v) > sizeof(r->buf))
+    {
+        memset(r->buf, 0, sizeof(r->buf));
+        swan_mode_crypt(&r->ctx, SWAN_MODE_CTR, SWAN_ENCRYPT, r->ctr, r->buf, r->buf, sizeof(r->buf));
+        r->pos = 0;
+    }
+    memcpy(&v, r->buf + r->pos, sizeof(v));
+    r->pos += sizeof(v);
+    return v;
+}
+
+static void rng_wipe(wb_rng *r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+static uint16_t apply(const uint16_t *cols, unsigned w, uint16_t v)
+{
+    uint16_t r = 0;
+    unsigned i;
+
+    for (i = 0; i < w; i++)
+    {
+        if ((v >> i) & 1)
+            r ^= cols[i];
+    }
+    return r;
+}
+
+//Invert the w x w matrix with columns m into inv; returns -1 if it is singular;
+static int invert(const uint16_t *m, uint16_t *inv, unsigned w)
+{
+    uint32_t row[WB_MAX_WIDTH];
+    uint32_t tmp;
+    unsigned r, c, i;
+
+    //row r: bits 0..w-1 of the matrix, bits 16.. of the identity;
+    for (r = 0; r < w; r++)
+    {
+        row[r] = (uint32_t)1 << (16 + r);
+        for (c = 0; c < w; c++)
+            row[r] |= (uint32_t)((m[c] >> r) & 1) << c;
+    }
+    for (c = 0; c < w; c++)
+    {
+        for (r = c; r < w && !((row[r] >> c) & 1); r++)
+            ;
+        if (r == w)
+            return -1;
+        tmp = row[c];
+        row[c] = row[r];
+        row[r] = tmp;
+        for (r = 0; r < w; r++)
+        {
+            if (r != c && ((row[r] >> c) & 1))
+                row[r] ^= row[c];
+        }
+    }
+    for (i = 0; i < w; i++)
+    {
+        inv[i] = 0;
+        for (r = 0; r < w; r++)
+            inv[i] |= (uint16_t)(((row[r] >> (16 + i)) & 1) << r);
+    }
+    return 0;
+}
+
+static void random_encoding(const wb_gen *g, wb_rng *r, wb_encoding *e)
+{
+    unsigned b, i;
+
+    for (b = 0; b < g->blocks; b++)
+    {
+        do
+        {
+            for (i = 0; i < g->width; i++)
+                e->blk[b].m[i] = (uint16_t)rng_u64(r) & g->mask;
+        } while (invert(e->blk[b].m, e->blk[b].inv, g->width) != 0);
+        e->blk[b].c = (uint16_t)rng_u64(r) & g->mask;
+    }
+}
+
+static uint16_t block_of(const wb_gen *g, uint64_t v, unsigned b)
+{
+    return (uint16_t)(v >> (b * g->width)) & g->mask;
+}
+
+//Linear part of e on a whole half, for values that are XORed into an encoded half;
+static uint64_t encode_linear(const wb_gen *g, const wb_encoding *e, uint64_t v)
+{
+    uint64_t r = 0;
+    unsigned b;
+
+    for (b = 0; b < g->blocks; b++)
+        r |= (uint64_t)apply(e->blk[b].m, g->width, block_of(g, v, b)) << (b * g->width);
+    return r;
+}
+
+static uint64_t encoding_constant(const wb_gen *g, const wb_encoding *e)
+{
+    uint64_t r = 0;
+    unsigned b;
+
+    for (b = 0; b < g->blocks; b++)
+        r |= (uint64_t)e->blk[b].c << (b * g->width);
+    return r;
+}
+
+static uint16_t decode_block(const wb_gen *g, const wb_encoding *e, unsigned b, uint16_t v)
+{
+    return apply(e->blk[b].inv, g->width, (v ^ e->blk[b].c) & g->mask);
+}
+
+//Lane-packed half to S-box order and back;
+static uint64_t to_sbox_order(uint64_t p)
+{
+    uint64_t q = 0;
+    unsigned s, i;
+
+    for (s = 0; s < SWAN_WB_NIBBLES; s++)
+    {
+        for (i = 0; i < 4; i++)
+            q |= ((p >> (16 * i + (s + wb_rot[i]) % 16)) & 1) << (4 * s + i);
+    }
+    return q;
+}
+
+static uint64_t from_sbox_order(uint64_t q)
+{
+    uint64_t p = 0;
+    unsigned s, i;
+
+    for (s = 0; s < SWAN_WB_NIBBLES; s++)
+    {
+        for (i = 0; i < 4; i++)
+            p |= ((q >> (4 * s + i)) & 1) << (16 * i + (s + wb_rot[i]) % 16);
+    }
+    return p;
+}
+
+//Beta on one nibble: bit i is lane i;
+static unsigned beta(unsigned v)
+{
+    unsigned a0 = v & 1, a1 = (v >> 1) & 1, a2 = (v >> 2) & 1, a3 = (v >> 3) & 1;
+    unsigned b0, b1, b2, b3;
+
+    b0 = 1 ^ a0 ^ a1 ^ a3 ^ (a2 & a3);
+    b1 = a0 ^ (a0 & a1) ^ a2 ^ (a0 & a3) ^ (a1 & a3) ^ (a0 & a1 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3) ^ (a1 & a2 & a3);
+    b2 = a1 ^ a2 ^ (a0 & a2) ^ a3 ^ (a0 & a1 & a3) ^ (a1 & a2 & a3);
+    b3 = a1 ^ (a0 & a1) ^ (a0 & a2) ^ (a0 & a3) ^ (a2 & a3) ^ (a0 & a2 & a3);
+    return b0 | (b1 << 1) | (b2 << 2) | (b3 << 3);
+}
+
+static void gen_init(wb_gen *g, unsigned width)
+{
+    unsigned s, v, o, i, bit;
+
+    g->width = width;
+    g->blocks = 64 / width;
+    g->mask = (uint16_t)((1u << width) - 1);
+    for (s = 0; s < SWAN_WB_NIBBLES; s++)
+    {
+        for (v = 0; v < 16; v++)
+        {
+            o = beta(v);
+            g->contrib[s][v] = 0;
+            for (i = 0; i < 4; i++)
+            {
+                //SwitchLanes: lane i gets the other three lanes;
+                bit = (o ^ (o >> 1) ^ (o >> 2) ^ (o >> 3) ^ (o >> i)) & 1;
+                //bit s of lane i sits in nibble s-rot[i];
+                g->contrib[s][v] |= (uint64_t)bit << (4 * ((s + 16 - wb_rot[i]) % 16) + i);
+            }
+        }
+    }
+}
+
+//n random words that XOR to zero;
+static void zero_sum_masks(wb_rng *r, uint64_t *mask, unsigned n)
+{
+    uint64_t sum = 0;
+    unsigned i;
+
+    for (i = 0; i + 1 < n; i++)
+    {
+        mask[i] = rng_u64(r);
+        sum ^= mask[i];
+    }
+    mask[n - 1] = sum;
+}
+
+static void gen_in(const wb_gen *g, wb_rng *r, const wb_encoding *e, int half, uint64_t *in)
+{
+    uint64_t mask[SWAN_WB_NIBBLES];
+    unsigned n, v;
+
+    zero_sum_masks(r, mask, SWAN_WB_NIBBLES);
+    //the affine constant goes in once, with nibble 0;
+    mask[0] ^= encoding_constant(g, e);
+    for (n = 0; n < SWAN_WB_NIBBLES; n++)
+    {
+        for (v = 0; v < 16; v++)
+            in[(half * SWAN_WB_NIBBLES + n) * 16 + v] =
+                encode_linear(g, e, to_sbox_order((uint64_t)v << (4 * n))) ^ mask[n];
+    }
+}
+
+static void gen_out(const wb_gen *g, wb_rng *r, const wb_encoding *e, int half, uint64_t *out)
+{
+    uint64_t mask[64 / 4];
+    size_t ents = (size_t)1 << g->width;
+    unsigned b, v;
+
+    zero_sum_masks(r, mask, g->blocks);
+    for (b = 0; b < g->blocks; b++)
+    {
+        for (v = 0; v < ents; v++)
+            out[(half * g->blocks + b) * ents + v] =
+                from_sbox_order((uint64_t)decode_block(g, e, b, (uint16_t)v) << (b * g->width)) ^ mask[b];
+    }
+}
+
+//Tables of one half round: y = RE(y) ^ XOR_b T_b[x_b], with x under ex, y from ey to ny;
+static void gen_half_round(const wb_gen *g, wb_rng *r, const uint16_t k[4], const wb_encoding *ex,
+                           const wb_encoding *ey, const wb_encoding *ny, uint64_t *t, void *re)
+{
+    uint64_t mask[64 / 4];
+    uint64_t acc;
+    size_t ents = (size_t)1 << g->width;
+    unsigned nib = g->width / 4;
+    unsigned b, v, q, s, kc, u;
+    uint16_t e;
+
+    zero_sum_masks(r, mask, g->blocks);
+    for (b = 0; b < g->blocks; b++)
+    {
+        for (v = 0; v < ents; v++)
+        {
+            u = decode_block(g, ex, b, (uint16_t)v);
+            acc = 0;
+            for (q = 0; q < nib; q++)
+            {
+                s = b * nib + q;
+                //key bits of S-box s: bit s of each lane;
+                kc = ((k[0] >> s) & 1) | (((k[1] >> s) & 1) << 1) | (((k[2] >> s) & 1) << 2) | (((k[3] >> s) & 1) << 3);
+                acc ^= g->contrib[s][((u >> (4 * q)) & 15) ^ kc];
+            }
+            t[b * ents + v] = encode_linear(g, ny, acc) ^ mask[b];
+            u = decode_block(g, ey, b, (uint16_t)v);
+            e = apply(ny->blk[b].m, g->width, (uint16_t)u) ^ ny->blk[b].c;
+            if (g->width > 8)
+                ((uint16_t *)re)[b * ents + v] = e;
+            else
+                ((uint8_t *)re)[b * ents + v] = (uint8_t)e;
+        }
+    }
+}
+
+//Nibble tables of one half round: S-box s sends bit i of SwitchLanes(Beta()) to y's nibble s-rot[i],
+//so every T entry is one encoded nibble; the four shares of each nibble of y are masked to cancel;
+static void gen_half_round_nibble(const wb_gen *g, wb_rng *r, const uint16_t k[4], const wb_encoding *ex,
+                                  const wb_encoding *ey, const wb_encoding *ny, uint8_t *tn, uint8_t *re)
+{
+    uint64_t mask[SWAN_WB_NIBBLES];
+    unsigned s, v, i, o, kc, u, bit;
+
+    //mask[o] holds the four nibble masks of y's nibble o, by lane;
+    for (o = 0; o < SWAN_WB_NIBBLES; o++)
+    {
+        mask[o] = rng_u64(r) & 0xfff;
+        mask[o] |= ((mask[o] ^ (mask[o] >> 4) ^ (mask[o] >> 8)) & 15) << 12;
+    }
+    for (s = 0; s < SWAN_WB_NIBBLES; s++)
+    {
+        kc = ((k[0] >> s) & 1) | (((k[1] >> s) & 1) << 1) | (((k[2] >> s) & 1) << 2) | (((k[3] >> s) & 1) << 3);
+        for (v = 0; v < 16; v++)
+        {
+            u = decode_block(g, ex, s, (uint16_t)v) ^ kc;
+            for (i = 0; i < 4; i++)
+            {
+                o = (s + 16 - wb_rot[i]) % 16;
+                bit = (unsigned)(g->contrib[s][u] >> (4 * o + i)) & 1;
+                tn[(s * 4 + i) * 16 + v] =
+                    (uint8_t)((apply(ny->blk[o].m, 4, (uint16_t)(bit << i)) ^ (mask[o] >> (4 * i))) & 15);
+            }
+            u = decode_block(g, ey, s, (uint16_t)v);
+            re[s * 16 + v] = (uint8_t)(apply(ny->blk[s].m, 4, (uint16_t)u) ^ ny->blk[s].c);
+        }
+    }
+}
+
+static int read_seed(uint8_t *seed)
+{
+    FILE *f = fopen("/dev/urandom", "rb");
+    int ok;
+
+    if (f == NULL)
+        return -1;
+    ok = fread(seed, SWAN_WB_SEED_BYTES, 1, f) == 1;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+typedef struct wb_plan
+{
+    const wb_gen *g;
+    swan_wb *wb;
+    const uint8_t *seed;
+    const uint16_t *subkeys;
+    //per direction: the initial encodings of L and R, then the one y takes in each half round;
+    //when re-encoding, the deltas applied to them instead;
+    wb_encoding *enc[2];
+    const uint8_t *changed[2]; //re-encoding: which versions get a delta
+    void (*run)(struct wb_plan *p, unsigned job, void *scratch);
+    unsigned jobs; //per direction: the input tables, every half round, the output tables
+    unsigned next;
+    uint8_t *scratch; //scratch_size bytes per worker, allocated before any table is touched
+    size_t scratch_size;
+    unsigned workers;
+} wb_plan;
+
+//Version of the encoding of half h after the half rounds before t;
+static unsigned version_at(int d, unsigned t, unsigned h)
+{
+    //half round t reads half d^(t&1), L first for encryption and R first for decryption, and writes the other;
+    if (t >= 1 && h == ((unsigned)d ^ ((t - 1) & 1) ^ 1))
+        return 2 + t - 1;
+    if (t >= 2)
+        return 2 + t - 2;
+    return h;
+}
+
+static const wb_encoding *encoding_at(const wb_plan *p, int d, unsigned t, unsigned h)
+{
+    return &p->enc[d][version_at(d, t, h)];
+}
+
+static void run_job(wb_plan *p, unsigned job, void *scratch)
+{
+    const wb_gen *g = p->g;
+    swan_wb *wb = p->wb;
+    int d = (int)(job / p->jobs);
+    unsigned j = job % p->jobs;
+    unsigned hr = 2u * wb->rounds;
+    const swan_wb_tables *tb = &wb->tab[d];
+    unsigned t, kidx, x;
+    void *T, *RE;
+    wb_rng r;
+
+    (void)scratch;
+    if (!(wb->dirs & (d == 0 ? SWAN_WB_ENCRYPT : SWAN_WB_DECRYPT)))
+        return;
+    if (j == 0)
+    {
+        rng_init(&r, p->seed, WB_STREAM(WB_STREAM_IN, d, 0));
+        gen_in(g, &r, encoding_at(p, d, 0, 0), 0, (uint64_t *)tb->in);
+        gen_in(g, &r, encoding_at(p, d, 0, 1), 1, (uint64_t *)tb->in);
+    }
+    else if (j <= hr)
+    {
+        t = j - 1;
+        //decryption runs the same half rounds backwards;
+        kidx = d == 0 ? t : hr - 1 - t;
+        x = kidx & 1;
+        rng_init(&r, p->seed, WB_STREAM(WB_STREAM_HALF_ROUND, d, t));
+        T = (void *)swan_wb_step(g->width == 4 ? (const void *)tb->tn : (const void *)tb->t, tb->t_stride, t);
+        RE = (void *)swan_wb_step(tb->re, tb->re_stride, t);
+        if (g->width == 4)
+            gen_half_round_nibble(g, &r, p->subkeys + 4 * kidx, encoding_at(p, d, t, x), encoding_at(p, d, t, x ^ 1),
+                                  &p->enc[d][2 + t], (uint8_t *)T, (uint8_t *)RE);
+        else
+            gen_half_round(g, &r, p->subkeys + 4 * kidx, encoding_at(p, d, t, x), encoding_at(p, d, t, x ^ 1),
+                           &p->enc[d][2 + t], (uint64_t *)T, RE);
+    }
+    else
+    {
+        rng_init(&r, p->seed, WB_STREAM(WB_STREAM_OUT, d, 0));
+        gen_out(g, &r, encoding_at(p, d, hr, 0), 0, (uint64_t *)tb->out);
+        gen_out(g, &r, encoding_at(p, d, hr, 1), 1, (uint64_t *)tb->out);
+    }
+    rng_wipe(&r);
+}
+
+static void *gen_worker(void *arg)
+{
+    wb_plan *p = (wb_plan *)arg;
+    unsigned w = __atomic_fetch_add(&p->workers, 1, __ATOMIC_RELAXED);
+    void *scratch = p->scratch != NULL ? p->scratch + w * p->scratch_size : NULL;
+    unsigned job;
+
+    while ((job = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < 2 * p->jobs)
+        p->run(p, job, scratch);
+    return NULL;
+}
+
+//Draw the encodings, or the deltas of the changed ones, from their streams;
+static int make_encodings(wb_plan *p, int kind)
+{
+    unsigned v, nv = 2 + 2u * p->wb->rounds;
+    wb_rng r;
+    int d;
+
+    for (d = 0; d < 2; d++)
+    {
+        p->enc[d] = (wb_encoding *)calloc(nv, sizeof(wb_encoding));
+        if (p->enc[d] == NULL)
+            return -1;
+        for (v = 0; v < nv; v++)
+        {
+            if (p->changed[d] != NULL && !p->changed[d][v])
+                continue;
+            rng_init(&r, p->seed, WB_STREAM(kind, d, v));
+            random_encoding(p->g, &r, &p->enc[d][v]);
+        }
+    }
+    rng_wipe(&r);
+    return 0;
+}
+
+//Workers for threads, at most one per job and no more than 64;
+static unsigned worker_count(const wb_plan *p, unsigned threads)
+{
+    unsigned jobs = 2 * (2u * p->wb->rounds + 2);
+
+    if (threads > 64)
+        threads = 64;
+    return threads < jobs ? threads : jobs;
+}
+
+//Every job of both directions, the calling thread being one of the workers;
+static void run_jobs(wb_plan *p, unsigned threads)
+{
+    pthread_t tid[64];
+    unsigned i, n = 0;
+
+    p->jobs = 2u * p->wb->rounds + 2;
+    p->next = 0;
+    p->workers = 0;
+    threads = worker_count(p, threads);
+    //the calling thread is one of the workers;
+    for (i = 1; i < threads && i < 2 * p->jobs; i++)
+    {
+        if (pthread_create(&tid[n], NULL, gen_worker, p) != 0)
+            break;
+        n++;
+    }
+    gen_worker(p);
+    for (i = 0; i < n; i++)
+        pthread_join(tid[i], NULL);
+}
+
+static int gen_tables(wb_plan *p, unsigned threads)
+{
+    if (make_encodings(p, WB_STREAM_ENCODING) != 0)
+        return -1;
+    p->run = run_job;
+    run_jobs(p, threads);
+    return 0;
+}
+
+static void free_encodings(wb_plan *p)
+{
+    int d;
+
+    for (d = 0; d < 2; d++)
+    {
+        if (p->enc[d] != NULL)
+            memset(p->enc[d], 0, (2 + 2u * p->wb->rounds) * sizeof(wb_encoding));
+        free(p->enc[d]);
+    }
+}
+
+static unsigned default_threads(unsigned threads)
+{
+    long n;
+
+    if (threads != 0)
+        return threads;
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+swan_wb *swan_wb_generate(const uint8_t *key, uint16_t keysize, const swan_wb_config *cfg)
+{
+    uint8_t seed[SWAN_WB_SEED_BYTES];
+    unsigned threads = cfg != NULL ? cfg->threads : 0;
+    swan_ctx ctx;
+    wb_plan plan;
+    wb_gen g;
+    wb_rng r;
+    swan_wb *wb;
+    int ok;
+
+    if (swan_expand_key(&ctx, BLOCK128, keysize, key) != 0)
+        return NULL;
+    wb = (swan_wb *)calloc(1, sizeof(swan_wb));
+    if (wb == NULL)
+        goto fail;
+    wb->keysize = keysize;
+    wb->rounds = ctx.rounds;
+    wb->width = (uint8_t)swan_wb_config_width(cfg);
+    if (wb->width != 4 && wb->width != 8 && wb->width != 16)
+        goto fail;
+    wb->dirs = cfg != NULL && cfg->dirs != 0 ? cfg->dirs : SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT;
+    wb->writable = 1;
+    wb->layout = cfg != NULL ? (uint8_t)cfg->layout : SWAN_WB_LAYOUT_PLAIN;
+    if (wb->layout > SWAN_WB_LAYOUT_INTERLEAVED)
+        goto fail;
+    wb->size = swan_wb_layout(wb);
+    //the header page is filled in by swan_wb_save(), the padding between sections stays zero;
+    if (swan_wb_alloc(wb, cfg != NULL && cfg->hugepages) != 0)
+        goto fail;
+    swan_wb_layout(wb);
+
+    if (cfg != NULL && cfg->seed != NULL)
+        memcpy(seed, cfg->seed, sizeof(seed));
+    else if (read_seed(seed) != 0)
+        goto fail;
+    rng_init(&r, seed, WB_STREAM(WB_STREAM_ID, 0, 0));
+    wb->encoding_id = rng_u64(&r);
+    rng_wipe(&r);
+
+    gen_init(&g, wb->width);
+    memset(&plan, 0, sizeof(plan));
+    plan.g = &g;
+    plan.wb = wb;
+    plan.seed = seed;
+    plan.subkeys = (const uint16_t *)ctx.subkeys;
+    ok = gen_tables(&plan, default_threads(threads)) == 0;
+    free_encodings(&plan);
+    memset(seed, 0, sizeof(seed));
+    if (!ok)
+        goto fail;
+    wb->checksum = swan_wb_checksum(wb->mem + SWAN_WB_PAGE, wb->size - SWAN_WB_PAGE);
+    memset(&ctx, 0, sizeof(ctx));
+    return wb;
+
+fail:
+    memset(&ctx, 0, sizeof(ctx));
+    swan_wb_free(wb);
+    return NULL;
+}
+
+/*
+ * A delta of the re-encoding with its linear part and inverse as byte-indexed tables,
+ * [block][low byte, then 256 + high byte], so mapping every entry of a 64K-entry table
+ * costs lookups instead of bit-serial matrix products.
+ */
+typedef struct
+{
+    const wb_encoding *e;
+    uint16_t fwd[64 / 4][512];
+    uint16_t inv[64 / 4][512];
+} wb_delta;
+
+static void delta_init(const wb_gen *g, const wb_encoding *e, wb_delta *dl)
+{
+    unsigned lo = g->width > 8 ? 256 : 1u << g->width;
+    unsigned b, v;
+
+    dl->e = e;
+    for (b = 0; b < g->blocks; b++)
+    {
+        for (v = 0; v < lo; v++)
+        {
+            dl->fwd[b][v] = apply(e->blk[b].m, g->width, (uint16_t)v);
+            dl->inv[b][v] = apply(e->blk[b].inv, g->width, (uint16_t)v);
+            dl->fwd[b][256 + v] = g->width > 8 ? apply(e->blk[b].m, g->width, (uint16_t)(v << 8)) : 0;
+            dl->inv[b][256 + v] = g->width > 8 ? apply(e->blk[b].inv, g->width, (uint16_t)(v << 8)) : 0;
+        }
+    }
+}
+
+static inline uint16_t byte_apply(const uint16_t *tab, uint16_t v)
+{
+    return tab[v & 255] ^ tab[256 + (v >> 8)];
+}
+
+//The delta on block b of a value, its inverse, and its linear part on a whole half;
+static inline uint16_t delta_block(const wb_delta *dl, unsigned b, uint16_t v)
+{
+    return byte_apply(dl->fwd[b], v) ^ dl->e->blk[b].c;
+}
+
+static inline uint16_t delta_inverse(const wb_delta *dl, unsigned b, uint16_t v)
+{
+    return byte_apply(dl->inv[b], v ^ dl->e->blk[b].c);
+}
+
+static uint64_t delta_linear(const wb_gen *g, const wb_delta *dl, uint64_t v)
+{
+    uint64_t r = 0;
+    unsigned b;
+
+    for (b = 0; b < g->blocks; b++)
+        r |= (uint64_t)byte_apply(dl->fwd[b], block_of(g, v, b)) << (b * g->width);
+    return r;
+}
+
+static void refresh_in(const wb_gen *g, wb_rng *r, const wb_delta *dl, int half, uint64_t *in)
+{
+    uint64_t mask[SWAN_WB_NIBBLES];
+    uint64_t *e;
+    unsigned n, v;
+
+    //masks that XOR to the delta's constant, so it goes in once;
+    zero_sum_masks(r, mask, SWAN_WB_NIBBLES);
+    mask[0] ^= encoding_constant(g, dl->e);
+    for (n = 0; n < SWAN_WB_NIBBLES; n++)
+    {
+        for (v = 0; v < 16; v++)
+        {
+            e = &in[(half * SWAN_WB_NIBBLES + n) * 16 + v];
+            *e = delta_linear(g, dl, *e) ^ mask[n];
+        }
+    }
+}
+
+static void refresh_out(const wb_gen *g, const wb_delta *dl, int half, uint64_t *out, uint64_t *tmp)
+{
+    size_t ents = (size_t)1 << g->width;
+    uint64_t *tab;
+    unsigned b, v;
+
+    for (b = 0; b < g->blocks; b++)
+    {
+        tab = out + (half * g->blocks + b) * ents;
+        memcpy(tmp, tab, ents * sizeof(uint64_t));
+        for (v = 0; v < ents; v++)
+            tab[v] = tmp[delta_inverse(dl, b, (uint16_t)v)];
+    }
+}
+
+/*
+ * One half round's tables after deltas on x's encoding (dx), on y's old encoding (dy)
+ * and on the encoding it gives y (dn); any of them may be NULL. The inputs are
+ * permuted by the inverse deltas, the outputs mapped through dn with fresh masks.
+ */
+static void refresh_half_round(const wb_gen *g, wb_rng *r, const wb_delta *dx, const wb_delta *dy,
+                               const wb_delta *dn, uint64_t *t, void *re, uint64_t *tmp)
+{
+    uint64_t mask[64 / 4];
+    size_t ents = (size_t)1 << g->width;
+    uint16_t *re16 = (uint16_t *)re, *tmp16 = (uint16_t *)(tmp + ents);
+    uint8_t *re8 = (uint8_t *)re, *tmp8 = (uint8_t *)(tmp + ents);
+    uint16_t e, vx, vy;
+    unsigned b, v;
+
+    if (dn != NULL)
+        zero_sum_masks(r, mask, g->blocks);
+    for (b = 0; b < g->blocks; b++)
+    {
+        memcpy(tmp, t + b * ents, ents * sizeof(uint64_t));
+        memcpy(tmp8, g->width > 8 ? (void *)(re16 + b * ents) : (void *)(re8 + b * ents), ents * (g->width > 8 ? 2 : 1));
+        for (v = 0; v < ents; v++)
+        {
+            vx = dx != NULL ? delta_inverse(dx, b, (uint16_t)v) : (uint16_t)v;
+            vy = dy != NULL ? delta_inverse(dy, b, (uint16_t)v) : (uint16_t)v;
+            t[b * ents + v] = dn != NULL ? delta_linear(g, dn, tmp[vx]) ^ mask[b] : tmp[vx];
+            e = g->width > 8 ? tmp16[vy] : tmp8[vy];
+            if (dn != NULL)
+                e = delta_block(dn, b, e);
+            if (g->width > 8)
+                re16[b * ents + v] = e;
+            else
+                re8[b * ents + v] = (uint8_t)e;
+        }
+    }
+}
+
+//The same for nibble tables: S-box s reads x's nibble s and writes a share of y's nibble s-rot[i];
+static void refresh_half_round_nibble(wb_rng *r, const wb_delta *dx, const wb_delta *dy, const wb_delta *dn,
+                                      uint8_t *tn, uint8_t *re)
+{
+    uint64_t mask[SWAN_WB_NIBBLES];
+    uint8_t tmp[SWAN_WB_TN_BYTES + SWAN_WB_NIBBLES * 16];
+    unsigned s, v, i, o;
+    uint8_t e;
+
+    //the four shares of each nibble of y get masks that cancel, as generated;
+    for (o = 0; dn != NULL && o < SWAN_WB_NIBBLES; o++)
+    {
+        mask[o] = rng_u64(r) & 0xfff;
+        mask[o] |= ((mask[o] ^ (mask[o] >> 4) ^ (mask[o] >> 8)) & 15) << 12;
+    }
+    memcpy(tmp, tn, SWAN_WB_TN_BYTES);
+    memcpy(tmp + SWAN_WB_TN_BYTES, re, SWAN_WB_NIBBLES * 16);
+    for (s = 0; s < SWAN_WB_NIBBLES; s++)
+    {
+        for (v = 0; v < 16; v++)
+        {
+            for (i = 0; i < 4; i++)
+            {
+                o = (s + 16 - wb_rot[i]) % 16;
+                e = tmp[(s * 4 + i) * 16 + (dx != NULL ? delta_inverse(dx, s, (uint16_t)v) : v)];
+                if (dn != NULL)
+                    e = (uint8_t)((dn->fwd[o][e] ^ (mask[o] >> (4 * i))) & 15);
+                tn[(s * 4 + i) * 16 + v] = e;
+            }
+            e = tmp[SWAN_WB_TN_BYTES + s * 16 + (dy != NULL ? delta_inverse(dy, s, (uint16_t)v) : v)];
+            if (dn != NULL)
+                e = (uint8_t)delta_block(dn, s, e);
+            re[s * 16 + v] = e;
+        }
+    }
+}
+
+//Worker scratch: the deltas a job needs, then a block of T and of RE, or of OUT;
+typedef struct
+{
+    wb_delta delta[3];
+    uint64_t tmp[];
+} wb_refresh_scratch;
+
+//The delta of version v in slot k of the scratch, NULL if v keeps its encoding;
+static const wb_delta *delta_of(const wb_plan *p, int d, unsigned v, wb_refresh_scratch *sc, int k)
+{
+    if (!p->changed[d][v])
+        return NULL;
+    delta_init(p->g, &p->enc[d][v], &sc->delta[k]);
+    return &sc->delta[k];
+}
+
+//Job numbering as for run_job();
+static void refresh_job(wb_plan *p, unsigned job, void *scratch)
+{
+    const wb_gen *g = p->g;
+    swan_wb *wb = p->wb;
+    int d = (int)(job / p->jobs);
+    unsigned j = job % p->jobs;
+    unsigned hr = 2u * wb->rounds;
+    const swan_wb_tables *tb = &wb->tab[d];
+    wb_refresh_scratch *sc = (wb_refresh_scratch *)scratch;
+    const wb_delta *dx, *dy, *dn;
+    unsigned t, x, h;
+    wb_rng r;
+
+    if (!(wb->dirs & (d == 0 ? SWAN_WB_ENCRYPT : SWAN_WB_DECRYPT)))
+        return;
+    rng_init(&r, p->seed, WB_STREAM(WB_STREAM_REFRESH, d, j));
+    if (j == 0)
+    {
+        for (h = 0; h < 2; h++)
+        {
+            if ((dn = delta_of(p, d, h, sc, 0)) != NULL)
+                refresh_in(g, &r, dn, (int)h, (uint64_t *)tb->in);
+        }
+    }
+    else if (j <= hr)
+    {
+        t = j - 1;
+        x = (unsigned)d ^ (t & 1);
+        dx = delta_of(p, d, version_at(d, t, x), sc, 0);
+        dy = delta_of(p, d, version_at(d, t, x ^ 1), sc, 1);
+        dn = delta_of(p, d, 2 + t, sc, 2);
+        if (g->width == 4 && (dx != NULL || dy != NULL || dn != NULL))
+            refresh_half_round_nibble(&r, dx, dy, dn, (uint8_t *)swan_wb_step(tb->tn, tb->t_stride, t),
+                                      (uint8_t *)swan_wb_step(tb->re, tb->re_stride, t));
+        else if (dx != NULL || dy != NULL || dn != NULL)
+            refresh_half_round(g, &r, dx, dy, dn, (uint64_t *)swan_wb_step(tb->t, tb->t_stride, t),
+                               (void *)swan_wb_step(tb->re, tb->re_stride, t), sc->tmp);
+    }
+    else
+    {
+        for (h = 0; h < 2; h++)
+        {
+            if ((dx = delta_of(p, d, version_at(d, hr, h), sc, 0)) != NULL)
+                refresh_out(g, dx, (int)h, (uint64_t *)tb->out, sc->tmp);
+        }
+    }
+    rng_wipe(&r);
+}
+
+int swan_wb_refresh(swan_wb *wb, const swan_wb_refresh_config *cfg)
+{
+    uint8_t seed[SWAN_WB_SEED_BYTES];
+    uint8_t *changed;
+    unsigned nv = 2 + 2u * wb->rounds;
+    unsigned dirs = cfg->dirs != 0 ? cfg->dirs : wb->dirs;
+    unsigned last = cfg->rounds != 0 ? cfg->first_round + cfg->rounds : wb->rounds;
+    unsigned v;
+    wb_plan plan;
+    wb_gen g;
+    wb_rng r;
+    int d;
+
+    if (!wb->writable || (dirs & ~wb->dirs) != 0 || cfg->first_round >= wb->rounds || last > wb->rounds)
+        return -1;
+    if (cfg->seed != NULL)
+        memcpy(seed, cfg->seed, sizeof(seed));
+    else if (read_seed(seed) != 0)
+        return -1;
+    changed = (uint8_t *)calloc(2, nv);
+    if (changed == NULL)
+        return -1;
+    //round i produces versions 2+2i and 3+2i; round 0 also takes the two the input tables produce;
+    for (d = 0; d < 2; d++)
+    {
+        if (!(dirs & (d == 0 ? SWAN_WB_ENCRYPT : SWAN_WB_DECRYPT)))
+            continue;
+        for (v = 0; v < nv; v++)
+            changed[d * nv + v] = v >= 2 + 2 * cfg->first_round && v < 2 + 2 * last;
+        if (cfg->first_round == 0)
+            changed[d * nv] = changed[d * nv + 1] = 1;
+    }
+
+    gen_init(&g, wb->width);
+    memset(&plan, 0, sizeof(plan));
+    plan.g = &g;
+    plan.wb = wb;
+    plan.seed = seed;
+    plan.changed[0] = changed;
+    plan.changed[1] = changed + nv;
+    plan.scratch_size = sizeof(wb_refresh_scratch) + ((size_t)1 << wb->width) * (sizeof(uint64_t) + sizeof(uint16_t));
+    plan.scratch = (uint8_t *)malloc(worker_count(&plan, default_threads(cfg->threads)) * plan.scratch_size);
+    if (plan.scratch != NULL && make_encodings(&plan, WB_STREAM_DELTA) == 0)
+    {
+        plan.run = refresh_job;
+        run_jobs(&plan, default_threads(cfg->threads));
+        rng_init(&r, seed, WB_STREAM(WB_STREAM_ID, 1, 0));
+        wb->encoding_id = rng_u64(&r);
+        rng_wipe(&r);
+        wb->checksum = swan_wb_checksum(wb->mem + SWAN_WB_PAGE, wb->size - SWAN_WB_PAGE);
+        d = 0;
+    }
+    else
+        d = -1;
+    free_encodings(&plan);
+    free(plan.scratch);
+    free(changed);
+    memset(seed, 0, sizeof(seed));
+    return d;
+}
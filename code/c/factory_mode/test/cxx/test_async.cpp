@@ -0,0 +1,144 @@
+#include <SWAN_async.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+//swan::encrypt_async() against one swan_crypt() call: buffers of several windows, operations
+//sharing a throttle smaller than their total, and a stop token that cancels one of them;
+#define ASYNC_WINDOW (16 * 1024)
+#define ASYNC_BUDGET (2 * ASYNC_WINDOW)
+#define ASYNC_OPS 6
+
+static std::atomic<int> failures;
+static std::atomic<int> finished;
+
+//Fire-and-forget coroutine, the test waits on finished instead;
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() noexcept
+        {
+        }
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+//Encrypt len bytes asynchronously; whatever part was done, output and iv must match swan_crypt() over it;
+static detached run(const swan::Context &ctx, swan_mode mode, std::size_t len, swan::async_options opts, bool may_cancel)
+{
+    const std::size_t bs = ctx.block_bytes();
+    std::vector<std::uint8_t> in(len), out(len), want(len), iv(bs), want_iv(bs);
+    std::size_t i;
+
+    for (i = 0; i < len; i++)
+        in[i] = static_cast<std::uint8_t>(i * 31 + 5);
+    for (i = 0; i < bs; i++)
+        iv[i] = static_cast<std::uint8_t>(0xF0 + i);
+    want_iv = iv;
+
+    swan::async_result r = co_await swan::encrypt_async(ctx, mode, iv, in, out, opts);
+
+    if (r.status != 0 || r.bytes > len || (r.cancelled && !may_cancel) || (!r.cancelled && r.bytes != len))
+    {
+        std::printf("ASYNC FAILED: mode %d len %zu status %d bytes %zu cancelled %d\n", mode, len, r.status, r.bytes,
+                    r.cancelled);
+        failures++;
+    }
+    else if (swan_crypt(ctx.get(), mode, SWAN_ENCRYPT, want_iv.data(), in.data(), want.data(), r.bytes) != 0 ||
+             std::memcmp(out.data(), want.data(), r.bytes) != 0 || iv != want_iv)
+    {
+        std::printf("ASYNC FAILED: mode %d len %zu differs from swan_crypt() after %zu bytes\n", mode, len, r.bytes);
+        failures++;
+    }
+    finished++;
+}
+
+int main()
+{
+    swan_pool_config cfg = {};
+    std::uint8_t key[32], tweak[32];
+    std::stop_source never, cancel, early;
+    swan::throttle small(ASYNC_BUDGET);
+    swan::async_options opts;
+    std::size_t i;
+    int started = 0;
+
+    for (i = 0; i < sizeof(key); i++)
+    {
+        key[i] = static_cast<std::uint8_t>(i * 29 + 7);
+        tweak[i] = static_cast<std::uint8_t>(i * 17 + 3);
+    }
+    //workers even on one CPU, so the windows really complete on other threads;
+    cfg.threads = 2;
+    if (swan_pool_start(&cfg) != 0)
+    {
+        std::printf("ASYNC FAILED: swan_pool_start\n");
+        return 1;
+    }
+
+    swan::Context c(BLOCK128, KEY256, std::span<const std::uint8_t>(key, KEY256 / 8));
+    swan::Context x(BLOCK256, KEY256, std::span<const std::uint8_t>(key, KEY256 / 8),
+                    std::span<const std::uint8_t>(tweak, KEY256 / 8), 512);
+
+    opts.limit = &small;
+    opts.window = ASYNC_WINDOW;
+    opts.stop = never.get_token();
+
+    //several windows each, more bytes than the throttle admits at once, CTR with a partial tail;
+    for (i = 0; i < ASYNC_OPS; i++)
+    {
+        run(c, SWAN_MODE_CTR, 5 * ASYNC_WINDOW + 16 * i + 7, opts, false);
+        started++;
+    }
+    run(c, SWAN_MODE_CBC, 4 * ASYNC_WINDOW, opts, false);
+    started++;
+    run(x, SWAN_MODE_XTS, 3 * ASYNC_WINDOW + 512, opts, false);
+    started++;
+
+    //cancelled while it runs alone, usually part-way: the check holds wherever it stopped;
+    while (finished.load() < started)
+        std::this_thread::yield();
+    opts.stop = cancel.get_token();
+    run(c, SWAN_MODE_CTR, 256 * ASYNC_WINDOW, opts, true);
+    started++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    cancel.request_stop();
+
+    //cancelled before it starts: nothing is done and the iv is untouched;
+    early.request_stop();
+    opts.stop = early.get_token();
+    run(c, SWAN_MODE_CBC, 2 * ASYNC_WINDOW, opts, true);
+    started++;
+
+    while (finished.load() < started)
+        std::this_thread::yield();
+    if (small.in_flight() != 0)
+    {
+        std::printf("ASYNC FAILED: %zu bytes still reserved\n", small.in_flight());
+        failures++;
+    }
+    swan_pool_stop();
+    if (failures.load() != 0)
+        return 1;
+    std::printf("swan::encrypt_async matches swan_crypt()\n");
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <SWAN.hpp>
+#include <cstdio>
+#include <cstring>
+
+//swan::Cipher<Block, Key> against the *_rounds reference code: single blocks through the
+//unrolled loop, batches on both sides of the scalar/kernel cut-over;
+#define CIPHER_BLOCKS 37
+
+static void ref64_128(const std::uint8_t *key, const std::uint8_t *in, std::uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN64_K128_encrypt_rounds(in, key, ROUNDS64_K128, out);
+    else
+        SWAN64_K128_decrypt_rounds(in, key, ROUNDS64_K128, out);
+}
+
+static void ref64_256(const std::uint8_t *key, const std::uint8_t *in, std::uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN64_K256_encrypt_rounds(in, key, ROUNDS64_K256, out);
+    else
+        SWAN64_K256_decrypt_rounds(in, key, ROUNDS64_K256, out);
+}
+
+static void ref128_128(const std::uint8_t *key, const std::uint8_t *in, std::uint8_t *out, int enc)
+{
+    const std::uint16_t *k = reinterpret_cast<const std::uint16_t *>(key);
+    const std::uint16_t *i = reinterpret_cast<const std::uint16_t *>(in);
+    std::uint16_t *o = reinterpret_cast<std::uint16_t *>(out);
+
+    if (enc)
+        SWAN128_K128_encrypt_rounds(i, k, ROUNDS128_128, o);
+    else
+        SWAN128_K128_decrypt_rounds(i, k, ROUNDS128_128, o);
+}
+
+static void ref128_256(const std::uint8_t *key, const std::uint8_t *in, std::uint8_t *out, int enc)
+{
+    const std::uint16_t *k = reinterpret_cast<const std::uint16_t *>(key);
+    const std::uint16_t *i = reinterpret_cast<const std::uint16_t *>(in);
+    std::uint16_t *o = reinterpret_cast<std::uint16_t *>(out);
+
+    if (enc)
+        SWAN128_K256_encrypt_rounds(i, k, ROUNDS128_256, o);
+    else
+        SWAN128_K256_decrypt_rounds(i, k, ROUNDS128_256, o);
+}
+
+static void ref256_256(const std::uint8_t *key, const std::uint8_t *in, std::uint8_t *out, int enc)
+{
+    const std::uint32_t *k = reinterpret_cast<const std::uint32_t *>(key);
+    const std::uint32_t *i = reinterpret_cast<const std::uint32_t *>(in);
+    std::uint32_t *o = reinterpret_cast<std::uint32_t *>(out);
+
+    if (enc)
+        SWAN256_encrypt_rounds(i, k, ROUNDS256_256, o);
+    else
+        SWAN256_decrypt_rounds(i, k, ROUNDS256_256, o);
+}
+
+static int check(const char *name, const char *what, const std::uint8_t *got, const std::uint8_t *want, std::size_t len)
+{
+    if (std::memcmp(got, want, len) == 0)
+        return 0;
+    std::printf("CIPHER FAILED: %s %s\n", name, what);
+    return 1;
+}
+
+template <unsigned Block, unsigned Key>
+static int cipher(const char *name, void (*ref)(const std::uint8_t *, const std::uint8_t *, std::uint8_t *, int))
+{
+    using C = swan::Cipher<Block, Key>;
+    constexpr std::size_t bs = C::block_bytes;
+    constexpr std::size_t len = CIPHER_BLOCKS * bs;
+    //the reference code reads lanes, keep every buffer lane aligned;
+    alignas(8) std::uint8_t key[C::key_bytes];
+    alignas(8) std::uint8_t plain[len], want[len], got[len], back[len];
+    const std::size_t counts[] = {1, 2, 3, 5, 8, 16, CIPHER_BLOCKS};
+    std::size_t i;
+    int fail = 0;
+
+    for (i = 0; i < sizeof(key); i++)
+        key[i] = static_cast<std::uint8_t>(i * 29 + 7);
+    for (i = 0; i < len; i++)
+        plain[i] = static_cast<std::uint8_t>(i * 13 + 1);
+    for (i = 0; i < CIPHER_BLOCKS; i++)
+        ref(key, plain + i * bs, want + i * bs, 1);
+
+    C c{std::span<const std::uint8_t, C::key_bytes>(key)};
+
+    //single blocks;
+    for (i = 0; i < CIPHER_BLOCKS; i++)
+    {
+        c.encrypt_block(std::span<const std::uint8_t, bs>(plain + i * bs, bs), std::span<std::uint8_t, bs>(got + i * bs, bs));
+        c.decrypt_block(std::span<const std::uint8_t, bs>(want + i * bs, bs), std::span<std::uint8_t, bs>(back + i * bs, bs));
+    }
+    fail += check(name, "encrypt_block", got, want, len);
+    fail += check(name, "decrypt_block", back, plain, len);
+
+    //batches, short ones take the scalar loop and long ones the kernels;
+    for (std::size_t n : counts)
+    {
+        std::memset(got, 0, len);
+        c.encrypt(std::span<const std::uint8_t>(plain, n * bs), std::span<std::uint8_t>(got, n * bs));
+        fail += check(name, "encrypt", got, want, n * bs);
+        c.decrypt(std::span<const std::uint8_t>(got, n * bs), std::span<std::uint8_t>(got, n * bs));
+        fail += check(name, "decrypt in place", got, plain, n * bs);
+    }
+
+    //a partial block is rejected;
+    try
+    {
+        c.encrypt(std::span<const std::uint8_t>(plain, bs + 1), std::span<std::uint8_t>(got, len));
+        std::printf("CIPHER FAILED: %s partial block accepted\n", name);
+        fail++;
+    }
+    catch (const std::invalid_argument &)
+    {
+    }
+    return fail;
+}
+
+int main()
+{
+    int fail = 0;
+
+    fail += cipher<BLOCK64, KEY128>("SWAN64K128", ref64_128);
+    fail += cipher<BLOCK64, KEY256>("SWAN64K256", ref64_256);
+    fail += cipher<BLOCK128, KEY128>("SWAN128K128", ref128_128);
+    fail += cipher<BLOCK128, KEY256>("SWAN128K256", ref128_256);
+    fail += cipher<BLOCK256, KEY256>("SWAN256K256", ref256_256);
+    if (fail != 0)
+        return 1;
+    std::printf("swan::Cipher matches the reference for all variants\n");
+    return 0;
+}
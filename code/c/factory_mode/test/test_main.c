@@ -1,9 +1,13 @@
 #include <SWAN.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "count_cycles.h"
 #define TEST 10000
 
+//known-answer check: blocks, modes and iovec against the *_rounds reference code;
+#define KAT_BLOCKS 37
+
 void dump(const uint8_t *li, int len)
 {
     int line_ctrl = 16;
@@ -23,6 +27,154 @@ void dump(const uint8_t *li, int len)
     }
 }
 
+static void ref64_128(const uint8_t *key, const uint8_t *in, uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN64_K128_encrypt_rounds(in, key, ROUNDS64_K128, out);
+    else
+        SWAN64_K128_decrypt_rounds(in, key, ROUNDS64_K128, out);
+}
+
+static void ref64_256(const uint8_t *key, const uint8_t *in, uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN64_K256_encrypt_rounds(in, key, ROUNDS64_K256, out);
+    else
+        SWAN64_K256_decrypt_rounds(in, key, ROUNDS64_K256, out);
+}
+
+static void ref128_128(const uint8_t *key, const uint8_t *in, uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN128_K128_encrypt_rounds((const uint16_t *)in, (const uint16_t *)key, ROUNDS128_128, (uint16_t *)out);
+    else
+        SWAN128_K128_decrypt_rounds((const uint16_t *)in, (const uint16_t *)key, ROUNDS128_128, (uint16_t *)out);
+}
+
+static void ref128_256(const uint8_t *key, const uint8_t *in, uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN128_K256_encrypt_rounds((const uint16_t *)in, (const uint16_t *)key, ROUNDS128_256, (uint16_t *)out);
+    else
+        SWAN128_K256_decrypt_rounds((const uint16_t *)in, (const uint16_t *)key, ROUNDS128_256, (uint16_t *)out);
+}
+
+static void ref256_256(const uint8_t *key, const uint8_t *in, uint8_t *out, int enc)
+{
+    if (enc)
+        SWAN256_encrypt_rounds((const uint32_t *)in, (const uint32_t *)key, ROUNDS256_256, (uint32_t *)out);
+    else
+        SWAN256_decrypt_rounds((const uint32_t *)in, (const uint32_t *)key, ROUNDS256_256, (uint32_t *)out);
+}
+
+static int check(const char *what, const uint8_t *got, const uint8_t *want, size_t len)
+{
+    if (memcmp(got, want, len) == 0)
+        return 0;
+    printf("KAT FAILED: %s\n", what);
+    return 1;
+}
+
+//One variant: the batch kernels block by block, CBC and CTR through swan_crypt_iov()
+//with segments that split blocks, against the same modes built on the reference code;
+static int kat(uint16_t blocksize, uint16_t keysize,
+               void (*ref)(const uint8_t *, const uint8_t *, uint8_t *, int))
+{
+    size_t bs = blocksize / 8;
+    size_t len = KAT_BLOCKS * bs;
+    size_t ctr_len = len - 11;
+    uint32_t key[8], iv0[8], iv[8], ctr[8];
+    uint32_t plain[KAT_BLOCKS * 8], want[KAT_BLOCKS * 8], got[KAT_BLOCKS * 8], back[KAT_BLOCKS * 8];
+    uint8_t *p = (uint8_t *)plain, *w = (uint8_t *)want, *g = (uint8_t *)got, *b = (uint8_t *)back;
+    struct iovec src[4], dst[3], out[2];
+    swan_ctx ctx;
+    size_t i, j;
+    int fail = 0;
+
+    for (i = 0; i < sizeof(key); i++)
+        ((uint8_t *)key)[i] = (uint8_t)(i * 29 + 7);
+    for (i = 0; i < sizeof(iv0); i++)
+        ((uint8_t *)iv0)[i] = (uint8_t)(0xF0 + i);
+    for (i = 0; i < len; i++)
+        p[i] = (uint8_t)(i * 13 + 1);
+    if (swan_set_key(&ctx, blocksize, keysize, (const uint8_t *)key) != 0)
+    {
+        printf("KAT FAILED: swan_set_key\n");
+        return 1;
+    }
+
+    //ECB through the batch kernels;
+    for (i = 0; i < KAT_BLOCKS; i++)
+        ref((const uint8_t *)key, p + i * bs, w + i * bs, 1);
+    swan_encrypt_blocks(&ctx, p, g, KAT_BLOCKS);
+    fail += check("encrypt_blocks", g, w, len);
+    swan_decrypt_blocks(&ctx, g, b, KAT_BLOCKS);
+    fail += check("decrypt_blocks", b, p, len);
+
+    //segments straddling block boundaries, different on both sides;
+    src[0].iov_base = p;
+    src[0].iov_len = bs / 2 + 1;
+    src[1].iov_base = p + bs / 2 + 1;
+    src[1].iov_len = 3 * bs;
+    src[2].iov_base = p + bs / 2 + 1 + 3 * bs;
+    src[2].iov_len = 5;
+    src[3].iov_base = p + bs / 2 + 6 + 3 * bs;
+    src[3].iov_len = len - (bs / 2 + 6 + 3 * bs);
+    dst[0].iov_base = g;
+    dst[0].iov_len = 2 * bs - 3;
+    dst[1].iov_base = g + 2 * bs - 3;
+    dst[1].iov_len = 7;
+    dst[2].iov_base = g + 2 * bs + 4;
+    dst[2].iov_len = len - (2 * bs + 4);
+
+    //CBC;
+    memcpy(iv, iv0, bs);
+    for (i = 0; i < KAT_BLOCKS; i++)
+    {
+        for (j = 0; j < bs; j++)
+            ((uint8_t *)iv)[j] ^= p[i * bs + j];
+        ref((const uint8_t *)key, (const uint8_t *)iv, w + i * bs, 1);
+        memcpy(iv, w + i * bs, bs);
+    }
+    memcpy(iv, iv0, bs);
+    memset(g, 0, len);
+    if (swan_crypt_iov(&ctx, SWAN_MODE_CBC, SWAN_ENCRYPT, (uint8_t *)iv, src, 4, dst, 3) != 0)
+        fail++;
+    fail += check("cbc iovec encrypt", g, w, len);
+    memcpy(iv, iv0, bs);
+    if (swan_crypt(&ctx, SWAN_MODE_CBC, SWAN_DECRYPT, (uint8_t *)iv, g, b, len) != 0)
+        fail++;
+    fail += check("cbc decrypt", b, p, len);
+
+    //CTR, ending on a partial block;
+    memcpy(ctr, iv0, bs);
+    for (i = 0; i < KAT_BLOCKS; i++)
+    {
+        ref((const uint8_t *)key, (const uint8_t *)ctr, w + i * bs, 1);
+        for (j = bs; j-- > 0 && ++((uint8_t *)ctr)[j] == 0;)
+            ;
+    }
+    for (i = 0; i < ctr_len; i++)
+        w[i] ^= p[i];
+    src[3].iov_len -= len - ctr_len;
+    memcpy(iv, iv0, bs);
+    memset(g, 0, len);
+    if (swan_crypt_iov(&ctx, SWAN_MODE_CTR, SWAN_ENCRYPT, (uint8_t *)iv, src, 4, dst, 3) != 0)
+        fail++;
+    fail += check("ctr iovec encrypt", g, w, ctr_len);
+    dst[2].iov_len -= len - ctr_len;
+    out[0].iov_base = b;
+    out[0].iov_len = bs + 1;
+    out[1].iov_base = b + bs + 1;
+    out[1].iov_len = len - (bs + 1);
+    memcpy(iv, iv0, bs);
+    memset(b, 0, len);
+    if (swan_crypt_iov(&ctx, SWAN_MODE_CTR, SWAN_DECRYPT, (uint8_t *)iv, dst, 3, out, 2) != 0)
+        fail++;
+    fail += check("ctr iovec decrypt", b, p, ctr_len);
+    return fail;
+}
+
 int main()
 {
     uint32_t i; 
@@ -143,5 +295,41 @@ int main()
     ans = (end - begin);
     printf("\nSWAN256k256 decrypt cost %llu CPU cycles\n", (ans) / TEST);
 
+    //swan128_k128 ctr over a fragmented message
+    printf("\n--------------------swan128_k128 ctr iovec--------------------\n");
+    {
+        swan_ctx ctx;
+        uint8_t iv[16] = {0};
+        uint8_t msg[1500];
+        uint8_t enc[1500];
+        struct iovec src[3] = {{msg, 54}, {msg + 54, 1000}, {msg + 1054, 446}};
+        struct iovec dst[2] = {{enc, 700}, {enc + 700, 800}};
+        memset(msg, 0x5A, sizeof(msg));
+        swan_set_key(&ctx, BLOCK128, KEY128, key);
+        begin = start_rdtsc();
+        for (i = 0; i < TEST; i++)
+        {
+            swan_crypt_iov(&ctx, SWAN_MODE_CTR, SWAN_ENCRYPT, iv, src, 3, dst, 2);
+        }
+        end = end_rdtsc();
+        dump(enc, 32);
+        ans = (end - begin);
+        printf("\nSWAN128K128 ctr iovec cost %llu CPU cycles per byte\n", (unsigned long long)((ans) / TEST / sizeof(msg)));
+    }
+
+    //known answers;
+    printf("\n--------------------known answers--------------------\n");
+    {
+        int fail = 0;
+        fail += kat(BLOCK64, KEY128, ref64_128);
+        fail += kat(BLOCK64, KEY256, ref64_256);
+        fail += kat(BLOCK128, KEY128, ref128_128);
+        fail += kat(BLOCK128, KEY256, ref128_256);
+        fail += kat(BLOCK256, KEY256, ref256_256);
+        printf("%s\n", fail ? "FAILED" : "all variants match the reference");
+        if (fail)
+            return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,616 @@
+/*
+ *  swan_file.c
+ *
+ *  Description: swan-file, encrypts or decrypts a file or a pipe with one of the SWAN
+ *  variants. Regular files large enough to pay for it are memory-mapped and handed to
+ *  swan_parallel_crypt() in one call; everything else is streamed through two buffers,
+ *  one filled by a reader thread while the other is encrypted and written out.
+ *  With -a, regular files go through the io_uring pipeline instead of mmap.
+ *  ECB and CBC use PKCS#7 padding unless -n is given.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SWAN.h>
+#include <SWAN_parallel.h>
+#include <SWAN_uring.h>
+
+//bytes per streaming buffer, a multiple of every XTS data unit up to its size;
+#define SWAN_FILE_BUF (4 * 1024 * 1024)
+//room in front of a buffer for the bytes carried over from the previous one;
+#define SWAN_FILE_HEAD (2 * SWAN_MAX_BLOCK_BYTES)
+
+typedef struct
+{
+    swan_ctx ctx;
+    swan_mode mode;
+    int enc;
+    int pad;
+    uint8_t iv[SWAN_MAX_BLOCK_BYTES];
+    size_t bs;
+} swan_file_job;
+
+typedef struct
+{
+    uint8_t *base;
+    uint8_t *data;
+    ssize_t len;
+    int eof;
+    int full;
+} swan_file_slot;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    swan_file_slot slot[2];
+    size_t size;
+    int fd;
+} swan_file_stream;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: swan-file -e|-d -v VARIANT -m MODE -k KEY [options] [in [out]]\n"
+            "  -e, -d      encrypt or decrypt\n"
+            "  -v VARIANT  64-128, 64-256, 128-128, 128-256 or 256-256 (block-key bits)\n"
+            "  -m MODE     ecb, cbc, ctr or xts\n"
+            "  -k KEY      key in hex\n"
+            "  -t KEY      XTS tweak key in hex\n"
+            "  -i IV       IV or initial counter in hex; for XTS the little-endian unit number\n"
+            "  -u BYTES    XTS data unit, default %d\n"
+            "  -j THREADS  worker threads, default one per CPU minus one\n"
+            "  -n          no padding for ECB and CBC\n"
+            "  -a          io_uring pipeline for regular files, mmap if io_uring is unavailable\n"
+            "  -q          do not report throughput\n"
+            "in and out default to stdin and stdout, \"-\" also selects them.\n",
+            SWAN_XTS_UNIT);
+}
+
+static int parse_hex(const char *s, uint8_t *out, size_t len)
+{
+    size_t i;
+    unsigned v;
+
+    if (strlen(s) != 2 * len)
+        return -1;
+    for (i = 0; i < len; i++)
+    {
+        if (sscanf(s + 2 * i, "%2x", &v) != 1)
+            return -1;
+        out[i] = (uint8_t)v;
+    }
+    return 0;
+}
+
+static int parse_mode(const char *s, swan_mode *mode)
+{
+    if (strcmp(s, "ecb") == 0)
+        *mode = SWAN_MODE_ECB;
+    else if (strcmp(s, "cbc") == 0)
+        *mode = SWAN_MODE_CBC;
+    else if (strcmp(s, "ctr") == 0)
+        *mode = SWAN_MODE_CTR;
+    else if (strcmp(s, "xts") == 0)
+        *mode = SWAN_MODE_XTS;
+    else
+        return -1;
+    return 0;
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static ssize_t read_full(int fd, uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+        n = read(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+//Length of the PKCS#7 padding ending block, or -1 if it is malformed;
+static int unpad_len(const uint8_t *block, size_t bs)
+{
+    size_t i;
+    uint8_t p = block[bs - 1];
+
+    if (p == 0 || p > bs)
+        return -1;
+    for (i = bs - p; i < bs; i++)
+    {
+        if (block[i] != p)
+            return -1;
+    }
+    return p;
+}
+
+//Encrypt or decrypt a regular file through two shared mappings; returns bytes written or -1;
+static long long map_file(swan_file_job *job, int in_fd, size_t len, int out_fd)
+{
+    size_t bs = job->bs;
+    size_t full = len, out_len = len;
+    uint8_t *in = NULL, *out = NULL;
+    uint8_t block[SWAN_MAX_BLOCK_BYTES];
+    int p;
+    long long ret = -1;
+
+    if (job->pad && job->enc)
+    {
+        full = len - len % bs;
+        out_len = full + bs;
+    }
+    else if (job->mode != SWAN_MODE_CTR && len % bs != 0)
+    {
+        fprintf(stderr, "swan-file: input is not a whole number of blocks\n");
+        return -1;
+    }
+
+    in = (uint8_t *)mmap(NULL, len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (in == MAP_FAILED || ftruncate(out_fd, (off_t)out_len) != 0)
+    {
+        perror("swan-file");
+        goto out;
+    }
+    out = (uint8_t *)mmap(NULL, out_len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if (out == MAP_FAILED)
+    {
+        perror("swan-file");
+        goto out;
+    }
+    madvise(in, len, MADV_SEQUENTIAL);
+
+    if (swan_parallel_crypt(&job->ctx, job->mode, job->enc, job->iv, in, out, full) != 0)
+        goto out;
+    ret = (long long)out_len;
+    if (job->pad && job->enc)
+    {
+        memcpy(block, in + full, len - full);
+        memset(block + (len - full), (int)(bs - (len - full)), bs - (len - full));
+        swan_crypt(&job->ctx, job->mode, 1, job->iv, block, out + full, bs);
+    }
+    else if (job->pad)
+    {
+        p = len > 0 ? unpad_len(out + len - bs, bs) : -1;
+        if (p < 0)
+        {
+            fprintf(stderr, "swan-file: bad padding\n");
+            ret = -1;
+            goto out;
+        }
+        ret = (long long)(len - (size_t)p);
+    }
+
+out:
+    if (out != NULL && out != MAP_FAILED)
+        munmap(out, out_len);
+    if (in != NULL && in != MAP_FAILED)
+        munmap(in, len);
+    if (ret >= 0 && (size_t)ret != out_len && ftruncate(out_fd, (off_t)ret) != 0)
+        ret = -1;
+    return ret;
+}
+
+//Same as map_file() through swan_uring_crypt(); returns -2 if io_uring cannot be used;
+static long long uring_file(swan_file_job *job, int in_fd, size_t len, int out_fd)
+{
+    size_t bs = job->bs;
+    size_t full = len;
+    uint8_t block[SWAN_MAX_BLOCK_BYTES];
+    int p;
+
+    //CBC encryption is a single chain, the pipeline cannot overlap it;
+    if (job->mode == SWAN_MODE_CBC && job->enc)
+        return -2;
+    if (job->pad && job->enc)
+        full = len - len % bs;
+    else if (job->mode != SWAN_MODE_CTR && len % bs != 0)
+    {
+        fprintf(stderr, "swan-file: input is not a whole number of blocks\n");
+        return -1;
+    }
+    if (swan_uring_crypt(&job->ctx, job->mode, job->enc, job->iv, in_fd, out_fd, full, NULL) != 0)
+    {
+        if (errno == ENOSYS)
+            return -2;
+        perror("swan-file");
+        return -1;
+    }
+
+    if (job->pad && job->enc)
+    {
+        if (pread(in_fd, block, len - full, (off_t)full) != (ssize_t)(len - full))
+            return -1;
+        memset(block + (len - full), (int)(bs - (len - full)), bs - (len - full));
+        swan_crypt(&job->ctx, job->mode, 1, job->iv, block, block, bs);
+        if (pwrite(out_fd, block, bs, (off_t)full) != (ssize_t)bs)
+            return -1;
+        return (long long)(full + bs);
+    }
+    if (job->pad)
+    {
+        p = len > 0 && pread(out_fd, block, bs, (off_t)(len - bs)) == (ssize_t)bs ? unpad_len(block, bs) : -1;
+        if (p < 0)
+        {
+            fprintf(stderr, "swan-file: bad padding\n");
+            return -1;
+        }
+        if (ftruncate(out_fd, (off_t)(len - (size_t)p)) != 0)
+            return -1;
+        return (long long)(len - (size_t)p);
+    }
+    return (long long)len;
+}
+
+static void *stream_reader(void *arg)
+{
+    swan_file_stream *s = (swan_file_stream *)arg;
+    swan_file_slot *slot;
+    int i = 0;
+
+    while (1)
+    {
+        slot = &s->slot[i];
+        pthread_mutex_lock(&s->lock);
+        while (slot->full)
+        {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        //read without the lock, the consumer is busy with the other slot;
+        slot->len = read_full(s->fd, slot->data, s->size);
+        slot->eof = slot->len < (ssize_t)s->size;
+
+        pthread_mutex_lock(&s->lock);
+        slot->full = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        if (slot->eof)
+            break;
+        i ^= 1;
+    }
+    return NULL;
+}
+
+//Stream in_fd to out_fd with double buffering; returns bytes written or -1;
+static long long stream_file(swan_file_job *job, int in_fd, int out_fd)
+{
+    size_t bs = job->bs;
+    size_t n, proc, keep;
+    size_t carried = 0;
+    uint8_t carry[SWAN_FILE_HEAD];
+    uint8_t *p;
+    long long written = 0;
+    int i = 0, eof = 0, pad, err = 0;
+    swan_file_stream s;
+    swan_file_slot *slot;
+    pthread_t reader;
+
+    memset(&s, 0, sizeof(s));
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+    s.fd = in_fd;
+    s.size = SWAN_FILE_BUF;
+    for (i = 0; i < 2; i++)
+    {
+        //a spare block at the end takes the padding block;
+        s.slot[i].base = (uint8_t *)malloc(SWAN_FILE_HEAD + SWAN_FILE_BUF + SWAN_MAX_BLOCK_BYTES);
+        if (s.slot[i].base == NULL)
+            return -1;
+        s.slot[i].data = s.slot[i].base + SWAN_FILE_HEAD;
+    }
+    if (pthread_create(&reader, NULL, stream_reader, &s) != 0)
+        return -1;
+
+    i = 0;
+    while (!eof && !err)
+    {
+        slot = &s.slot[i];
+        pthread_mutex_lock(&s.lock);
+        while (!slot->full)
+        {
+            pthread_cond_wait(&s.cond, &s.lock);
+        }
+        pthread_mutex_unlock(&s.lock);
+
+        eof = slot->eof;
+        if (slot->len < 0)
+        {
+            perror("swan-file: read");
+            err = 1;
+            break;
+        }
+        p = slot->data - carried;
+        memcpy(p, carry, carried);
+        n = carried + (size_t)slot->len;
+
+        //only whole blocks go through until the end, so counters and chains stay aligned;
+        proc = eof && job->mode == SWAN_MODE_CTR ? n : n - n % bs;
+        //a padded decryption keeps its last block back until it is known to be the last;
+        if (!eof && job->pad && !job->enc)
+            proc = proc >= bs ? proc - bs : 0;
+        if (eof && proc != n && !(job->pad && job->enc))
+        {
+            fprintf(stderr, "swan-file: input is not a whole number of blocks\n");
+            err = 1;
+            break;
+        }
+
+        keep = proc;
+        if (swan_parallel_crypt(&job->ctx, job->mode, job->enc, job->iv, p, p, proc) != 0)
+            err = 1;
+        if (eof && job->pad && job->enc)
+        {
+            memset(p + n, (int)(bs - (n - proc)), bs - (n - proc));
+            swan_crypt(&job->ctx, job->mode, 1, job->iv, p + proc, p + proc, bs);
+            keep = proc + bs;
+        }
+        else if (eof && job->pad)
+        {
+            pad = proc >= bs ? unpad_len(p + proc - bs, bs) : -1;
+            if (pad < 0)
+            {
+                fprintf(stderr, "swan-file: bad padding\n");
+                err = 1;
+                break;
+            }
+            keep = proc - (size_t)pad;
+        }
+        if (!err && write_all(out_fd, p, keep) != 0)
+        {
+            perror("swan-file: write");
+            err = 1;
+        }
+        written += (long long)keep;
+        carried = n - proc;
+        memcpy(carry, p + proc, carried);
+
+        pthread_mutex_lock(&s.lock);
+        slot->full = 0;
+        pthread_cond_broadcast(&s.cond);
+        pthread_mutex_unlock(&s.lock);
+        i ^= 1;
+    }
+
+    //on an error the reader may still wait for a slot, free both before joining;
+    pthread_mutex_lock(&s.lock);
+    s.slot[0].full = s.slot[1].full = 0;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.lock);
+    if (err)
+        pthread_cancel(reader);
+    pthread_join(reader, NULL);
+    free(s.slot[0].base);
+    free(s.slot[1].base);
+    memset(carry, 0, sizeof(carry));
+    return err ? -1 : written;
+}
+
+int main(int argc, char **argv)
+{
+    swan_file_job job;
+    swan_pool_config cfg;
+    unsigned blocksize = 0, keysize = 0;
+    const char *key_hex = NULL, *tweak_hex = NULL, *iv_hex = NULL;
+    const char *in_path = "-", *out_path = "-";
+    uint8_t key[KEY256 / 8], tweak[KEY256 / 8];
+    uint32_t unit = SWAN_XTS_UNIT;
+    int opt, quiet = 0, have_mode = 0, use_uring = 0, in_fd = 0, out_fd = 1, ret;
+    const char *path = "stream";
+    struct stat in_st, out_st;
+    long long written;
+    double t0, t;
+
+    memset(&job, 0, sizeof(job));
+    memset(&cfg, 0, sizeof(cfg));
+    job.enc = -1;
+    job.pad = 1;
+    while ((opt = getopt(argc, argv, "edv:m:k:t:i:u:j:naqh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'e':
+        case 'd':
+            job.enc = opt == 'e' ? SWAN_ENCRYPT : SWAN_DECRYPT;
+            break;
+        case 'v':
+            if (sscanf(optarg, "%u-%u", &blocksize, &keysize) != 2)
+                blocksize = 0;
+            break;
+        case 'm':
+            if (parse_mode(optarg, &job.mode) != 0)
+            {
+                fprintf(stderr, "swan-file: unknown mode %s\n", optarg);
+                return 1;
+            }
+            have_mode = 1;
+            break;
+        case 'k':
+            key_hex = optarg;
+            break;
+        case 't':
+            tweak_hex = optarg;
+            break;
+        case 'i':
+            iv_hex = optarg;
+            break;
+        case 'u':
+            unit = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            cfg.threads = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            job.pad = 0;
+            break;
+        case 'a':
+            use_uring = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (job.enc < 0 || !have_mode || key_hex == NULL || argc - optind > 2)
+    {
+        usage();
+        return 1;
+    }
+    if (optind < argc)
+        in_path = argv[optind];
+    if (optind + 1 < argc)
+        out_path = argv[optind + 1];
+
+    if (keysize != KEY128 && keysize != KEY256)
+    {
+        fprintf(stderr, "swan-file: unknown variant, use -v 64-128, 64-256, 128-128, 128-256 or 256-256\n");
+        return 1;
+    }
+    if (parse_hex(key_hex, key, keysize / 8) != 0)
+    {
+        fprintf(stderr, "swan-file: key must be %u hex digits\n", keysize / 4);
+        return 1;
+    }
+    if (job.mode == SWAN_MODE_XTS)
+    {
+        if (tweak_hex == NULL || parse_hex(tweak_hex, tweak, keysize / 8) != 0 ||
+            swan_set_xts_key(&job.ctx, blocksize, keysize, key, tweak, unit) != 0 || SWAN_FILE_BUF % unit != 0)
+        {
+            fprintf(stderr, "swan-file: XTS needs a -t tweak key and a data unit dividing %d\n", SWAN_FILE_BUF);
+            return 1;
+        }
+    }
+    else if (swan_set_key(&job.ctx, blocksize, keysize, key) != 0)
+    {
+        fprintf(stderr, "swan-file: unknown variant, use -v 64-128, 64-256, 128-128, 128-256 or 256-256\n");
+        return 1;
+    }
+    memset(key, 0, sizeof(key));
+    memset(tweak, 0, sizeof(tweak));
+    job.bs = swan_block_bytes(&job.ctx);
+    if (job.mode == SWAN_MODE_CTR || job.mode == SWAN_MODE_XTS)
+        job.pad = 0;
+    if (iv_hex != NULL && parse_hex(iv_hex, job.iv, job.bs) != 0)
+    {
+        fprintf(stderr, "swan-file: IV must be %u hex digits\n", (unsigned)job.bs * 2);
+        return 1;
+    }
+    if (iv_hex == NULL && (job.mode == SWAN_MODE_CBC || job.mode == SWAN_MODE_CTR))
+    {
+        fprintf(stderr, "swan-file: %s needs an IV (-i)\n", job.mode == SWAN_MODE_CBC ? "CBC" : "CTR");
+        return 1;
+    }
+
+    if (strcmp(in_path, "-") != 0 && (in_fd = open(in_path, O_RDONLY)) < 0)
+    {
+        perror(in_path);
+        return 1;
+    }
+    //no O_TRUNC: the output may turn out to be the input, truncate it after the check below;
+    if (strcmp(out_path, "-") != 0 && (out_fd = open(out_path, O_RDWR | O_CREAT, 0644)) < 0)
+    {
+        perror(out_path);
+        return 1;
+    }
+    if (fstat(in_fd, &in_st) != 0 || fstat(out_fd, &out_st) != 0)
+    {
+        perror("swan-file");
+        return 1;
+    }
+    if (S_ISREG(in_st.st_mode) && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino)
+    {
+        fprintf(stderr, "swan-file: input and output are the same file\n");
+        return 1;
+    }
+    if (strcmp(out_path, "-") != 0 && S_ISREG(out_st.st_mode) && ftruncate(out_fd, 0) != 0)
+    {
+        perror(out_path);
+        return 1;
+    }
+    if (swan_pool_start(&cfg) != 0)
+        fprintf(stderr, "swan-file: could not start every worker thread\n");
+
+    t0 = seconds();
+    //mapping pays off once the file is large enough for the pool to split it; a shared
+    //writable mapping needs the output open for reading too, which a shell redirect is not;
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode) && (fcntl(out_fd, F_GETFL) & O_ACCMODE) == O_RDWR &&
+        (size_t)in_st.st_size >= SWAN_PARALLEL_THRESHOLD)
+    {
+        written = -2;
+        if (use_uring)
+        {
+            path = "io_uring";
+            written = uring_file(&job, in_fd, (size_t)in_st.st_size, out_fd);
+        }
+        if (written == -2)
+        {
+            path = "mmap";
+            written = map_file(&job, in_fd, (size_t)in_st.st_size, out_fd);
+        }
+    }
+    else
+    {
+        written = stream_file(&job, in_fd, out_fd);
+    }
+    t = seconds() - t0;
+    ret = written < 0;
+
+    if (!ret && !quiet)
+    {
+        fprintf(stderr, "swan-file: %lld bytes in %.3f s, %.1f MB/s (%s, %u threads)\n", written, t,
+                t > 0 ? (double)written / t / 1e6 : 0.0, path, swan_pool_threads());
+    }
+    swan_pool_stop();
+    memset(&job, 0, sizeof(job));
+    if (out_fd != 1 && close(out_fd) != 0)
+        ret = 1;
+    if (in_fd != 0)
+        close(in_fd);
+    return ret;
+}
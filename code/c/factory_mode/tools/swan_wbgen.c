@@ -0,0 +1,439 @@
+/*
+ *  swan_wbgen.c
+ *
+ *  Description: swan-wbgen, turns a SWAN128 key into a white-box table file. The tables
+ *  are checked against the reference cipher before they are written. With -c it checks
+ *  an existing table file against the checksum in its header instead, and with -T it
+ *  reports the predicted and measured cost of every cache tier and table layout for
+ *  the key. With -r it re-encodes the tables of an existing file in place, which needs
+ *  neither the key nor the seed the file was generated from. -p publishes a table file
+ *  in the shared memory registry and prints the ID workers attach to, -u removes it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SWAN_WBGEN_TSC
+#endif
+#include <SWAN.h>
+#include <SWAN_wb.h>
+
+//blocks compared against the reference cipher;
+#define SWAN_WBGEN_CHECK 4096
+//blocks per timed run of the -T report, and runs;
+#define SWAN_WBGEN_BENCH 16384
+#define SWAN_WBGEN_RUNS 7
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: swan-wbgen -k KEY -o FILE [options]\n"
+            "       swan-wbgen -c FILE\n"
+            "       swan-wbgen -T [-k KEY]\n"
+            "       swan-wbgen -r FILE [-R FIRST[:COUNT]] [-s SEED] [-e|-d]\n"
+            "       swan-wbgen -p FILE | -u ID\n"
+            "  -k KEY   SWAN128 key in hex, 128 or 256 bits\n"
+            "  -o FILE  where to write the tables; - publishes them in shared memory instead\n"
+            "  -s SEED  %d-byte generator seed in hex, for reproducible tables; random by default\n"
+            "  -e, -d   encryption or decryption tables only; both by default\n"
+            "  -j N     generator threads, default one per CPU; the tables do not depend on it\n"
+            "  -w BITS  encoded block width: 4 (nibble tables run with PSHUFB), 8 or 16; default 8\n"
+            "  -t TIER  cache budget instead of -w: l1 (4-bit), l2 (8-bit) or unlimited (16-bit)\n"
+            "  -i       interleaved layout: each half round's tables together, prefetched a half round ahead\n"
+            "  -H       keep the generated tables on 2 MiB pages\n"
+            "  -T       report predicted and measured cycles per block of every tier and layout\n"
+            "  -c FILE  check the tables in a table file against its checksum\n"
+            "  -r FILE  re-encode the tables in a table file in place; no process may use them meanwhile\n"
+            "  -R FIRST[:COUNT]  with -r, re-encode only the encodings of rounds FIRST.. (COUNT of them); all by default\n"
+            "  -p FILE  publish a table file in shared memory and print the ID to attach to\n"
+            "  -u ID    remove published tables from shared memory\n"
+            "  -q       do not report\n",
+            SWAN_WB_SEED_BYTES);
+}
+
+static int parse_hex(const char *s, uint8_t *out, size_t len)
+{
+    size_t i;
+    unsigned v;
+
+    if (strlen(s) != 2 * len)
+        return -1;
+    for (i = 0; i < len; i++)
+    {
+        if (sscanf(s + 2 * i, "%2x", &v) != 1)
+            return -1;
+        out[i] = (uint8_t)v;
+    }
+    return 0;
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char *const backend_name[] = {"auto", "scalar", "SSSE3", "AVX2"};
+static const char *const tier_name[] = {"", "l1", "l2", "unlimited"};
+static const char *const level_name[] = {"", "L1", "L2", "L3", "memory"};
+
+//Compare the tables with swan_encrypt_blocks()/swan_decrypt_blocks() on random blocks;
+static int check(const swan_wb *wb, const swan_ctx *ctx, unsigned dirs, double *ns)
+{
+    size_t len = SWAN_WBGEN_CHECK * (BLOCK128 / 8);
+    uint8_t *plain = (uint8_t *)malloc(len);
+    uint8_t *ref = (uint8_t *)malloc(len);
+    uint8_t *out = (uint8_t *)malloc(len);
+    double t;
+    size_t i;
+    int ok = plain != NULL && ref != NULL && out != NULL;
+
+    for (i = 0; ok && i < len; i++)
+        plain[i] = (uint8_t)rand();
+    if (ok)
+        swan_encrypt_blocks(ctx, plain, ref, SWAN_WBGEN_CHECK);
+    if (ok && (dirs & SWAN_WB_ENCRYPT))
+    {
+        t = seconds();
+        swan_wb_encrypt(wb, plain, out, SWAN_WBGEN_CHECK);
+        *ns = (seconds() - t) * 1e9 / SWAN_WBGEN_CHECK;
+        ok = memcmp(out, ref, len) == 0;
+    }
+    if (ok && (dirs & SWAN_WB_DECRYPT))
+    {
+        t = seconds();
+        swan_wb_decrypt(wb, ref, out, SWAN_WBGEN_CHECK);
+        if (!(dirs & SWAN_WB_ENCRYPT))
+            *ns = (seconds() - t) * 1e9 / SWAN_WBGEN_CHECK;
+        ok = memcmp(out, plain, len) == 0;
+    }
+    free(plain);
+    free(ref);
+    free(out);
+    return ok ? 0 : -1;
+}
+
+//Cycles per block of swan_wb_encrypt(), best of a few runs over warm tables;
+static double cycles_per_block(const swan_wb *wb, double *ns)
+{
+    size_t len = SWAN_WBGEN_BENCH * (BLOCK128 / 8);
+    uint8_t *buf = (uint8_t *)malloc(len);
+    double best = 0, best_ns = 0, t, c;
+    size_t i;
+    int run;
+
+    *ns = 0;
+    if (buf == NULL)
+        return 0;
+    //random blocks, or every block would hit the same entries;
+    for (i = 0; i < len; i++)
+        buf[i] = (uint8_t)rand();
+    swan_wb_encrypt(wb, buf, buf, SWAN_WBGEN_BENCH);
+    for (run = 0; run < SWAN_WBGEN_RUNS; run++)
+    {
+        t = seconds();
+#ifdef SWAN_WBGEN_TSC
+        c = (double)__rdtsc();
+        swan_wb_encrypt(wb, buf, buf, SWAN_WBGEN_BENCH);
+        c = ((double)__rdtsc() - c) / SWAN_WBGEN_BENCH;
+#else
+        swan_wb_encrypt(wb, buf, buf, SWAN_WBGEN_BENCH);
+        c = 0;
+#endif
+        t = (seconds() - t) * 1e9 / SWAN_WBGEN_BENCH;
+        if (run == 0 || t < best_ns)
+        {
+            best_ns = t;
+            best = c;
+        }
+    }
+    free(buf);
+    *ns = best_ns;
+    return best;
+}
+
+//Generate encryption tables of every tier and layout for the key and time them against the model;
+static int report_tiers(const uint8_t *key, uint16_t keysize, unsigned threads)
+{
+    //plain, interleaved with prefetch, and interleaved on hugepages;
+    static const char *const layout_name[] = {"plain", "interleaved", "+hugepages"};
+    uint8_t seed[SWAN_WB_SEED_BYTES];
+    swan_wb_config cfg;
+    swan_wb_estimate est;
+    swan_wb *wb;
+    double cycles, ns;
+    int tier, layout;
+
+    //one seed for all of them, so the layouts hold the same tables;
+    for (tier = 0; tier < SWAN_WB_SEED_BYTES; tier++)
+        seed[tier] = (uint8_t)rand();
+    printf("%-10s %5s %-12s %12s %7s %10s %10s %10s\n", "tier", "width", "layout", "bytes", "fits", "predicted",
+           "measured", "ns/block");
+    for (tier = SWAN_WB_TIER_L1; tier <= SWAN_WB_TIER_UNLIMITED; tier++)
+    {
+        for (layout = 0; layout < 3; layout++)
+        {
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.dirs = SWAN_WB_ENCRYPT;
+            cfg.seed = seed;
+            cfg.threads = threads;
+            cfg.tier = (swan_wb_tier)tier;
+            cfg.layout = layout > 0 ? SWAN_WB_LAYOUT_INTERLEAVED : SWAN_WB_LAYOUT_PLAIN;
+            cfg.hugepages = layout == 2;
+            if (swan_wb_estimate_config(keysize, &cfg, &est) != 0 || (wb = swan_wb_generate(key, keysize, &cfg)) == NULL)
+            {
+                fprintf(stderr, "swan-wbgen: cannot generate the %s tier\n", tier_name[tier]);
+                return 1;
+            }
+            cycles = cycles_per_block(wb, &ns);
+            printf("%-10s %5u %-12s %12zu %7s %10.0f %10.0f %10.0f\n", tier_name[tier], est.width, layout_name[layout],
+                   est.bytes, level_name[est.level], est.cycles, cycles, ns);
+            swan_wb_free(wb);
+        }
+    }
+    return 0;
+}
+
+static int check_file(const char *path)
+{
+    swan_wb *wb = swan_wb_load(path);
+    int ok;
+
+    if (wb == NULL)
+    {
+        fprintf(stderr, "swan-wbgen: %s is not a table file this build can use\n", path);
+        return 1;
+    }
+    ok = swan_wb_verify(wb) == 0;
+    printf("%s: %zu bytes, tables %s\n", path, swan_wb_size(wb), ok ? "intact" : "CORRUPT");
+    swan_wb_free(wb);
+    return ok ? 0 : 1;
+}
+
+static int publish(const swan_wb *wb)
+{
+    if (swan_wb_publish(wb) != 0)
+    {
+        perror("swan-wbgen: cannot publish the tables");
+        return 1;
+    }
+    printf("%016" PRIx64 "\n", swan_wb_id(wb));
+    return 0;
+}
+
+static int publish_file(const char *path)
+{
+    swan_wb *wb = swan_wb_load(path);
+    int r;
+
+    if (wb == NULL || swan_wb_verify(wb) != 0)
+    {
+        fprintf(stderr, "swan-wbgen: %s is not an intact table file this build can use\n", path);
+        swan_wb_free(wb);
+        return 1;
+    }
+    r = publish(wb);
+    swan_wb_free(wb);
+    return r;
+}
+
+static int unpublish(const char *id_hex)
+{
+    char *end;
+    uint64_t id = strtoull(id_hex, &end, 16);
+
+    if (*end != '\0' || end == id_hex || swan_wb_unpublish(id) != 0)
+    {
+        fprintf(stderr, "swan-wbgen: no tables are published as %s\n", id_hex);
+        return 1;
+    }
+    return 0;
+}
+
+static int refresh_file(const char *path, const swan_wb_refresh_config *rc)
+{
+    double t = seconds();
+
+    if (swan_wb_refresh_file(path, rc) != 0)
+    {
+        fprintf(stderr, "swan-wbgen: cannot re-encode %s\n", path);
+        return 1;
+    }
+    t = seconds() - t;
+    printf("%s: re-encoded in %.2f s\n", path, t);
+    return check_file(path);
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t key[KEY256 / 8];
+    uint8_t seed[SWAN_WB_SEED_BYTES];
+    const char *key_hex = NULL;
+    const char *path = NULL;
+    const char *refresh_path = NULL;
+    swan_wb_refresh_config rc;
+    char *end;
+    swan_wb_config cfg;
+    swan_ctx ctx;
+    swan_wb *wb;
+    uint16_t keysize;
+    swan_wb_backend best;
+    int b;
+    double t, ns = 0;
+    int quiet = 0, report = 0;
+    int opt;
+
+    memset(&cfg, 0, sizeof(cfg));
+    memset(&rc, 0, sizeof(rc));
+    while ((opt = getopt(argc, argv, "k:o:s:c:r:R:p:u:j:w:t:iHTedqh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            return check_file(optarg);
+        case 'p':
+            return publish_file(optarg);
+        case 'u':
+            return unpublish(optarg);
+        case 'r':
+            refresh_path = optarg;
+            break;
+        case 'R':
+            rc.first_round = (unsigned)strtoul(optarg, &end, 10);
+            if (*end == ':')
+                rc.rounds = (unsigned)strtoul(end + 1, &end, 10);
+            if (*end != '\0' || end == optarg)
+            {
+                fprintf(stderr, "swan-wbgen: the rounds are FIRST or FIRST:COUNT\n");
+                return 2;
+            }
+            break;
+        case 'k':
+            key_hex = optarg;
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        case 's':
+            if (parse_hex(optarg, seed, sizeof(seed)) != 0)
+            {
+                fprintf(stderr, "swan-wbgen: the seed must be %d hex bytes\n", SWAN_WB_SEED_BYTES);
+                return 2;
+            }
+            cfg.seed = seed;
+            break;
+        case 'j':
+            cfg.threads = (unsigned)atoi(optarg);
+            break;
+        case 'w':
+            cfg.width = (unsigned)atoi(optarg);
+            break;
+        case 't':
+            for (b = SWAN_WB_TIER_L1; b <= SWAN_WB_TIER_UNLIMITED && strcmp(optarg, tier_name[b]) != 0; b++)
+                ;
+            if (b > SWAN_WB_TIER_UNLIMITED)
+            {
+                fprintf(stderr, "swan-wbgen: the tier is l1, l2 or unlimited\n");
+                return 2;
+            }
+            cfg.tier = (swan_wb_tier)b;
+            break;
+        case 'i':
+            cfg.layout = SWAN_WB_LAYOUT_INTERLEAVED;
+            break;
+        case 'H':
+            cfg.hugepages = 1;
+            break;
+        case 'T':
+            report = 1;
+            break;
+        case 'e':
+            cfg.dirs |= SWAN_WB_ENCRYPT;
+            break;
+        case 'd':
+            cfg.dirs |= SWAN_WB_DECRYPT;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (refresh_path != NULL && optind == argc)
+    {
+        rc.dirs = cfg.dirs;
+        rc.seed = cfg.seed;
+        rc.threads = cfg.threads;
+        return refresh_file(refresh_path, &rc);
+    }
+    if ((key_hex == NULL && !report) || (path == NULL && !report) || optind != argc)
+    {
+        usage();
+        return 2;
+    }
+    //the report times the tables, any key will do;
+    if (key_hex == NULL)
+        key_hex = "000102030405060708090a0b0c0d0e0f";
+    keysize = (uint16_t)(strlen(key_hex) * 4);
+    if ((keysize != KEY128 && keysize != KEY256) || parse_hex(key_hex, key, keysize / 8) != 0)
+    {
+        fprintf(stderr, "swan-wbgen: the key must be 32 or 64 hex digits\n");
+        return 2;
+    }
+    if (report)
+        return report_tiers(key, keysize, cfg.threads);
+
+    t = seconds();
+    wb = swan_wb_generate(key, keysize, &cfg);
+    t = seconds() - t;
+    if (wb == NULL)
+    {
+        fprintf(stderr, "swan-wbgen: cannot generate the tables\n");
+        return 1;
+    }
+    swan_set_key(&ctx, BLOCK128, keysize, key);
+    memset(key, 0, sizeof(key));
+    //every runtime this CPU has, the one in use last;
+    best = swan_wb_get_backend(wb);
+    for (b = SWAN_WB_SCALAR; b <= SWAN_WB_AVX2; b++)
+    {
+        if (b == (int)best || swan_wb_set_backend(wb, (swan_wb_backend)b) != 0)
+            continue;
+        if (check(wb, &ctx, cfg.dirs != 0 ? cfg.dirs : SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT, &ns) != 0)
+            break;
+    }
+    swan_wb_set_backend(wb, SWAN_WB_AUTO);
+    if (b <= SWAN_WB_AVX2 || check(wb, &ctx, cfg.dirs != 0 ? cfg.dirs : SWAN_WB_ENCRYPT | SWAN_WB_DECRYPT, &ns) != 0)
+    {
+        fprintf(stderr, "swan-wbgen: the tables do not match the reference cipher\n");
+        swan_wb_free(wb);
+        return 1;
+    }
+    memset(&ctx, 0, sizeof(ctx));
+    if (strcmp(path, "-") == 0)
+    {
+        b = publish(wb);
+        swan_wb_free(wb);
+        return b;
+    }
+    if (swan_wb_save(wb, path) != 0)
+    {
+        perror(path);
+        swan_wb_free(wb);
+        return 1;
+    }
+    if (!quiet)
+        fprintf(stderr, "swan-wbgen: SWAN128-%u, %zu bytes of tables in %.2f s, %.0f ns per block (%s)\n",
+                keysize, swan_wb_size(wb), t, ns, backend_name[best]);
+    swan_wb_free(wb);
+    return 0;
+}